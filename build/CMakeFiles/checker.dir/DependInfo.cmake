@@ -0,0 +1,23 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/compiler/checker.cpp" "CMakeFiles/checker.dir/checker.cpp.o" "gcc" "CMakeFiles/checker.dir/checker.cpp.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  "/root/repo/build/CMakeFiles/syntax.dir/DependInfo.cmake"
+  "/root/repo/build/CMakeFiles/core.dir/DependInfo.cmake"
+  "/root/repo/build/CMakeFiles/variant.dir/DependInfo.cmake"
+  "/root/repo/build/CMakeFiles/token.dir/DependInfo.cmake"
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
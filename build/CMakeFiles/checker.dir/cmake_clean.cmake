@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/checker.dir/checker.cpp.o"
+  "CMakeFiles/checker.dir/checker.cpp.o.d"
+  "libchecker.a"
+  "libchecker.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/checker.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
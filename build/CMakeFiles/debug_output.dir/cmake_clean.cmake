@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/debug_output.dir/debug_output.cpp.o"
+  "CMakeFiles/debug_output.dir/debug_output.cpp.o.d"
+  "libdebug_output.a"
+  "libdebug_output.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/debug_output.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/lexer.dir/lexer.cpp.o"
+  "CMakeFiles/lexer.dir/lexer.cpp.o.d"
+  "liblexer.a"
+  "liblexer.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/lexer.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/syntax.dir/syntax.cpp.o"
+  "CMakeFiles/syntax.dir/syntax.cpp.o.d"
+  "libsyntax.a"
+  "libsyntax.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/syntax.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
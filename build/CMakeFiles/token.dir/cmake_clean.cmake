@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/token.dir/token.cpp.o"
+  "CMakeFiles/token.dir/token.cpp.o.d"
+  "libtoken.a"
+  "libtoken.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/token.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -1,10 +1,13 @@
 #include "checker.hpp"
 
 #include "debug_output.hpp"
+#include "types.hpp"
 
+#include <algorithm>
 #include <map>
 #include <optional>
 #include <set>
+#include <span>
 #include <sstream>
 
 namespace aoc2022 {
@@ -26,6 +29,65 @@ std::string MakeMessage(Location location, const Args&... args) {
   return message.str();
 }
 
+// A pattern in a case alternative, which may contain further patterns.
+struct NestedPattern;
+
+struct MatchVariable {
+  Location location;
+  std::string name;
+};
+
+struct MatchConstructor {
+  std::shared_ptr<const core::UnionType> type;
+  int index;
+  std::vector<NestedPattern> elements;
+};
+
+struct MatchTuple {
+  std::vector<NestedPattern> elements;
+};
+
+struct NestedPattern {
+  Location location;
+  std::variant<MatchVariable, MatchConstructor, MatchTuple, core::Integer,
+               core::Character>
+      value;
+};
+
+// Returns true if `id` occurs anywhere within `x`.
+bool Mentions(const core::Expression& x, core::Identifier id) {
+  return std::visit(
+      [&](const auto& x) -> bool {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, core::Identifier>) {
+          return x == id;
+        } else if constexpr (std::is_same_v<T, core::Tuple>) {
+          return std::ranges::any_of(x.elements, [&](const auto& e) {
+            return Mentions(e, id);
+          });
+        } else if constexpr (std::is_same_v<T, core::Apply>) {
+          return Mentions(x.f, id) || Mentions(x.x, id);
+        } else if constexpr (std::is_same_v<T, core::Lambda>) {
+          return Mentions(x.result, id);
+        } else if constexpr (std::is_same_v<T, core::Let>) {
+          return Mentions(x.binding.value, id) || Mentions(x.value, id);
+        } else if constexpr (std::is_same_v<T, core::LetRecursive>) {
+          return Mentions(x.value, id) ||
+                 std::ranges::any_of(x.bindings, [&](const auto& b) {
+                   return Mentions(b.value, id);
+                 });
+        } else if constexpr (std::is_same_v<T, core::Case>) {
+          return Mentions(x.value, id) ||
+                 std::ranges::any_of(x.alternatives, [&](const auto& a) {
+                   return Mentions(a.value, id);
+                 });
+        } else {
+          return false;
+        }
+      },
+      x->value);
+}
+
 class Error : public std::runtime_error {
  public:
   template <typename... Args>
@@ -233,8 +295,7 @@ struct Checker {
     return core::Lambda(v, core::Apply(Check(x.f), core::Apply(Check(x.g), v)));
   }
 
-  core::Case::Alternative CheckAlternativeImpl(const syntax::Identifier& x,
-                                               const syntax::Expression& value) {
+  NestedPattern CheckPatternImpl(const syntax::Identifier& x) {
     if (IsTypeName(x.value)) {
       // The pattern is a type constructor with no arguments.
       const auto* u =
@@ -243,106 +304,59 @@ struct Checker {
       if (u->type->alternatives.at(u->index).num_members != 0) {
         throw Error(x.location, "wrong arity for data constructor");
       }
-      return core::Case::Alternative(core::MatchUnion(u->type, u->index, {}),
-                                     Check(value));
+      return NestedPattern(x.location, MatchConstructor(u->type, u->index, {}));
     }
-    const auto n = names.size();
-    core::Identifier variable = NextIdentifier(x.location);
-    names.push_back(
-        Name{.location = x.location, .name = x.value, .value = variable});
-    core::Expression result = Check(value);
-    names.erase(names.begin() + n, names.end());
-    return core::Case::Alternative(std::move(variable), std::move(result));
+    return NestedPattern(x.location, MatchVariable(x.location, x.value));
   }
 
-  core::Case::Alternative CheckAlternativeImpl(const syntax::Integer& x,
-                                               const syntax::Expression& value) {
-    return core::Case::Alternative(core::Integer(x.value), Check(value));
+  NestedPattern CheckPatternImpl(const syntax::Integer& x) {
+    return NestedPattern(x.location, core::Integer(x.value));
   }
 
-  core::Case::Alternative CheckAlternativeImpl(const syntax::Character& x,
-                                               const syntax::Expression& value) {
-    return core::Case::Alternative(core::Character(x.value), Check(value));
+  NestedPattern CheckPatternImpl(const syntax::Character& x) {
+    return NestedPattern(x.location, core::Character(x.value));
   }
 
-  core::Case::Alternative CheckAlternativeImpl(const syntax::String& x,
-                                               const syntax::Expression& value) {
-    if (x.value != "") {
-      throw Error(x.location, "non-empty string patterns are unimplemented");
+  NestedPattern CheckPatternImpl(const syntax::String& x) {
+    NestedPattern result(x.location, MatchConstructor(list_type, 1, {}));
+    for (int i = x.value.size() - 1; i >= 0; i--) {
+      result = ConsPattern(
+          x.location, NestedPattern(x.location, core::Character(x.value[i])),
+          std::move(result));
     }
-    return core::Case::Alternative(core::MatchUnion(list_type, 1, {}),
-                                   Check(value));
+    return result;
   }
 
-  core::Case::Alternative CheckAlternativeImpl(
-      const syntax::Cons& x, const syntax::Expression& value) {
-    const auto* head_identifier =
-        std::get_if<syntax::Identifier>(&x.head->value);
-    const auto* tail_identifier =
-        std::get_if<syntax::Identifier>(&x.tail->value);
-    if (!head_identifier) {
-      throw Error(x.head.location(), "nested patterns are unimplemented");
+  NestedPattern CheckPatternImpl(const syntax::List& x) {
+    NestedPattern result(x.location, MatchConstructor(list_type, 1, {}));
+    for (int i = x.elements.size() - 1; i >= 0; i--) {
+      result = ConsPattern(x.location, CheckPattern(x.elements[i]),
+                           std::move(result));
     }
-    if (!tail_identifier) {
-      throw Error(x.tail.location(), "nested patterns are unimplemented");
-    }
-    core::Identifier head = NextIdentifier(x.head.location());
-    core::Identifier tail = NextIdentifier(x.tail.location());
-    const auto n = names.size();
-    names.push_back(Name{
-        .location = x.location, .name = head_identifier->value, .value = head});
-    names.push_back(Name{
-        .location = x.location, .name = tail_identifier->value, .value = tail});
-    core::Expression result = Check(value);
-    names.erase(names.begin() + n, names.end());
-    return core::Case::Alternative(
-        core::MatchUnion(list_type, 0, {std::move(head), std::move(tail)}),
-        std::move(result));
+    return result;
   }
 
-  core::Case::Alternative CheckAlternativeImpl(
-      const syntax::Tuple& x, const syntax::Expression& value) {
-    const auto n = names.size();
-    std::vector<core::Identifier> elements;
-    for (const auto& element : x.elements) {
-      const auto* i = std::get_if<syntax::Identifier>(&element->value);
-      if (!i) {
-        throw Error(element.location(), "nested patterns are unimplemented");
-      }
-      const core::Identifier id = NextIdentifier(element.location());
-      elements.push_back(id);
-      names.push_back(Name{
-          .location = i->location, .name = i->value, .value = id});
-    }
-    core::Expression result = Check(value);
-    names.erase(names.begin() + n, names.end());
-    return core::Case::Alternative(core::MatchTuple(std::move(elements)),
-                                   std::move(result));
+  NestedPattern CheckPatternImpl(const syntax::Cons& x) {
+    return ConsPattern(x.location, CheckPattern(x.head), CheckPattern(x.tail));
   }
 
-  core::Case::Alternative CheckAlternativeImpl(
-      const syntax::List& x, const syntax::Expression& value) {
-    if (!x.elements.empty()) {
-      throw Error(x.location, "non-empty list patterns are unimplemented");
+  NestedPattern CheckPatternImpl(const syntax::Tuple& x) {
+    std::vector<NestedPattern> elements;
+    for (const auto& element : x.elements) {
+      elements.push_back(CheckPattern(element));
     }
-    return core::Case::Alternative(core::MatchUnion(list_type, 1, {}),
-                                   Check(value));
+    return NestedPattern(x.location, MatchTuple(std::move(elements)));
   }
 
-  core::Case::Alternative CheckAlternativeImpl(
-      const syntax::Apply& x, const syntax::Expression& value) {
+  NestedPattern CheckPatternImpl(const syntax::Apply& x) {
     // An application in a pattern must be a data constructor pattern. We need
     // to unwrap all the Apply nodes. Since Apply nodes are left-associative,
     // the unwrapping will produce the parameters in reverse order, so they must
     // then be examined in reverse.
-    std::vector<const syntax::Identifier*> parameters;
+    std::vector<const syntax::Expression*> parameters;
     const syntax::Apply* e = &x;
     while (true) {
-      const auto* i = std::get_if<syntax::Identifier>(&e->x->value);
-      if (!i) {
-        throw Error(e->x.location(), "illegal pattern expression");
-      }
-      parameters.push_back(i);
+      parameters.push_back(&e->x);
       if (const auto* a = std::get_if<syntax::Apply>(&e->f->value)) {
         e = a;
       } else {
@@ -358,43 +372,259 @@ struct Checker {
     if ((int)parameters.size() != arity) {
       throw Error(c->location, "wrong arity for data constructor");
     }
-    const int n = names.size();
-    std::vector<core::Identifier> elements;
+    std::vector<NestedPattern> elements;
     for (int i = parameters.size() - 1; i >= 0; i--) {
-      const core::Identifier id = NextIdentifier(parameters[i]->location);
-      names.push_back(Name{.location = parameters[i]->location,
-                           .name = parameters[i]->value,
-                           .value = id});
-      elements.push_back(id);
-    }
-    core::Pattern pattern =
-        core::MatchUnion(u->type, u->index, std::move(elements));
-    core::Expression result = Check(value);
-    names.erase(names.begin() + n, names.end());
-    return core::Case::Alternative(std::move(pattern), std::move(result));
+      elements.push_back(CheckPattern(*parameters[i]));
+    }
+    return NestedPattern(
+        x.location, MatchConstructor(u->type, u->index, std::move(elements)));
   }
 
-  core::Case::Alternative CheckAlternativeImpl(const auto& x,
-                                               const syntax::Expression&) {
+  NestedPattern CheckPatternImpl(const auto& x) {
     throw Error(x.location, "illegal pattern expression");
   }
 
-  core::Case::Alternative CheckAlternative(
-      const syntax::Alternative& alternative) {
+  NestedPattern CheckPattern(const syntax::Expression& x) {
+    return std::visit([&](const auto& x) { return CheckPatternImpl(x); },
+                      x->value);
+  }
+
+  NestedPattern ConsPattern(Location location, NestedPattern head,
+                            NestedPattern tail) {
+    std::vector<NestedPattern> elements;
+    elements.push_back(std::move(head));
+    elements.push_back(std::move(tail));
+    return NestedPattern(location,
+                         MatchConstructor(list_type, 0, std::move(elements)));
+  }
+
+  // A row of the pattern matrix: the patterns which the remaining columns
+  // must match (where a null pattern matches anything), the variables which
+  // have been bound so far, and the expression to evaluate if all of them
+  // match.
+  struct Row {
+    std::vector<const NestedPattern*> patterns;
+    std::vector<std::pair<const MatchVariable*, core::Identifier>> bindings;
+    const syntax::Expression* value;
+  };
+
+  static bool IsIrrefutable(const NestedPattern* pattern) {
+    return !pattern || std::holds_alternative<MatchVariable>(pattern->value);
+  }
+
+  // Identifies which values a refutable pattern tests for: the constructor
+  // index, the literal value, or 0 for a tuple.
+  static std::int64_t Key(const NestedPattern& pattern) {
     return std::visit(
-        [&](const auto& x) {
-          return CheckAlternativeImpl(x, alternative.value);
+        [](const auto& x) -> std::int64_t {
+          using T = std::decay_t<decltype(x)>;
+          if constexpr (std::is_same_v<T, MatchConstructor>) {
+            return x.index;
+          } else if constexpr (std::is_same_v<T, core::Integer> ||
+                               std::is_same_v<T, core::Character>) {
+            return x.value;
+          } else {
+            return 0;
+          }
         },
-        alternative.pattern->value);
+        pattern.value);
+  }
+
+  static bool SameType(const NestedPattern& a, const NestedPattern& b) {
+    if (a.value.index() != b.value.index()) return false;
+    if (const auto* x = std::get_if<MatchConstructor>(&a.value)) {
+      return x->type->id == std::get<MatchConstructor>(b.value).type->id;
+    }
+    if (const auto* x = std::get_if<MatchTuple>(&a.value)) {
+      return x->elements.size() ==
+             std::get<MatchTuple>(b.value).elements.size();
+    }
+    return true;
+  }
+
+  static std::span<const NestedPattern> Elements(const NestedPattern& pattern) {
+    if (const auto* x = std::get_if<MatchConstructor>(&pattern.value)) {
+      return x->elements;
+    }
+    if (const auto* x = std::get_if<MatchTuple>(&pattern.value)) {
+      return x->elements;
+    }
+    return {};
+  }
+
+  // Compiles a pattern matrix into a decision tree of flat case expressions.
+  // Each case examines one column, which is chosen as the leftmost refutable
+  // pattern in the first row, so values are only ever examined if the first
+  // alternative which could still match would have examined them too. Each
+  // value is examined at most once on any path through the tree, at the cost
+  // of duplicating alternatives which are reachable along several paths.
+  core::Expression Match(const std::vector<core::Identifier>& columns,
+                         const std::vector<Row>& rows) {
+    const Row& first = rows.front();
+    int j = 0;
+    const int n = columns.size();
+    while (j < n && IsIrrefutable(first.patterns[j])) j++;
+    if (j == n) {
+      // The first row matches unconditionally.
+      const auto num_names = names.size();
+      auto bind = [&](const MatchVariable& v, core::Identifier id) {
+        names.push_back(
+            Name{.location = v.location, .name = v.name, .value = id});
+      };
+      for (const auto& [variable, id] : first.bindings) bind(*variable, id);
+      for (int i = 0; i < n; i++) {
+        if (first.patterns[i]) {
+          bind(std::get<MatchVariable>(first.patterns[i]->value), columns[i]);
+        }
+      }
+      core::Expression result = Check(*first.value);
+      names.erase(names.begin() + num_names, names.end());
+      return result;
+    }
+
+    // Every distinct head in column j gets a branch of its own, in the order
+    // in which they first appear.
+    const NestedPattern& head = *first.patterns[j];
+    std::vector<const NestedPattern*> heads;
+    std::set<std::int64_t> seen;
+    for (const Row& row : rows) {
+      const NestedPattern* pattern = row.patterns[j];
+      if (IsIrrefutable(pattern)) continue;
+      if (!SameType(head, *pattern)) {
+        throw Error(pattern->location,
+                    "pattern does not match the type of earlier patterns");
+      }
+      if (seen.insert(Key(*pattern)).second) heads.push_back(pattern);
+    }
+
+    // Rows which don't examine column j remain in every branch.
+    auto keep = [&](const Row& row, int num_fields) {
+      Row result{.patterns = {},
+                 .bindings = row.bindings,
+                 .value = row.value};
+      for (int i = 0; i < n; i++) {
+        if (i != j) {
+          result.patterns.push_back(row.patterns[i]);
+          continue;
+        }
+        const NestedPattern* pattern = row.patterns[i];
+        const MatchVariable* variable =
+            pattern ? std::get_if<MatchVariable>(&pattern->value) : nullptr;
+        if (variable) result.bindings.emplace_back(variable, columns[i]);
+        result.patterns.insert(result.patterns.end(), num_fields, nullptr);
+      }
+      return result;
+    };
+
+    std::vector<core::Case::Alternative> alternatives;
+    for (const NestedPattern* pattern : heads) {
+      const std::int64_t key = Key(*pattern);
+      const int num_fields = Elements(*pattern).size();
+      std::vector<core::Identifier> fields;
+      for (int i = 0; i < num_fields; i++) {
+        fields.push_back(NextIdentifier(pattern->location));
+      }
+      std::vector<core::Identifier> branch_columns = columns;
+      branch_columns.erase(branch_columns.begin() + j);
+      branch_columns.insert(branch_columns.begin() + j, fields.begin(),
+                            fields.end());
+      std::vector<Row> branch_rows;
+      for (const Row& row : rows) {
+        const NestedPattern* p = row.patterns[j];
+        if (IsIrrefutable(p)) {
+          branch_rows.push_back(keep(row, num_fields));
+        } else if (Key(*p) == key) {
+          Row result = keep(row, 0);
+          std::vector<const NestedPattern*> elements;
+          for (const NestedPattern& element : Elements(*p)) {
+            elements.push_back(&element);
+          }
+          result.patterns.insert(result.patterns.begin() + j,
+                                 elements.begin(), elements.end());
+          branch_rows.push_back(std::move(result));
+        }
+      }
+      core::Expression value = Match(branch_columns, branch_rows);
+      core::Pattern match = std::visit(
+          [&](const auto& x) -> core::Pattern {
+            using T = std::decay_t<decltype(x)>;
+            if constexpr (std::is_same_v<T, MatchConstructor>) {
+              return core::MatchUnion(x.type, x.index, std::move(fields));
+            } else if constexpr (std::is_same_v<T, MatchTuple>) {
+              return core::MatchTuple(std::move(fields));
+            } else if constexpr (std::is_same_v<T, MatchVariable>) {
+              throw std::logic_error("variable in a refutable position");
+            } else {
+              return x;
+            }
+          },
+          pattern->value);
+      alternatives.push_back(
+          core::Case::Alternative(std::move(match), std::move(value)));
+    }
+
+    // If the heads don't cover every possible value, the remaining values are
+    // matched by the rows which don't examine column j.
+    bool exhaustive = std::holds_alternative<MatchTuple>(head.value);
+    if (const auto* c = std::get_if<MatchConstructor>(&head.value)) {
+      exhaustive = heads.size() == c->type->alternatives.size();
+    }
+    if (!exhaustive) {
+      std::vector<core::Identifier> default_columns = columns;
+      default_columns.erase(default_columns.begin() + j);
+      std::vector<Row> default_rows;
+      for (const Row& row : rows) {
+        if (IsIrrefutable(row.patterns[j])) {
+          default_rows.push_back(keep(row, 0));
+        }
+      }
+      if (!default_rows.empty()) {
+        alternatives.push_back(
+            core::Case::Alternative(NextIdentifier(head.location),
+                                    Match(default_columns, default_rows)));
+      }
+    }
+    return core::Case(columns[j], std::move(alternatives));
   }
 
   core::Expression Check(const syntax::Case& x) {
     core::Expression value = Check(x.value);
-    std::vector<core::Case::Alternative> alternatives;
+    if (x.alternatives.empty()) throw Error(x.location, "no case alternatives");
+    std::vector<NestedPattern> patterns;
     for (const auto& alternative : x.alternatives) {
-      alternatives.push_back(CheckAlternative(alternative));
+      patterns.push_back(CheckPattern(alternative.pattern));
+    }
+    std::vector<Row> rows;
+    for (int i = 0, n = x.alternatives.size(); i < n; i++) {
+      rows.push_back(Row{.patterns = {&patterns[i]},
+                         .bindings = {},
+                         .value = &x.alternatives[i].value});
+    }
+    const core::Identifier scrutinee = NextIdentifier(x.location);
+    core::Expression result = Match({scrutinee}, rows);
+    // The decision tree usually starts by examining the scrutinee, in which
+    // case it can examine the value directly. That only needs a variable for
+    // the scrutinee if some alternative refers to the value as a whole, and
+    // the catch-all alternative can bind it.
+    const auto* c = std::get_if<core::Case>(&result->value);
+    const auto* examined =
+        c ? std::get_if<core::Identifier>(&c->value->value) : nullptr;
+    if (!examined || *examined != scrutinee) {
+      return core::Case(
+          std::move(value),
+          {core::Case::Alternative(scrutinee, std::move(result))});
+    }
+    std::vector<core::Case::Alternative> alternatives = c->alternatives;
+    for (auto& alternative : alternatives) {
+      if (std::holds_alternative<core::Identifier>(
+              alternative.pattern->value)) {
+        alternative.pattern = scrutinee;
+      } else if (Mentions(alternative.value, scrutinee)) {
+        return core::Case(
+            std::move(value),
+            {core::Case::Alternative(scrutinee, std::move(result))});
+      }
     }
-    if (alternatives.empty()) throw Error(x.location, "no case alternatives");
     return core::Case(std::move(value), std::move(alternatives));
   }
 
@@ -435,6 +665,7 @@ struct Checker {
                            .name = definition.name.value,
                            .value = name});
       definitions.push_back(BindingData{name, &definition});
+      globals.emplace(definition.name.value, name);
     }
 
     std::vector<core::Binding> bindings;
@@ -464,14 +695,83 @@ struct Checker {
         [&](const auto& x) -> core::Expression { return Check(x); }, x->value);
   }
 
+  // Converts a type expression in a data definition into a type, where
+  // `parameters` are the parameters of the type being defined.
+  core::Type CheckType(const syntax::Expression& x,
+                       std::span<const syntax::Identifier> parameters) {
+    std::vector<core::Type> arguments;
+    const syntax::Expression* head = &x;
+    while (auto* apply = std::get_if<syntax::Apply>(&(*head)->value)) {
+      arguments.push_back(CheckType(apply->x, parameters));
+      head = &apply->f;
+    }
+    std::ranges::reverse(arguments);
+    if (auto* list = std::get_if<syntax::List>(&(*head)->value)) {
+      if (list->elements.size() == 1 && arguments.empty()) {
+        return core::Type{
+            .kind = core::Type::Kind::kUnion,
+            .id = (int)core::UnionType::Id::kList,
+            .arguments = {CheckType(list->elements[0], parameters)}};
+      }
+    } else if (auto* tuple = std::get_if<syntax::Tuple>(&(*head)->value)) {
+      if (arguments.empty()) {
+        core::Type result = {.kind = core::Type::Kind::kTuple};
+        for (const auto& element : tuple->elements) {
+          result.arguments.push_back(CheckType(element, parameters));
+        }
+        return result;
+      }
+    } else if (auto* name = std::get_if<syntax::Identifier>(&(*head)->value)) {
+      if (!IsTypeName(name->value)) {
+        auto i = std::ranges::find(parameters, name->value,
+                                   &syntax::Identifier::value);
+        if (i == parameters.end()) {
+          throw Error(name->location, "use of undefined type variable");
+        }
+        if (!arguments.empty()) {
+          throw Error(name->location, "type variable applied to arguments");
+        }
+        return core::Type{.kind = core::Type::Kind::kVariable,
+                          .id = -1 - (int)(i - parameters.begin())};
+      }
+      auto i = types.find(name->value);
+      if (i == types.end()) {
+        throw Error(name->location, "use of undefined type");
+      }
+      if ((int)arguments.size() != i->second.num_parameters) {
+        throw Error(name->location, "wrong number of arguments for type");
+      }
+      if (i->second.id) {
+        return core::Type{.kind = core::Type::Kind::kUnion,
+                          .id = (int)*i->second.id,
+                          .arguments = std::move(arguments)};
+      }
+      return i->second.type;
+    }
+    throw Error(x.location(), "illegal type expression");
+  }
+
   void Check(const syntax::DataDefinition& x) {
-    const core::UnionType::Id id = NextUnion(x.location);
+    const core::UnionType::Id id = *types.at(x.name.value).id;
+    for (int i = 0, n = x.parameters.size(); i < n; i++) {
+      for (int j = 0; j < i; j++) {
+        if (x.parameters[i].value == x.parameters[j].value) {
+          throw Error(x.parameters[i].location, "redefinition of ",
+                      x.parameters[i].value);
+        }
+      }
+    }
     std::vector<core::TupleType> alternatives;
     for (const auto& alternative : x.alternatives) {
-      alternatives.push_back(core::TupleType(alternative.members.size()));
+      std::vector<core::Type> members;
+      for (const auto& member : alternative.members) {
+        members.push_back(CheckType(member, x.parameters));
+      }
+      alternatives.push_back(
+          core::TupleType(alternative.members.size(), std::move(members)));
     }
-    const auto type =
-        std::make_shared<core::UnionType>(id, std::move(alternatives));
+    const auto type = std::make_shared<core::UnionType>(
+        id, std::move(alternatives), x.name.value, x.parameters.size());
     for (int i = 0, n = x.alternatives.size(); i < n; i++) {
       if (TryLookup(x.alternatives[i].name.value)) {
         throw Error(x.alternatives[i].location, "redefinition of ",
@@ -484,6 +784,18 @@ struct Checker {
   }
 
   core::Expression Check(const syntax::Program& program) {
+    // Data definitions may refer to each other in any order, so all of the
+    // type names are introduced before any of the definitions are checked.
+    for (const auto& data_definition : program.data_definitions) {
+      if (types.contains(data_definition.name.value)) {
+        throw Error(data_definition.name.location, "redefinition of ",
+                    data_definition.name.value);
+      }
+      types.emplace(data_definition.name.value,
+                    TypeName{.id = NextUnion(data_definition.location),
+                             .num_parameters =
+                                 (int)data_definition.parameters.size()});
+    }
     for (const auto& data_definition : program.data_definitions) {
       Check(data_definition);
     }
@@ -502,6 +814,7 @@ struct Checker {
                            .name = definition.name.value,
                            .value = name});
       definitions.push_back(BindingData{name, &definition});
+      globals.emplace(definition.name.value, name);
     }
 
     std::vector<core::Binding> bindings;
@@ -511,11 +824,27 @@ struct Checker {
 
     const Name* main = TryLookup("main");
     if (!main) throw Error(program.end, "no definition for main");
-    return core::LetRecursive(std::move(bindings), main->value);
+    core::Expression result =
+        core::LetRecursive(std::move(bindings), main->value);
+    try {
+      // The program is applied to the puzzle input and produces the output.
+      const core::Type string = {
+          .kind = core::Type::Kind::kUnion,
+          .id = (int)core::UnionType::Id::kList,
+          .arguments = {core::Type{.kind = core::Type::Kind::kChar}}};
+      InferTypes(result, core::Type{.kind = core::Type::Kind::kFunction,
+                                    .arguments = {string, string}});
+    } catch (const TypeError& error) {
+      throw Error(error.context ? locations[(int)*error.context]
+                                : main->location,
+                  error.what());
+    }
+    return result;
   }
 
-  core::Identifier NextIdentifier(Location) {
+  core::Identifier NextIdentifier(Location location) {
     core::Identifier next = core::Identifier(next_id++);
+    locations.push_back(location);
     return next;
   }
 
@@ -531,16 +860,38 @@ struct Checker {
         std::move(tail));
   }
 
+  // A type name, which either refers to a union type or is an alias for
+  // another type.
+  struct TypeName {
+    std::optional<core::UnionType::Id> id;
+    int num_parameters = 0;
+    core::Type type = {.kind = core::Type::Kind::kVariable};
+  };
+
   int next_id = 0;
+  // The location at which each identifier was introduced.
+  std::vector<Location> locations;
+  std::map<std::string, core::Identifier> globals;
+  std::map<std::string, TypeName> types = {
+      {"Bool",
+       TypeName{.id = core::UnionType::Id::kBool, .num_parameters = 0}},
+      {"Char",
+       TypeName{.id = std::nullopt,
+                .type = {.kind = core::Type::Kind::kChar}}},
+      {"Int",
+       TypeName{.id = std::nullopt,
+                .type = {.kind = core::Type::Kind::kInt}}},
+      {"String",
+       TypeName{.id = std::nullopt,
+                .type = {.kind = core::Type::Kind::kUnion,
+                         .id = (int)core::UnionType::Id::kList,
+                         .arguments = {{.kind = core::Type::Kind::kChar}}}}},
+  };
   core::UnionType::Id next_union = core::UnionType::Id::kFirstUserType;
   const std::shared_ptr<const core::UnionType> bool_type =
-      std::make_unique<core::UnionType>(
-          core::UnionType::Id::kBool,
-          std::vector<core::TupleType>{core::TupleType(0), core::TupleType(0)});
+      core::BoolType();
   const std::shared_ptr<const core::UnionType> list_type =
-      std::make_unique<core::UnionType>(
-          core::UnionType::Id::kList,
-          std::vector<core::TupleType>{core::TupleType(2), core::TupleType(0)});
+      core::ListType();
   const core::Expression nil = core::UnionConstructor(list_type, 1);
   std::vector<Name> names = {
       Name{.location = kBuiltinLocation,
@@ -580,4 +931,12 @@ core::Expression Check(const syntax::Program& program) {
   return checker.Check(program);
 }
 
+core::Expression Check(const syntax::Program& program,
+                       std::map<std::string, core::Identifier>& definitions) {
+  Checker checker;
+  core::Expression result = checker.Check(program);
+  definitions = std::move(checker.globals);
+  return result;
+}
+
 }  // namespace aoc2022
@@ -4,10 +4,18 @@
 #include "syntax.hpp"
 #include "core.hpp"
 
+#include <map>
+#include <string>
+
 namespace aoc2022 {
 
 core::Expression Check(const syntax::Program&);
 
+// As above, but also reports which identifier each top-level definition was
+// given.
+core::Expression Check(const syntax::Program&,
+                       std::map<std::string, core::Identifier>& definitions);
+
 }  // namespace aoc2022
 
 #endif  // AOC2022_CHECKER_HPP_
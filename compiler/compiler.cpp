@@ -3,10 +3,13 @@
 #include "parser.hpp"
 #include "checker.hpp"
 #include "interpreter.hpp"
+#include "simplifier.hpp"
 
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <string>
+#include <string_view>
 
 std::string GetContents(const char* filename) {
   std::ifstream file(filename);
@@ -26,11 +29,13 @@ null xs =
     [] -> True
     xs -> False
 
-length xs = length' 0 xs
-length' n xs =
-  case xs of
-    [] -> n
-    (x : xs') -> length' (n + 1) xs'
+-- The simplifier rewrites foldr f e (build g) to g f e, so a list which is
+-- produced with build and consumed with foldr is never allocated.
+build g = g consFB []
+consFB x xs = x : xs
+
+length xs = foldl lengthFB 0 xs
+lengthFB n x = n + 1
 
 elem x xs =
   case xs of
@@ -56,15 +61,13 @@ tails xs =
     [] -> [[]]
     (x : xs') -> xs : tails xs'
 
-map f xs =
-  case xs of
-    [] -> []
-    (x : xs') -> f x : map f xs'
+map f xs = build (mapFB f xs)
+mapFB f xs c n = foldr (mapFB' c f) n xs
+mapFB' c f x ys = c (f x) ys
 
-filter p xs =
-  case xs of
-    [] -> []
-    (x : xs') -> if p x then x : filter p xs' else filter p xs'
+filter p xs = build (filterFB p xs)
+filterFB p xs c n = foldr (filterFB' c p) n xs
+filterFB' c p x ys = if p x then c x ys else ys
 
 reverse = reverse' []
 reverse' sx xs =
@@ -72,10 +75,8 @@ reverse' sx xs =
     [] -> sx
     (x : xs') -> reverse' (x : sx) xs'
 
-concat xs =
-  case xs of
-    [] -> []
-    (x : xs') -> x ++ concat xs'
+concat xs = foldr concatFB [] xs
+concatFB xs ys = xs ++ ys
 
 take n xs =
   case xs of
@@ -95,15 +96,16 @@ drop n xs =
       else
         drop (n - 1) xs'
 
-split c = split' c []
-split' c first xs =
+split c xs = build (splitFB c xs)
+splitFB c xs cons nil = splitFB' c cons nil [] xs
+splitFB' c cons nil first xs =
   case xs of
-    [] -> if null first then [] else [reverse first]
+    [] -> if null first then nil else cons (reverse first) nil
     (x : xs') ->
       if x == c then
-        reverse first : split c xs'
+        cons (reverse first) (splitFB' c cons nil [] xs')
       else
-        split' c (x : first) xs'
+        splitFB' c cons nil (x : first) xs'
 
 lines = split '\n'
 words = split ' '
@@ -122,16 +124,11 @@ foldr f e xs =
     [] -> e
     (x : xs') -> f x (foldr f e xs')
 
-foldl f e xs =
-  case xs of
-    [] -> e
-    (x : xs') -> foldl f (f e x) xs'
+foldl f e xs = foldr (foldlFB f) id xs e
+foldlFB f x k e = k (f e x)
 
-sum xs = sum' 0 xs
-sum' n xs =
-  case xs of
-    [] -> n
-    (x : xs') -> sum' (n + x) xs'
+sum xs = foldl sumFB 0 xs
+sumFB n x = n + x
 
 partition p = partition' p [] []
 partition' p ls rs xs =
@@ -164,14 +161,10 @@ max a b = if a < b then b else a
 minimum xs = foldl min (head xs) (tail xs)
 maximum xs = foldl max (head xs) (tail xs)
 
-all f xs =
-  case xs of
-    [] -> True
-    (x : xs') -> f x && all f xs'
-any f xs =
-  case xs of
-    [] -> False
-    (x : xs') -> f x || any f xs'
+all f xs = foldr (allFB f) True xs
+allFB f x r = f x && r
+any f xs = foldr (anyFB f) False xs
+anyFB f x r = f x || r
 
 fst x = case x of
   (a, b) -> a
@@ -185,8 +178,31 @@ iterate f x = x : iterate f (f x)
 )"};
 
 int main(int argc, char* argv[]) {
-  if (argc != 2) {
-    std::cerr << "Usage: compiler <filename>\n";
+  aoc2022::Backend backend = aoc2022::Backend::kBytecode;
+  bool print_stats = false;
+  aoc2022::SimplifierOptions options;
+  const char* filename = nullptr;
+  for (int i = 1; i < argc; i++) {
+    const std::string_view arg = argv[i];
+    if (arg == "--backend=tree") {
+      backend = aoc2022::Backend::kTree;
+    } else if (arg == "--backend=bytecode") {
+      backend = aoc2022::Backend::kBytecode;
+    } else if (arg == "--stats") {
+      print_stats = true;
+    } else if (arg.size() == 3 && arg.starts_with("-O") && '0' <= arg[2] &&
+               arg[2] <= '0' + aoc2022::kMaxOptimizationLevel) {
+      options.level = arg[2] - '0';
+    } else if (!arg.starts_with("-") && !filename) {
+      filename = argv[i];
+    } else {
+      filename = nullptr;
+      break;
+    }
+  }
+  if (!filename) {
+    std::cerr << "Usage: compiler [--backend=tree|bytecode] [--stats] "
+                 "[-O0|-O1|-O2|-O3] <filename>\n";
     return 1;
   }
 
@@ -194,13 +210,21 @@ int main(int argc, char* argv[]) {
   const std::vector<aoc2022::Token> prelude_tokens = aoc2022::Lex(kPrelude);
   const aoc2022::syntax::Program prelude = aoc2022::Parse(prelude_tokens);
 
-  const std::string contents = GetContents(argv[1]);
-  const aoc2022::Source source = {.filename = argv[1], .contents = contents};
+  const std::string contents = GetContents(filename);
+  const aoc2022::Source source = {.filename = filename, .contents = contents};
   const std::vector<aoc2022::Token> tokens = aoc2022::Lex(source);
   aoc2022::syntax::Program program = aoc2022::Parse(tokens);
   program.definitions.insert(program.definitions.end(),
                              prelude.definitions.begin(),
                              prelude.definitions.end());
-  const aoc2022::core::Expression ir = aoc2022::Check(program);
-  aoc2022::Run(ir);
+  std::map<std::string, aoc2022::core::Identifier> definitions;
+  const aoc2022::core::Expression checked =
+      aoc2022::Check(program, definitions);
+  options.foldr = definitions.at("foldr");
+  options.build = definitions.at("build");
+  aoc2022::SimplifierStats stats;
+  const aoc2022::core::Expression ir =
+      aoc2022::Simplify(checked, options, stats);
+  if (print_stats) std::cerr << stats << '\n';
+  aoc2022::Run(ir, backend);
 }
@@ -1 +1,25 @@
 #include "core.hpp"
+
+namespace aoc2022::core {
+
+const std::shared_ptr<const UnionType>& BoolType() {
+  static const std::shared_ptr<const UnionType> type =
+      std::make_shared<UnionType>(UnionType::Id::kBool,
+                                  std::vector<TupleType>{{0}, {0}}, "Bool");
+  return type;
+}
+
+const std::shared_ptr<const UnionType>& ListType() {
+  // Lists have a single parameter, which is the type of their elements.
+  const Type element = {.kind = Type::Kind::kVariable, .id = -1};
+  const Type list = {.kind = Type::Kind::kUnion,
+                     .id = (int)UnionType::Id::kList,
+                     .arguments = {element}};
+  static const std::shared_ptr<const UnionType> type =
+      std::make_shared<UnionType>(
+          UnionType::Id::kList,
+          std::vector<TupleType>{{2, {element, list}}, {0}}, "List", 1);
+  return type;
+}
+
+}  // namespace aoc2022::core
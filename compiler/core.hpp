@@ -5,15 +5,39 @@
 #include "variant.hpp"
 
 #include <memory>
+#include <string>
 #include <vector>
 
 namespace aoc2022::core {
 
 enum class Identifier : int {};
 
+// A type inferred by the type checker. Type variables with non-negative ids
+// stand for unknown types, and those with negative ids are the parameters of a
+// polymorphic type, numbered from -1 in order.
+struct Type {
+  enum class Kind {
+    kVariable,
+    kInt,
+    kChar,
+    // A function from the first argument to the second.
+    kFunction,
+    kTuple,
+    // The union type with the id given by `id`, applied to one argument for
+    // each of its parameters.
+    kUnion,
+  };
+  bool operator==(const Type&) const = default;
+  Kind kind;
+  int id = 0;
+  std::vector<Type> arguments = {};
+};
+
 struct TupleType {
   bool operator==(const TupleType&) const = default;
   int num_members;
+  // The type of each member, in terms of the parameters of the union type.
+  std::vector<Type> members = {};
 };
 
 struct UnionType {
@@ -25,8 +49,15 @@ struct UnionType {
   bool operator==(const UnionType&) const = default;
   Id id;
   std::vector<TupleType> alternatives;
+  std::string name = {};
+  int num_parameters = 0;
 };
 
+// The built-in union types: Bool, with False and True, and lists, with (:)
+// and [].
+const std::shared_ptr<const UnionType>& BoolType();
+const std::shared_ptr<const UnionType>& ListType();
+
 struct PatternVariant;
 class Pattern {
  public:
@@ -2,13 +2,22 @@
 
 #include "debug_output.hpp"
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <cassert>
+#include <cerrno>
 #include <charconv>
+#include <csetjmp>
+#include <cstring>
 #include <map>
+#include <optional>
 #include <set>
 #include <span>
-#include <iostream>
 #include <sstream>
+#include <string_view>
 
 namespace aoc2022 {
 namespace {
@@ -19,405 +28,2978 @@ std::string StrCat(const auto&... args) {
   return output.str();
 }
 
-struct Node {
-  virtual ~Node() = default;
+class Heap;
+
+// Nodes are allocated in the garbage-collected heap. They are relocated by
+// copying their bytes and dead nodes are never destroyed, so every node type
+// must be trivially destructible and must not hold pointers into itself.
+//
+// The header is two words: the vtable pointer and the fields below. Once a
+// node has been evacuated, its vtable pointer is overwritten with the address
+// of the new copy. The fields only fill half of the second word, and the rest
+// is left for the type tags of values and thunks and for the small fields of
+// the most common nodes, so that a cons cell is just the header and its two
+// fields.
+struct Node {
+  // Updates every node pointer held by this node to refer to the live copy of
+  // the target, evacuating the target if it has not already been copied.
+  virtual void Trace(Heap& heap) = 0;
+
+  // The header belongs to the allocation rather than the value, so it is not
+  // copied when one node is assigned over another.
+  Node() = default;
+  Node(const Node&) {}
+  Node& operator=(const Node&) { return *this; }
+
+  Node* forward() const {
+    Node* result;
+    std::memcpy(&result, this, sizeof(result));
+    return result;
+  }
+  void set_forward(Node* copy) {
+    std::memcpy(static_cast<void*>(this), &copy, sizeof(copy));
+    forwarded = true;
+  }
+
+  // Size of the allocation, including any trailing elements.
+  std::uint32_t size = 0;
+  // The flags are packed into one byte so that subclasses can place their own
+  // small fields in the tail padding of the header.
+  //
+  // Set on the old copy of a node once it has been evacuated.
+  bool forwarded : 1 = false;
+  // Set once a node has survived a collection, at which point it belongs to
+  // the old generation.
+  bool old : 1 = false;
+  // Set while an old node is in the remembered set.
+  bool remembered : 1 = false;
+};
+
+// Small integers, characters and booleans are never allocated. Instead, they
+// are encoded directly in the bits of a node pointer, which can be told apart
+// from a real one because nodes are word-aligned. The low bit of an immediate
+// is set, the next two bits hold its kind, and the rest hold its payload. An
+// evaluated Lazy whose value is immediate is encoded in exactly the same way,
+// so these values never touch the heap at all.
+enum class Immediate : std::uintptr_t {
+  kInt64 = 0b001,
+  kChar = 0b011,
+  kBool = 0b101,
+};
+
+constexpr int kImmediateBits = 3;
+
+inline bool IsImmediate(const Node* node) {
+  return reinterpret_cast<std::uintptr_t>(node) & 1;
+}
+
+inline Immediate KindOf(const Node* node) {
+  return static_cast<Immediate>(reinterpret_cast<std::uintptr_t>(node) &
+                                ((1 << kImmediateBits) - 1));
+}
+
+inline std::int64_t PayloadOf(const Node* node) {
+  return reinterpret_cast<std::intptr_t>(node) >> kImmediateBits;
+}
+
+template <std::derived_from<Node> T>
+T* MakeImmediate(Immediate kind, std::int64_t payload) {
+  return reinterpret_cast<T*>(static_cast<std::uintptr_t>(payload)
+                                  << kImmediateBits |
+                              static_cast<std::uintptr_t>(kind));
+}
+
+// Returns the elements of a variable-sized node, which are stored directly
+// after the node itself.
+template <typename E, typename T>
+std::span<E> TrailingElements(T* node, std::size_t n) {
+  return std::span<E>(reinterpret_cast<E*>(node + 1), n);
+}
+
+// A generational copying garbage collector. The heap is a single reserved
+// region of address space which is carved into aligned blocks. New nodes are
+// bump-allocated into the blocks of the nursery. A collection evacuates every
+// reachable node into freshly claimed blocks using Cheney's algorithm and then
+// releases the old blocks wholesale, so its cost is proportional to the amount
+// of live data rather than the size of the heap.
+//
+// Most collections are minor: only the nursery is evacuated, and survivors are
+// promoted straight into the old generation. Old nodes are only traced during
+// a minor collection if they are in the remembered set, so every store which
+// might make an old node point at a young one must be followed by a call to
+// WriteBarrier. Once the old generation has grown enough since the last major
+// collection, the next collection evacuates both generations.
+//
+// The evaluator holds raw node pointers (including `this`) in native stack
+// frames across allocations, so the native stack is scanned conservatively.
+// Any block which appears to be referenced from the stack is pinned: it is
+// promoted to the new space in place and its nodes are treated as roots
+// (Bartlett's mostly-copying collection). All other roots are precise.
+//
+// Immediate values are not nodes, so the collector leaves them as they are.
+class Heap {
+ public:
+  static constexpr int kBlockBits = 16;
+  static constexpr std::size_t kBlockSize = std::size_t(1) << kBlockBits;
+  static constexpr std::size_t kReservedSize = std::size_t(1) << 36;
+  static constexpr std::size_t kNurserySize = 1 << 22;
+  static constexpr std::size_t kMaxNurserySize = 1 << 28;
+  static constexpr std::size_t kMinimumCollectionSize = 1 << 24;
+
+  Heap();
+  ~Heap();
+  Heap(const Heap&) = delete;
+  Heap& operator=(const Heap&) = delete;
+
+  // Allocates uninitialized storage for a node.
+  void* Allocate(std::size_t size) {
+    size = RoundUp(size);
+    allocated_ += size;
+    if (current_->used + size > current_->capacity) return Refill(size);
+    void* result = current_->begin() + current_->used;
+    current_->used += size;
+    return result;
+  }
+
+  bool ShouldCollect() const { return allocated_ >= nursery_size_; }
+
+  // Records a store into `node` which may have created an old-to-young
+  // reference.
+  void WriteBarrier(Node* node) {
+    if (!node->old || node->remembered) return;
+    node->remembered = true;
+    remembered_.push_back(node);
+  }
+
+  // A collection proceeds by calling BeginCollection, then Evacuate for every
+  // precise root, and finally FinishCollection. `root_size` is the total size
+  // in bytes of the precise roots.
+  void BeginCollection(const void* stack_base, std::size_t root_size);
+  void FinishCollection();
+
+  template <std::derived_from<Node> T>
+  T* Evacuate(T* node) {
+    return static_cast<T*>(EvacuateNode(node));
+  }
+
+  template <std::derived_from<Node> T>
+  void Update(T*& node) {
+    node = Evacuate(node);
+  }
+
+ private:
+  struct Block {
+    char* begin() { return reinterpret_cast<char*>(this) + kHeaderSize; }
+    // Number of contiguous chunks of kBlockSize which make up this block.
+    std::uint32_t num_chunks;
+    std::uint32_t capacity;
+    std::uint32_t used = 0;
+    bool from_space = false;
+  };
+  static constexpr std::size_t kHeaderSize = 64;
+  static_assert(sizeof(Block) <= kHeaderSize);
+
+  // Nodes are word-aligned, so every allocation is a whole number of words.
+  static constexpr std::size_t kAlignment = alignof(Node);
+  static constexpr std::size_t RoundUp(std::size_t size) {
+    return (size + kAlignment - 1) & ~(kAlignment - 1);
+  }
+
+  static Block* BlockOf(const void* address) {
+    return reinterpret_cast<Block*>(reinterpret_cast<std::uintptr_t>(address) &
+                                    ~(kBlockSize - 1));
+  }
+
+  void* Refill(std::size_t size);
+  Block* NewBlock(std::size_t size);
+  void ReleaseBlock(Block* block);
+  Node* EvacuateNode(Node* node);
+  void* CopyAllocate(std::size_t size);
+  void Promote(Block* block);
+  // Returns the size of the stack in bytes.
+  std::size_t ScanStack(const void* stack_base);
+  void ScanRange(const void* begin, const void* end);
+
+  char* base_;
+  char* reservation_;
+  std::size_t next_chunk_ = 0;
+  // For each chunk below next_chunk_, the block which contains it.
+  std::vector<Block*> owners_;
+  std::vector<Block*> free_blocks_;
+  // Free blocks whose memory has been returned to the operating system.
+  std::vector<Block*> released_blocks_;
+  // Blocks of the young generation, in allocation order.
+  std::vector<Block*> nursery_;
+  std::vector<Block*> old_blocks_;
+  // During a collection, the blocks being evacuated into. These all belong to
+  // the old generation once the collection is over.
+  std::vector<Block*> to_blocks_;
+  // Old nodes which may refer to young ones.
+  std::vector<Node*> remembered_;
+  Block* current_ = nullptr;
+  Block* copy_ = nullptr;
+  bool major_ = false;
+  // Bytes allocated in the nursery since the last collection.
+  std::size_t allocated_ = 0;
+  // The nursery grows with the native stack and the precise roots so that the
+  // cost of scanning them is amortized over a proportional amount of
+  // allocation.
+  std::size_t nursery_size_ = kNurserySize;
+  // Bytes in the old generation, and the size at which the next collection
+  // will be major.
+  std::size_t old_size_ = 0;
+  std::size_t collect_at_ = kMinimumCollectionSize;
+};
+
+Heap::Heap() {
+  void* reservation =
+      mmap(nullptr, kReservedSize + kBlockSize, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reservation == MAP_FAILED) throw std::runtime_error("can't reserve heap");
+  reservation_ = static_cast<char*>(reservation);
+  base_ = reinterpret_cast<char*>(BlockOf(reservation_ + kBlockSize - 1));
+  current_ = NewBlock(0);
+  nursery_.push_back(current_);
+}
+
+Heap::~Heap() { munmap(reservation_, kReservedSize + kBlockSize); }
+
+void* Heap::Refill(std::size_t size) {
+  Block* block = NewBlock(size);
+  nursery_.push_back(block);
+  // Oversized nodes get a block to themselves, which is never bump-allocated
+  // into afterwards.
+  if (block->num_chunks == 1) current_ = block;
+  block->used = size;
+  return block->begin();
+}
+
+Heap::Block* Heap::NewBlock(std::size_t size) {
+  // Leave a little slack at the end of every block so that a pointer just past
+  // the end of a node still lands within the block holding that node.
+  const std::size_t overhead = kHeaderSize + kAlignment;
+  const std::size_t num_chunks = (size + overhead + kBlockSize - 1) / kBlockSize;
+  Block* block;
+  if (num_chunks == 1 && !free_blocks_.empty()) {
+    block = free_blocks_.back();
+    free_blocks_.pop_back();
+  } else if (num_chunks == 1 && !released_blocks_.empty()) {
+    block = released_blocks_.back();
+    released_blocks_.pop_back();
+  } else {
+    if ((next_chunk_ + num_chunks) * kBlockSize > kReservedSize) {
+      throw std::runtime_error("out of memory");
+    }
+    block = reinterpret_cast<Block*>(base_ + next_chunk_ * kBlockSize);
+    next_chunk_ += num_chunks;
+    owners_.resize(next_chunk_, block);
+  }
+  return new (block) Block{
+      .num_chunks = static_cast<std::uint32_t>(num_chunks),
+      .capacity = static_cast<std::uint32_t>(num_chunks * kBlockSize - overhead)};
+}
+
+void Heap::ReleaseBlock(Block* block) {
+  // Oversized blocks are split back into individual chunks.
+  char* const begin = reinterpret_cast<char*>(block);
+  const std::size_t first = (begin - base_) / kBlockSize;
+  for (std::size_t i = 0, n = block->num_chunks; i < n; i++) {
+    Block* chunk = reinterpret_cast<Block*>(begin + i * kBlockSize);
+    new (chunk) Block{.num_chunks = 1, .capacity = 0};
+    owners_[first + i] = chunk;
+    free_blocks_.push_back(chunk);
+  }
+}
+
+void Heap::BeginCollection(const void* stack_base, std::size_t root_size) {
+  major_ = old_size_ >= collect_at_;
+  for (Block* block : nursery_) block->from_space = true;
+  if (major_) {
+    for (Block* block : old_blocks_) block->from_space = true;
+  }
+  for (Node* node : remembered_) node->remembered = false;
+  copy_ = nullptr;
+  const std::size_t stack_size = ScanStack(stack_base);
+  nursery_size_ = std::clamp(4 * (stack_size + root_size), kNurserySize,
+                             kMaxNurserySize);
+  // A major collection reaches every live old node anyway, but a minor one
+  // must treat the remembered set as roots.
+  if (!major_) {
+    for (Node* node : remembered_) node->Trace(*this);
+  }
+  remembered_.clear();
+}
+
+void Heap::FinishCollection() {
+  // Cheney scan: walk the nodes of the new space in order, evacuating anything
+  // they reference. Pinned blocks come first, so their nodes act as roots.
+  for (std::size_t i = 0; i < to_blocks_.size(); i++) {
+    Block* block = to_blocks_[i];
+    for (std::size_t offset = 0; offset < block->used;) {
+      Node* node = reinterpret_cast<Node*>(block->begin() + offset);
+      node->old = true;
+      node->Trace(*this);
+      offset += RoundUp(node->size);
+    }
+  }
+  std::size_t survivors = 0;
+  for (Block* block : to_blocks_) survivors += block->used;
+  for (Block* block : nursery_) {
+    if (block->from_space) ReleaseBlock(block);
+  }
+  nursery_.clear();
+  if (major_) {
+    for (Block* block : old_blocks_) {
+      if (block->from_space) ReleaseBlock(block);
+    }
+    old_blocks_ = std::move(to_blocks_);
+    old_size_ = survivors;
+    collect_at_ = std::max(kMinimumCollectionSize, 4 * survivors);
+  } else {
+    old_blocks_.insert(old_blocks_.end(), to_blocks_.begin(), to_blocks_.end());
+    old_size_ += survivors;
+  }
+  to_blocks_.clear();
+  // Any pinned nursery blocks have just been promoted, so allocation always
+  // starts over in a fresh block.
+  current_ = NewBlock(0);
+  nursery_.push_back(current_);
+  allocated_ = 0;
+  // Keep enough free blocks around to refill the nursery and to absorb the
+  // promotions expected before the next major collection, and hand the rest
+  // back to the operating system.
+  const std::size_t headroom =
+      nursery_size_ + (collect_at_ - std::min(collect_at_, old_size_));
+  const std::size_t keep = headroom / kBlockSize + 1;
+  while (free_blocks_.size() > keep) {
+    madvise(free_blocks_.back(), kBlockSize, MADV_DONTNEED);
+    released_blocks_.push_back(free_blocks_.back());
+    free_blocks_.pop_back();
+  }
+}
+
+Node* Heap::EvacuateNode(Node* node) {
+  if (node == nullptr || IsImmediate(node)) return node;
+  Block* block = BlockOf(node);
+  if (!block->from_space) return node;
+  if (node->forwarded) return node->forward();
+  if (block->num_chunks > 1) {
+    // Oversized nodes are never copied: their block is promoted instead.
+    Promote(block);
+    return node;
+  }
+  Node* copy = static_cast<Node*>(CopyAllocate(node->size));
+  std::memcpy(static_cast<void*>(copy), node, node->size);
+  node->set_forward(copy);
+  return copy;
+}
+
+void* Heap::CopyAllocate(std::size_t size) {
+  size = RoundUp(size);
+  if (copy_ == nullptr || copy_->used + size > copy_->capacity) {
+    copy_ = NewBlock(size);
+    to_blocks_.push_back(copy_);
+  }
+  void* result = copy_->begin() + copy_->used;
+  copy_->used += size;
+  return result;
+}
+
+void Heap::Promote(Block* block) {
+  block->from_space = false;
+  to_blocks_.push_back(block);
+}
+
+// Spill any callee-saved registers which might hold node pointers onto the
+// stack and then scan it.
+[[gnu::noinline]] std::size_t Heap::ScanStack(const void* stack_base) {
+  std::jmp_buf registers;
+  setjmp(registers);
+  ScanRange(&registers, stack_base);
+  return static_cast<const char*>(stack_base) -
+         reinterpret_cast<const char*>(&registers);
+}
+
+void Heap::ScanRange(const void* begin, const void* end) {
+  const auto* i = static_cast<const std::uintptr_t*>(begin);
+  const auto* const last = static_cast<const std::uintptr_t*>(end);
+  const std::uintptr_t low = reinterpret_cast<std::uintptr_t>(base_);
+  const std::uintptr_t high = low + next_chunk_ * kBlockSize;
+  for (; i < last; i++) {
+    const std::uintptr_t word = *i;
+    if (word < low || high <= word) continue;
+    Block* block = owners_[(word - low) >> kBlockBits];
+    if (block->from_space) Promote(block);
+  }
+}
+
+static_assert(sizeof(Node) == 2 * sizeof(void*));
+
+struct Value;
+struct Interpreter;
+
+// A stack of root slots. Slots live in fixed-size chunks so that their
+// addresses are stable while more slots are pushed, and they are released in
+// bulk by resetting the stack to an earlier mark.
+class HandleStack {
+ public:
+  struct Mark {
+    Node** top;
+    std::size_t chunk;
+  };
+
+  HandleStack() {
+    chunks_.push_back(std::make_unique<Node*[]>(kChunkSize));
+    Reset({.top = chunks_[0].get(), .chunk = 0});
+  }
+
+  Node** Push(Node* node) {
+    if (top_ == limit_) Grow();
+    *top_ = node;
+    return top_++;
+  }
+
+  Mark GetMark() const { return {.top = top_, .chunk = chunk_}; }
+
+  void Reset(Mark mark) {
+    top_ = mark.top;
+    chunk_ = mark.chunk;
+    limit_ = chunks_[chunk_].get() + kChunkSize;
+  }
+
+  void Trace(Heap& heap) {
+    for (std::size_t i = 0; i < chunk_; i++) {
+      for (Node*& node : std::span(chunks_[i].get(), kChunkSize)) {
+        heap.Update(node);
+      }
+    }
+    for (Node** i = chunks_[chunk_].get(); i != top_; i++) heap.Update(*i);
+  }
+
+ private:
+  static constexpr std::size_t kChunkSize = 4096;
+
+  void Grow() {
+    chunk_++;
+    if (chunk_ == chunks_.size()) {
+      chunks_.push_back(std::make_unique<Node*[]>(kChunkSize));
+    }
+    Reset({.top = chunks_[chunk_].get(), .chunk = chunk_});
+  }
+
+  std::vector<std::unique_ptr<Node*[]>> chunks_;
+  std::size_t chunk_;
+  Node** top_;
+  Node** limit_;
+};
+
+// A rooted pointer to a node. The node is held in a slot of the interpreter's
+// handle stack, which the collector updates if the node moves. The slot is
+// released when the innermost enclosing HandleScope exits, so a GCPtr must not
+// outlive that scope.
+template <std::derived_from<Node> T>
+class GCPtr {
+ public:
+  GCPtr() = default;
+  GCPtr(std::nullptr_t) : GCPtr() {}
+  GCPtr(Interpreter* interpreter, T* value);
+  template <typename U = T>
+  requires std::convertible_to<U*, T*>
+  GCPtr(const GCPtr<U>& other) : GCPtr(other.interpreter_, other.get()) {}
+  GCPtr(const GCPtr& other) : GCPtr(other.interpreter_, other.get()) {}
+  template <typename U = T>
+  requires std::convertible_to<U*, T*>
+  GCPtr(GCPtr<U>&& other)
+      : interpreter_(other.interpreter_), slot_(other.slot_) {}
+
+  GCPtr& operator=(const GCPtr& other) { return *this = other.get(); }
+
+  GCPtr& operator=(T* value) {
+    *slot_ = value;
+    return *this;
+  }
+
+  T* get() const { return slot_ ? static_cast<T*>(*slot_) : nullptr; }
+  T& operator*() const { return *get(); }
+  T* operator->() const { return get(); }
+
+  operator T*() const { return get(); }
+  explicit operator bool() const { return get() != nullptr; }
+
+ private:
+  template <std::derived_from<Node> U>
+  friend class GCPtr;
+
+  Interpreter* interpreter_ = nullptr;
+  Node** slot_ = nullptr;
+};
+
+struct Lambda;
+
+// A possibly-unevaluated value: either a Value, which is its own evaluated
+// lazy, or a Thunk. Like a Value pointer, a Lazy pointer may be an immediate,
+// in which case it is the (evaluated) value itself. It must only be read
+// through Get and TryGet.
+struct Lazy : public Node {
+  // The tags of thunks have the high bit set, which tells them apart from
+  // values.
+  static constexpr std::uint8_t kThunkTag = 0x80;
+
+  Lazy(std::uint8_t tag) : tag(tag) {}
+  bool IsValue() const { return !(tag & kThunkTag); }
+
+  // The type of the value or thunk, in the tail padding of the header.
+  std::uint8_t tag;
+};
+
+// A value in weak head normal form. A Value pointer may be an immediate, so it
+// must only be inspected through the functions below, which never dereference
+// an immediate.
+struct Value : public Lazy {
+  enum class Type : std::uint8_t {
+    kInt64,
+    kChar,
+    kLambda,
+    kTuple,
+    kUnion,
+  };
+
+  // Checking the type of a value is a load rather than a virtual call.
+  Value(Type type) : Lazy(static_cast<std::uint8_t>(type)) {}
+  Type GetType() const { return static_cast<Type>(tag); }
+};
+
+// A view of a value of a union type, which is either a Union node or an
+// immediate bool.
+struct UnionView {
+  core::UnionType::Id type_id;
+  int index;
+  std::span<Lazy* const> elements;
+};
+
+// The largest union type id and constructor index which fit in a Union.
+constexpr int kMaxUnionTypeId = 0xFF;
+constexpr int kMaxUnionIndex = 0xFF;
+
+Value::Type TypeOf(const Value* value);
+bool AsBool(const Value* value);
+std::int64_t AsInt64(const Value* value);
+char AsChar(const Value* value);
+std::span<Lazy* const> AsTuple(const Value* value);
+UnionView AsUnion(const Value* value);
+// Like AsUnion, but raises an error if the value is not of the given type.
+UnionView AsUnion(const Value* value, core::UnionType::Id type_id);
+Lambda* AsLambda(Value* value);
+
+// An unevaluated value. Once a thunk has been evaluated, it is overwritten in
+// place with an Indirection to its value, so that everything which refers to
+// it shares the result.
+struct Thunk : public Lazy {
+  enum class Type : std::uint8_t {
+    // Thunks which the bytecode machine evaluates itself.
+    kSuspension = kThunkTag,
+    kApply,
+    // Thunks which are always evaluated by calling Run. The packed strings
+    // (Read and Text) and ConcatThunk are told apart from the rest so that
+    // strings can be copied out of them without unpacking them.
+    kNative,
+    kRead,
+    kText,
+    kConcat,
+    // An evaluated thunk or a filled hole for a recursive binding. Neither is
+    // ever run.
+    kIndirection,
+  };
+
+  Thunk(Type type = Type::kNative) : Lazy(static_cast<std::uint8_t>(type)) {}
+  Type GetType() const { return static_cast<Type>(tag); }
+  virtual Value* Run(Interpreter& interpreter) = 0;
+
+  // For evaluators which run thunks themselves: Claim marks the thunk as being
+  // evaluated, and Update overwrites it with its value.
+  void Claim();
+  void Update(Interpreter& interpreter, Value* value);
+
+  // Set while the thunk is being evaluated.
+  bool computing = false;
+};
+
+// Overwrites `node` with a new T, keeping the parts of the header which belong
+// to the allocation rather than the node.
+template <std::derived_from<Node> T, typename... Args>
+T* Become(Node* node, Args&&... args) {
+  const std::uint32_t size = node->size;
+  const bool old = node->old;
+  const bool remembered = node->remembered;
+  if (sizeof(T) > size) throw std::logic_error("node is too small");
+  T* result = new (node) T(std::forward<Args>(args)...);
+  result->size = size;
+  result->old = old;
+  result->remembered = remembered;
+  return result;
+}
+
+// A reference to another lazy, which is equivalent to it in every way. The
+// collector short-circuits indirections, so they only survive until the next
+// collection.
+struct Indirection final : public Thunk {
+  Indirection(Lazy* target) : Thunk(Type::kIndirection), target(target) {}
+  void Trace(Heap& heap) override;
+  Value* Run(Interpreter&) override {
+    throw std::logic_error("running an indirection");
+  }
+  Lazy* target;
+};
+
+static_assert(sizeof(Indirection) == sizeof(Node) + sizeof(Lazy*));
+
+// Follows any indirections from `lazy` to the value or thunk they refer to.
+inline Lazy* Follow(Lazy* lazy) {
+  while (!IsImmediate(lazy) && !lazy->IsValue() &&
+         static_cast<Thunk*>(lazy)->GetType() == Thunk::Type::kIndirection) {
+    lazy = static_cast<Indirection*>(lazy)->target;
+  }
+  return lazy;
+}
+
+// Returns the value of `lazy` if it has already been evaluated, or null
+// otherwise.
+inline Value* TryGet(Lazy* lazy) {
+  lazy = Follow(lazy);
+  if (IsImmediate(lazy)) return reinterpret_cast<Value*>(lazy);
+  return lazy->IsValue() ? static_cast<Value*>(lazy) : nullptr;
+}
+
+// Returns the thunk of `lazy` if it has not been evaluated and is not being
+// evaluated, or null otherwise.
+inline Thunk* TryGetThunk(Lazy* lazy) {
+  lazy = Follow(lazy);
+  if (IsImmediate(lazy) || lazy->IsValue()) return nullptr;
+  Thunk* thunk = static_cast<Thunk*>(lazy);
+  return thunk->computing ? nullptr : thunk;
+}
+
+// Evaluates `lazy` if necessary and returns its value.
+Value* Get(Interpreter& interpreter, Lazy* lazy);
+
+// Indirections are skipped whenever the collector updates a lazy. Only the
+// header and the target of an indirection are read, which are intact even if
+// it has already been evacuated. Unassigned locals are null.
+template <>
+inline void Heap::Update(Lazy*& lazy) {
+  if (lazy) lazy = Evacuate(Follow(lazy));
+}
+
+void Indirection::Trace(Heap& heap) { heap.Update(target); }
+
+template <typename K>
+class flat_set {
+ public:
+  flat_set() = default;
+
+  flat_set(std::initializer_list<K> contents)
+      : flat_set(std::vector(contents)) {}
+
+  flat_set(std::vector<K> contents)
+      : contents_(std::move(contents)) {
+    std::sort(contents_.begin(), contents_.end());
+  }
+
+  bool contains(const K& k) const {
+    return !contents_.empty() && contents_[Index(k)] == k;
+  }
+
+  template <typename... Args>
+  requires std::constructible_from<K, Args...>
+  std::pair<typename std::vector<K>::const_iterator, bool>
+  emplace(Args&&... args) {
+    if (contents_.empty()) {
+      return std::pair(
+          contents_.emplace(contents_.end(), std::forward<Args>(args)...),
+          true);
+    }
+    K k(std::forward<Args>(args)...);
+    const int i = Index(k);
+    if (contents_[i] == k) return std::pair(contents_.begin() + i, false);
+    // Index returns the last element which is not greater than k, except that
+    // it returns the first element when they all are.
+    const int position = k < contents_[i] ? i : i + 1;
+    return std::pair(
+        contents_.emplace(contents_.begin() + position, std::move(k)), true);
+  }
+
+  std::pair<typename std::vector<K>::const_iterator, bool> insert(const K& k) {
+    return emplace(k);
+  }
+
+  void erase(const K& k) {
+    if (contents_.empty()) return;
+    const int i = Index(k);
+    if (contents_[i] == k) contents_.erase(contents_.begin() + i);
+  }
+
+  bool empty() const { return contents_.empty(); }
+  auto size() const { return contents_.size(); }
+  auto begin() const { return contents_.begin(); }
+  auto end() const { return contents_.end(); }
+
+ private:
+  int Index(const K& k) const {
+    int a = 0, b = contents_.size();
+    while (b - a > 1) {
+      const int i = (a + b) / 2;
+      if (k < contents_[i]) {
+        b = i;
+      } else {
+        a = i;
+      }
+    }
+    return a;
+  }
+
+  std::vector<K> contents_;
+};
+
+template <typename K, typename V>
+class flat_map {
+ public:
+  V& operator[](const K& k) {
+    if (contents_.empty()) {
+      auto& entry = contents_.emplace_back(k, V());
+      return entry.second;
+    }
+    const int i = Index(k);
+    if (contents_[i].first == k) return contents_[i].second;
+    const int position = k < contents_[i].first ? i : i + 1;
+    auto entry = contents_.emplace(contents_.begin() + position, k, V());
+    return entry->second;
+  }
+
+  const V& at(const K& k) const {
+    if (contents_.empty()) throw std::runtime_error("not found");
+    const int i = Index(k);
+    if (contents_[i].first != k) throw std::runtime_error("not found");
+    return contents_[i].second;
+  }
+
+  bool empty() const { return contents_.empty(); }
+  auto size() const { return contents_.size(); }
+  auto begin() { return contents_.begin(); }
+  auto end() { return contents_.end(); }
+  auto begin() const { return contents_.begin(); }
+  auto end() const { return contents_.end(); }
+
+ private:
+  int Index(const K& k) const {
+    int a = 0, b = contents_.size();
+    while (b - a > 1) {
+      const int i = (a + b) / 2;
+      if (k < contents_[i].first) {
+        b = i;
+      } else {
+        a = i;
+      }
+    }
+    return a;
+  }
+
+  std::vector<std::pair<K, V>> contents_;
+};
+
+// Finds the subexpressions of a program whose values are certainly demanded
+// whenever the expression containing them is evaluated: the arguments of
+// saturated calls to functions which are strict in them, and the values of let
+// bindings whose bodies are strict in the bound variable. These can be
+// evaluated eagerly rather than suspended.
+//
+// The demand of an expression is the set of variables which are certainly
+// evaluated whenever the expression is evaluated to weak head normal form. The
+// signature of a function bound by a let or letrec records which of its
+// parameters are demanded by a saturated call. The signatures of a recursive
+// group are computed as a least fixed point, starting from the assumption that
+// every function in the group diverges.
+class StrictnessAnalyzer {
+ public:
+  // Occurrences of a variable share a single expression, so the results
+  // identify the enclosing application or let instead.
+  struct Result {
+    // Applications whose argument is demanded whenever they are evaluated.
+    std::set<const core::Apply*> arguments;
+    // Let expressions whose binding is demanded whenever they are evaluated.
+    std::set<const core::Let*> bindings;
+  };
+
+  struct Signature {
+    bool operator==(const Signature&) const = default;
+    // Whether each parameter is demanded by a saturated call.
+    std::vector<bool> strict;
+    // Set if a saturated call certainly diverges. Such calls are strict in
+    // every argument, but there is no point evaluating them eagerly.
+    bool diverges = false;
+  };
+
+  Result AnalyzeProgram(const core::Expression& program);
+
+  // The signature of a builtin, which has one entry per parameter.
+  static Signature BuiltinSignature(core::Builtin x);
+
+ private:
+  struct Demand {
+    // Set if evaluation certainly diverges, in which case every variable is
+    // vacuously demanded.
+    bool diverges = false;
+    // Identifiers are unique, so variables can stay in a demand after they go
+    // out of scope without being confused with anything else.
+    flat_set<core::Identifier> variables;
+  };
+
+  // The demand of evaluating both `a` and `b`.
+  static Demand Both(Demand a, const Demand& b);
+  // The demand of evaluating one of `a` or `b`.
+  static Demand Either(const Demand& a, const Demand& b);
+
+  std::optional<Signature> GetSignature(const core::Expression& f) const;
+
+  Demand Analyze(const core::Builtin& x);
+  Demand Analyze(const core::Identifier& x);
+  Demand Analyze(const core::Integer& x);
+  Demand Analyze(const core::Character& x);
+  Demand Analyze(const core::Tuple& x);
+  Demand Analyze(const core::UnionConstructor& x);
+  Demand Analyze(const core::Apply& x);
+  Demand Analyze(const core::Lambda& x);
+  Demand Analyze(const core::Let& x);
+  Demand Analyze(const core::LetRecursive& x);
+  Demand Analyze(const core::Case& x);
+  Demand Analyze(const core::Expression& x);
+  Signature AnalyzeFunction(const core::Expression& x);
+
+  std::map<core::Identifier, Signature> signatures_;
+  // Subexpressions which are only evaluated lazily can't affect any demand, so
+  // they are only visited once the signatures of every enclosing recursive
+  // group have reached a fixed point, which is also when the results are
+  // recorded.
+  bool recording_ = true;
+  Result result_;
+};
+
+StrictnessAnalyzer::Result StrictnessAnalyzer::AnalyzeProgram(
+    const core::Expression& program) {
+  Analyze(program);
+  return std::move(result_);
+}
+
+StrictnessAnalyzer::Demand StrictnessAnalyzer::Both(Demand a,
+                                                    const Demand& b) {
+  a.diverges = a.diverges || b.diverges;
+  for (core::Identifier id : b.variables) a.variables.insert(id);
+  return a;
+}
+
+StrictnessAnalyzer::Demand StrictnessAnalyzer::Either(const Demand& a,
+                                                      const Demand& b) {
+  if (a.diverges) return b;
+  if (b.diverges) return a;
+  Demand result;
+  for (core::Identifier id : a.variables) {
+    if (b.variables.contains(id)) result.variables.insert(id);
+  }
+  return result;
+}
+
+StrictnessAnalyzer::Signature StrictnessAnalyzer::BuiltinSignature(
+    core::Builtin x) {
+  switch (x) {
+    case core::Builtin::kAdd:
+    case core::Builtin::kBitShift:
+    case core::Builtin::kBitwiseAnd:
+    case core::Builtin::kBitwiseOr:
+    case core::Builtin::kDivide:
+    case core::Builtin::kEqual:
+    case core::Builtin::kLessThan:
+    case core::Builtin::kModulo:
+    case core::Builtin::kMultiply:
+    case core::Builtin::kSubtract:
+      return {.strict = {true, true}};
+    case core::Builtin::kAnd:
+    case core::Builtin::kConcat:
+    case core::Builtin::kOr:
+      return {.strict = {true, false}};
+    case core::Builtin::kChr:
+    case core::Builtin::kNot:
+    case core::Builtin::kOrd:
+    case core::Builtin::kReadInt:
+    case core::Builtin::kShowInt:
+      return {.strict = {true}};
+    case core::Builtin::kError:
+      return {.strict = {true}, .diverges = true};
+  }
+  throw std::logic_error(StrCat("unimplemented builtin: ", x));
+}
+
+std::optional<StrictnessAnalyzer::Signature> StrictnessAnalyzer::GetSignature(
+    const core::Expression& f) const {
+  if (const auto* builtin = std::get_if<core::Builtin>(&f->value)) {
+    return BuiltinSignature(*builtin);
+  }
+  if (const auto* id = std::get_if<core::Identifier>(&f->value)) {
+    auto i = signatures_.find(*id);
+    if (i != signatures_.end()) return i->second;
+  }
+  return std::nullopt;
+}
+
+StrictnessAnalyzer::Demand StrictnessAnalyzer::Analyze(const core::Builtin&) {
+  return {};
+}
+
+StrictnessAnalyzer::Demand StrictnessAnalyzer::Analyze(
+    const core::Identifier& x) {
+  return {.variables = {x}};
+}
+
+StrictnessAnalyzer::Demand StrictnessAnalyzer::Analyze(const core::Integer&) {
+  return {};
+}
+
+StrictnessAnalyzer::Demand StrictnessAnalyzer::Analyze(
+    const core::Character&) {
+  return {};
+}
+
+StrictnessAnalyzer::Demand StrictnessAnalyzer::Analyze(const core::Tuple& x) {
+  if (recording_) {
+    for (const auto& element : x.elements) Analyze(element);
+  }
+  return {};
+}
+
+StrictnessAnalyzer::Demand StrictnessAnalyzer::Analyze(
+    const core::UnionConstructor&) {
+  return {};
+}
+
+StrictnessAnalyzer::Demand StrictnessAnalyzer::Analyze(const core::Apply& x) {
+  // The applications along the spine, innermost first.
+  std::vector<const core::Apply*> spine = {&x};
+  while (const auto* apply = std::get_if<core::Apply>(&spine.back()->f->value)) {
+    spine.push_back(apply);
+  }
+  std::ranges::reverse(spine);
+  const core::Expression& f = spine.front()->f;
+  Demand result = Analyze(f);
+  const std::optional<Signature> signature = GetSignature(f);
+  const bool saturated = signature && spine.size() >= signature->strict.size();
+  for (int i = 0, n = spine.size(); i < n; i++) {
+    if (saturated && i < (int)signature->strict.size() &&
+        signature->strict[i]) {
+      result = Both(std::move(result), Analyze(spine[i]->x));
+      if (recording_ && !signature->diverges) {
+        result_.arguments.insert(spine[i]);
+      }
+    } else if (recording_) {
+      Analyze(spine[i]->x);
+    }
+  }
+  if (saturated && signature->diverges) result.diverges = true;
+  return result;
+}
+
+StrictnessAnalyzer::Demand StrictnessAnalyzer::Analyze(const core::Lambda& x) {
+  if (recording_) Analyze(x.result);
+  return {};
+}
+
+StrictnessAnalyzer::Demand StrictnessAnalyzer::Analyze(const core::Let& x) {
+  const core::Identifier variable = x.binding.variable;
+  Demand value;
+  if (std::holds_alternative<core::Lambda>(x.binding.value->value)) {
+    signatures_[variable] = AnalyzeFunction(x.binding.value);
+  } else {
+    value = Analyze(x.binding.value);
+  }
+  Demand result = Analyze(x.value);
+  if (result.variables.contains(variable)) {
+    result = Both(std::move(result), value);
+    if (recording_) result_.bindings.insert(&x);
+  }
+  return result;
+}
+
+StrictnessAnalyzer::Demand StrictnessAnalyzer::Analyze(
+    const core::LetRecursive& x) {
+  for (const auto& binding : x.bindings) {
+    const core::Expression* f = &binding.value;
+    std::vector<bool> strict;
+    while (const auto* lambda = std::get_if<core::Lambda>(&(*f)->value)) {
+      strict.push_back(true);
+      f = &lambda->result;
+    }
+    if (!strict.empty()) {
+      signatures_[binding.variable] = {.strict = std::move(strict),
+                                       .diverges = true};
+    }
+  }
+  const bool recording = recording_;
+  recording_ = false;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const auto& binding : x.bindings) {
+      auto i = signatures_.find(binding.variable);
+      if (i == signatures_.end()) continue;
+      Signature signature = AnalyzeFunction(binding.value);
+      if (signature != i->second) {
+        i->second = std::move(signature);
+        changed = true;
+      }
+    }
+  }
+  recording_ = recording;
+  if (recording_) {
+    for (const auto& binding : x.bindings) Analyze(binding.value);
+  }
+  return Analyze(x.value);
+}
+
+StrictnessAnalyzer::Demand StrictnessAnalyzer::Analyze(const core::Case& x) {
+  std::optional<Demand> alternatives;
+  for (const auto& alternative : x.alternatives) {
+    Demand demand = Analyze(alternative.value);
+    alternatives =
+        alternatives ? Either(*alternatives, demand) : std::move(demand);
+  }
+  Demand result = Analyze(x.value);
+  if (alternatives) result = Both(std::move(result), *alternatives);
+  return result;
+}
+
+StrictnessAnalyzer::Demand StrictnessAnalyzer::Analyze(
+    const core::Expression& x) {
+  return std::visit([this](const auto& x) { return Analyze(x); }, x->value);
+}
+
+StrictnessAnalyzer::Signature StrictnessAnalyzer::AnalyzeFunction(
+    const core::Expression& x) {
+  std::vector<core::Identifier> parameters;
+  const core::Expression* body = &x;
+  while (const auto* lambda = std::get_if<core::Lambda>(&(*body)->value)) {
+    parameters.push_back(lambda->parameter);
+    body = &lambda->result;
+  }
+  const Demand demand = Analyze(*body);
+  Signature result{.strict = {}, .diverges = demand.diverges};
+  for (core::Identifier parameter : parameters) {
+    result.strict.push_back(demand.diverges ||
+                            demand.variables.contains(parameter));
+  }
+  return result;
+}
+
+// The number of parameters of `x` if it is a chain of lambdas, or zero.
+int NumParameters(const core::Expression& x) {
+  int n = 0;
+  const core::Expression* body = &x;
+  while (const auto* lambda = std::get_if<core::Lambda>(&(*body)->value)) {
+    n++;
+    body = &lambda->result;
+  }
+  return n;
+}
+
+// Whether `x` is a variable or a constant, which is no cheaper to evaluate
+// eagerly than to pass lazily.
+bool IsAtom(const core::Expression& x) {
+  return std::holds_alternative<core::Identifier>(x->value) ||
+         std::holds_alternative<core::Builtin>(x->value) ||
+         std::holds_alternative<core::Integer>(x->value) ||
+         std::holds_alternative<core::Character>(x->value) ||
+         std::holds_alternative<core::UnionConstructor>(x->value);
+}
+
+// Returns the characters of `x` if it is a non-empty list of character
+// literals, such as a string literal.
+std::optional<std::string> AsStringLiteral(const core::Apply& x) {
+  std::string text;
+  const core::Apply* cons = &x;
+  while (true) {
+    const auto* f = std::get_if<core::Apply>(&cons->f->value);
+    if (!f) return std::nullopt;
+    const auto* constructor =
+        std::get_if<core::UnionConstructor>(&f->f->value);
+    const auto* head = std::get_if<core::Character>(&f->x->value);
+    if (!constructor || constructor->type->id != core::UnionType::Id::kList ||
+        constructor->index != 0 || !head) {
+      return std::nullopt;
+    }
+    text.push_back(head->value);
+    const core::Expression& tail = cons->x;
+    if (const auto* nil = std::get_if<core::UnionConstructor>(&tail->value)) {
+      if (nil->type->id != core::UnionType::Id::kList) return std::nullopt;
+      return text;
+    }
+    cons = std::get_if<core::Apply>(&tail->value);
+    if (!cons) return std::nullopt;
+  }
+}
+
+// Constructed product result analysis: finds the functions bound by let or
+// letrec expressions which build a tuple as their result, so that a known call
+// whose result is immediately taken apart by a case can receive the elements
+// on the stack instead of a newly allocated tuple.
+//
+// A function qualifies if any of its results is a tuple, or a saturated call
+// to a function which qualifies. Its other results are tuples of the same size
+// as well, since the program is well typed, so they are unpacked on return.
+class TupleResultAnalyzer {
+ public:
+  struct Result {
+    // The size of the tuple returned by each qualifying function.
+    std::map<core::Identifier, int> functions;
+    // The same, keyed by the outermost lambda of each definition.
+    std::map<const core::Lambda*, int> lambdas;
+  };
+
+  Result AnalyzeProgram(const core::Expression& program);
+
+ private:
+  struct Definition {
+    core::Identifier variable;
+    const core::Lambda* lambda;
+    // The body of the innermost lambda.
+    const core::Expression* body;
+  };
+
+  void AddDefinition(const core::Binding& binding);
+  void CollectDefinitions(const core::Expression& x);
+  // The size of the tuple which `x` is known to construct, or zero.
+  int ResultSize(const core::Expression& x) const;
+
+  std::vector<Definition> definitions_;
+  std::map<core::Identifier, int> arities_;
+  Result result_;
+};
+
+TupleResultAnalyzer::Result TupleResultAnalyzer::AnalyzeProgram(
+    const core::Expression& program) {
+  CollectDefinitions(program);
+  // Sizes only ever change from zero, so this reaches a fixed point.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const Definition& definition : definitions_) {
+      if (result_.functions.contains(definition.variable)) continue;
+      if (const int size = ResultSize(*definition.body)) {
+        result_.functions.emplace(definition.variable, size);
+        changed = true;
+      }
+    }
+  }
+  for (const Definition& definition : definitions_) {
+    auto i = result_.functions.find(definition.variable);
+    if (i != result_.functions.end()) {
+      result_.lambdas.emplace(definition.lambda, i->second);
+    }
+  }
+  return std::move(result_);
+}
+
+void TupleResultAnalyzer::AddDefinition(const core::Binding& binding) {
+  const auto* lambda = std::get_if<core::Lambda>(&binding.value->value);
+  if (!lambda) return;
+  const core::Expression* body = &binding.value;
+  int arity = 0;
+  while (const auto* inner = std::get_if<core::Lambda>(&(*body)->value)) {
+    arity++;
+    body = &inner->result;
+  }
+  definitions_.push_back({binding.variable, lambda, body});
+  arities_.emplace(binding.variable, arity);
+}
+
+void TupleResultAnalyzer::CollectDefinitions(const core::Expression& x) {
+  std::visit(
+      [&](const auto& x) {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, core::Tuple>) {
+          for (const auto& element : x.elements) CollectDefinitions(element);
+        } else if constexpr (std::is_same_v<T, core::Apply>) {
+          CollectDefinitions(x.f);
+          CollectDefinitions(x.x);
+        } else if constexpr (std::is_same_v<T, core::Lambda>) {
+          CollectDefinitions(x.result);
+        } else if constexpr (std::is_same_v<T, core::Let>) {
+          AddDefinition(x.binding);
+          CollectDefinitions(x.binding.value);
+          CollectDefinitions(x.value);
+        } else if constexpr (std::is_same_v<T, core::LetRecursive>) {
+          for (const auto& binding : x.bindings) {
+            AddDefinition(binding);
+            CollectDefinitions(binding.value);
+          }
+          CollectDefinitions(x.value);
+        } else if constexpr (std::is_same_v<T, core::Case>) {
+          CollectDefinitions(x.value);
+          for (const auto& alternative : x.alternatives) {
+            CollectDefinitions(alternative.value);
+          }
+        }
+      },
+      x->value);
+}
+
+int TupleResultAnalyzer::ResultSize(const core::Expression& x) const {
+  return std::visit(
+      [&](const auto& x) -> int {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, core::Tuple>) {
+          return x.elements.size();
+        } else if constexpr (std::is_same_v<T, core::Apply>) {
+          const core::Apply* apply = &x;
+          int num_arguments = 1;
+          while (const auto* f = std::get_if<core::Apply>(&apply->f->value)) {
+            apply = f;
+            num_arguments++;
+          }
+          const auto* id = std::get_if<core::Identifier>(&apply->f->value);
+          if (!id) return 0;
+          auto arity = arities_.find(*id);
+          auto size = result_.functions.find(*id);
+          if (arity == arities_.end() || arity->second != num_arguments ||
+              size == result_.functions.end()) {
+            return 0;
+          }
+          return size->second;
+        } else if constexpr (std::is_same_v<T, core::Let> ||
+                             std::is_same_v<T, core::LetRecursive>) {
+          return ResultSize(x.value);
+        } else if constexpr (std::is_same_v<T, core::Case>) {
+          for (const auto& alternative : x.alternatives) {
+            if (const int size = ResultSize(alternative.value)) return size;
+          }
+          return 0;
+        } else {
+          return 0;
+        }
+      },
+      x->value);
+}
+
+// Finds the saturated calls which functions bound by let or letrec expressions
+// make to themselves in tail position, mapping each to the outermost lambda of
+// the function. These are resolved as loops.
+class SelfTailCallFinder {
+ public:
+  using Result = std::map<const core::Apply*, const core::Lambda*>;
+
+  Result FindInProgram(const core::Expression& program);
+
+ private:
+  void AddDefinition(const core::Binding& binding);
+  void FindInTail(const core::Expression& x, core::Identifier self,
+                  const core::Lambda* lambda, int arity);
+  void Find(const core::Expression& x);
+
+  Result result_;
+};
+
+SelfTailCallFinder::Result SelfTailCallFinder::FindInProgram(
+    const core::Expression& program) {
+  Find(program);
+  return std::move(result_);
+}
+
+void SelfTailCallFinder::AddDefinition(const core::Binding& binding) {
+  const auto* lambda = std::get_if<core::Lambda>(&binding.value->value);
+  if (!lambda) return;
+  const core::Expression* body = &binding.value;
+  int arity = 0;
+  while (const auto* inner = std::get_if<core::Lambda>(&(*body)->value)) {
+    arity++;
+    body = &inner->result;
+  }
+  FindInTail(*body, binding.variable, lambda, arity);
+}
+
+void SelfTailCallFinder::FindInTail(const core::Expression& x,
+                                    core::Identifier self,
+                                    const core::Lambda* lambda, int arity) {
+  std::visit(
+      [&](const auto& x) {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, core::Apply>) {
+          const core::Apply* apply = &x;
+          int num_arguments = 1;
+          while (const auto* f = std::get_if<core::Apply>(&apply->f->value)) {
+            apply = f;
+            num_arguments++;
+          }
+          const auto* id = std::get_if<core::Identifier>(&apply->f->value);
+          if (id && *id == self && num_arguments == arity) {
+            result_.emplace(&x, lambda);
+          }
+        } else if constexpr (std::is_same_v<T, core::Let> ||
+                             std::is_same_v<T, core::LetRecursive>) {
+          FindInTail(x.value, self, lambda, arity);
+        } else if constexpr (std::is_same_v<T, core::Case>) {
+          for (const auto& alternative : x.alternatives) {
+            FindInTail(alternative.value, self, lambda, arity);
+          }
+        }
+      },
+      x->value);
+}
+
+void SelfTailCallFinder::Find(const core::Expression& x) {
+  std::visit(
+      [&](const auto& x) {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, core::Tuple>) {
+          for (const auto& element : x.elements) Find(element);
+        } else if constexpr (std::is_same_v<T, core::Apply>) {
+          Find(x.f);
+          Find(x.x);
+        } else if constexpr (std::is_same_v<T, core::Lambda>) {
+          Find(x.result);
+        } else if constexpr (std::is_same_v<T, core::Let>) {
+          AddDefinition(x.binding);
+          Find(x.binding.value);
+          Find(x.value);
+        } else if constexpr (std::is_same_v<T, core::LetRecursive>) {
+          for (const auto& binding : x.bindings) {
+            AddDefinition(binding);
+            Find(binding.value);
+          }
+          Find(x.value);
+        } else if constexpr (std::is_same_v<T, core::Case>) {
+          Find(x.value);
+          for (const auto& alternative : x.alternatives) {
+            Find(alternative.value);
+          }
+        }
+      },
+      x->value);
+}
+
+// The program after variable resolution. Each lambda body, and each let or case
+// expression which is evaluated lazily, becomes a Function which runs in its
+// own frame of variable slots. A frame starts with the values captured by the
+// function, followed by the parameters of a lambda, and then the variables
+// bound within the body. Every variable reference is an index into the frame
+// of the innermost enclosing function.
+namespace resolved {
+
+struct ExpressionVariant;
+class Expression {
+ public:
+  template <typename T>
+  Expression(T value);
+  const ExpressionVariant& operator*() const { return *value_; }
+  const ExpressionVariant* operator->() const { return value_.get(); }
+ private:
+  std::shared_ptr<const ExpressionVariant> value_;
+};
+
+struct Variable {
+  int slot;
+};
+
+struct Function {
+  // Functions are numbered from zero in the order in which they are resolved.
+  int id;
+  // For each captured value, the slot holding it in the enclosing frame.
+  std::vector<int> captures;
+  // Zero for a suspension. A chain of nested lambdas is resolved as a single
+  // function with one parameter for each of them.
+  int num_parameters;
+  int frame_size;
+  Expression body;
+  // If non-zero, the body always returns a tuple of this many elements, and
+  // the function can also be entered so as to return the elements unboxed.
+  int result_size = 0;
+};
+
+struct Tuple {
+  std::vector<Expression> elements;
+};
+
+struct Apply {
+  Expression f, x;
+};
+
+// A saturated application of a builtin, a constructor, or a variable which is
+// known to hold a lambda taking exactly that many arguments, which is executed
+// directly instead of through a chain of partial applications. The second
+// argument of (&&) or (||) is only evaluated depending on the first, so it is
+// resolved in the same position as the call itself.
+struct Call {
+  std::variant<core::Builtin, core::UnionConstructor, Variable> function;
+  std::vector<Expression> arguments;
+  // The result_size of the function, if it is a variable.
+  int result_size = 0;
+};
+
+// A saturated call of the enclosing function from its own tail position,
+// which assigns the arguments to the parameter slots in place and runs the
+// body again.
+struct Loop {
+  std::vector<int> slots;
+  std::vector<Expression> arguments;
+};
+
+// The parameters are in the slots directly after the captures.
+struct Lambda {
+  Function function;
+};
+
+// A computation whose evaluation is deferred until it is demanded.
+struct Suspend {
+  Function function;
+};
+
+// An expression in a lazy position which is evaluated immediately anyway,
+// because its value is certainly demanded or it is cheap and can't diverge.
+struct Strict {
+  Expression value;
+};
+
+// A string literal, which is kept packed until its characters are needed.
+// These only appear in the constant pool.
+struct String {
+  std::string value;
+};
+
+// An entry in the constant pool of the program. Closed expressions which are
+// built entirely from literals, such as string literals and constructors
+// applied to constants, are built once when the program starts and then shared
+// by every evaluation of them.
+struct Constant {
+  int index;
+};
+
+struct Let {
+  int slot;
+  Expression value;
+  Expression body;
+};
+
+struct LetRecursive {
+  struct Binding {
+    int slot;
+    Expression value;
+  };
+  std::vector<Binding> bindings;
+  Expression body;
+};
+
+struct MatchTuple {
+  std::vector<int> slots;
+};
+
+struct MatchUnion {
+  core::UnionType::Id type_id;
+  int index;
+  std::vector<int> slots;
+};
+
+using Pattern =
+    std::variant<Variable, MatchTuple, MatchUnion, core::Integer,
+                 core::Character>;
+
+struct Case {
+  struct Alternative {
+    Pattern pattern;
+    Expression value;
+  };
+  Expression value;
+  std::vector<Alternative> alternatives;
+  // If every pattern is either a variable or a constructor of the same union
+  // type, the index of the first alternative which matches each constructor
+  // of that type (or -1 if none of them do), so that the right alternative
+  // can be found with a single lookup. Otherwise, this is empty and the
+  // alternatives are tried in order.
+  std::vector<int> dispatch;
+  core::UnionType::Id type_id;
+  // The original expression, for diagnostics.
+  const core::Case* source;
+};
+
+// Whether `x` is a call to (&&) or (||).
+inline bool IsConditional(const Call& x) {
+  const auto* builtin = std::get_if<core::Builtin>(&x.function);
+  return builtin && (*builtin == core::Builtin::kAnd ||
+                     *builtin == core::Builtin::kOr);
+}
+
+// Whether `x` is a call to an arithmetic operator or to (<). Both operands are
+// Ints, or Chars for (<), which are computed directly rather than through the
+// builtin's closure.
+inline bool IsOperator(const Call& x) {
+  const auto* builtin = std::get_if<core::Builtin>(&x.function);
+  if (!builtin || x.arguments.size() != 2) return false;
+  switch (*builtin) {
+    case core::Builtin::kAdd:
+    case core::Builtin::kBitShift:
+    case core::Builtin::kBitwiseAnd:
+    case core::Builtin::kBitwiseOr:
+    case core::Builtin::kDivide:
+    case core::Builtin::kLessThan:
+    case core::Builtin::kModulo:
+    case core::Builtin::kMultiply:
+    case core::Builtin::kSubtract:
+      return true;
+    default:
+      return false;
+  }
+}
+
+struct ExpressionVariant {
+  std::variant<core::Builtin, Variable, core::Integer, core::Character, Tuple,
+               core::UnionConstructor, Apply, Call, Loop, Lambda, Suspend,
+               Strict, String, Constant, Let, LetRecursive, Case>
+      value;
+};
+
+template <typename T>
+Expression::Expression(T value)
+    : value_(std::make_shared<ExpressionVariant>(
+          ExpressionVariant{.value = std::move(value)})) {}
+
+struct Program {
+  Function main;
+  // The constant pool, in which each entry is resolved for a lazy position and
+  // only refers to the entries before it.
+  std::vector<Expression> constants;
+};
+
+}  // namespace resolved
+
+// Assigns a frame slot to every variable in a core expression. Whether an
+// expression is in a strict position (evaluated to weak head normal form
+// immediately) or a lazy one determines whether a let or case expression is
+// evaluated in the current frame or suspended in a frame of its own. Arguments
+// and let bindings which the strictness analysis found to be demanded are
+// evaluated eagerly.
+class Resolver {
+ public:
+  Resolver(const StrictnessAnalyzer::Result& strict,
+           const TupleResultAnalyzer::Result& results,
+           const SelfTailCallFinder::Result& loops)
+      : strict_(strict), results_(results), loops_(loops) {}
+  resolved::Program ResolveProgram(const core::Expression& program);
+
+ private:
+  struct Frame {
+    Frame* parent;
+    std::map<core::Identifier, std::vector<int>> slots;
+    // The number of parameters of the lambda in each slot which is bound to
+    // one by a let or letrec expression.
+    std::map<int, int> arities;
+    int next_slot = 0;
+    int size = 0;
+  };
+
+  int Bind(core::Identifier id);
+  void Unbind(core::Identifier id);
+  int Lookup(const Frame& frame, core::Identifier id) const;
+
+  // Adds `x`, which must be closed, to the constant pool.
+  resolved::Constant AddConstant(resolved::Expression x);
+  // Adds a string literal to the constant pool, sharing the entry for any
+  // other occurrence of the same literal.
+  resolved::Constant AddString(std::string text);
+
+  // Resolves `body` as a function in a new frame. The parameters are bound
+  // directly after the captures.
+  resolved::Function ResolveFunction(
+      std::span<const core::Identifier> parameters,
+      const core::Expression& body);
+
+  resolved::Expression Resolve(const core::Builtin& x);
+  resolved::Expression Resolve(const core::Identifier& x);
+  resolved::Expression Resolve(const core::Integer& x);
+  resolved::Expression Resolve(const core::Character& x);
+  resolved::Expression Resolve(const core::Tuple& x);
+  resolved::Expression Resolve(const core::UnionConstructor& x);
+  resolved::Expression Resolve(const core::Apply& x);
+  resolved::Expression Resolve(const core::Lambda& x);
+  resolved::Expression Resolve(const core::Let& x);
+  resolved::Expression Resolve(const core::LetRecursive& x);
+  resolved::Expression Resolve(const core::Case& x);
+  resolved::Expression Resolve(const core::Expression& x);
+
+  // Resolves `x` as a call if it is a saturated application of a builtin, a
+  // constructor, or a lambda of known arity.
+  std::optional<resolved::Expression> ResolveCall(const core::Apply& x);
+  // Resolves a self tail call of the function whose outermost lambda is
+  // `lambda`.
+  resolved::Expression ResolveLoop(const core::Apply& x,
+                                   const core::Lambda& lambda);
+
+  resolved::Expression ResolveLazy(const core::Apply& x);
+  resolved::Expression ResolveLazy(const auto& x) { return Resolve(x); }
+  // Let, letrec, and case expressions in a lazy position are suspended, as
+  // are applications with demanded arguments which would otherwise need
+  // thunks of their own. Saturated constructor applications are built
+  // immediately, except for string literals, which stay packed.
+  resolved::Expression ResolveLazy(const core::Expression& x);
+  // Resolves an argument or a let binding, which is lazy unless demanded.
+  resolved::Expression ResolveDemanded(const core::Expression& x,
+                                       bool demanded);
+
+  resolved::Pattern ResolvePattern(const core::Identifier& x);
+  resolved::Pattern ResolvePattern(const core::MatchTuple& x);
+  resolved::Pattern ResolvePattern(const core::MatchUnion& x);
+  resolved::Pattern ResolvePattern(const core::Integer& x);
+  resolved::Pattern ResolvePattern(const core::Character& x);
+
+  void FreeVariablesImpl(flat_set<core::Identifier>&,
+                         flat_set<core::Identifier>&, const core::Builtin& x);
+  void FreeVariablesImpl(flat_set<core::Identifier>&,
+                         flat_set<core::Identifier>&,
+                         const core::Identifier& x);
+  void FreeVariablesImpl(flat_set<core::Identifier>&,
+                         flat_set<core::Identifier>&, const core::Integer& x);
+  void FreeVariablesImpl(flat_set<core::Identifier>&,
+                         flat_set<core::Identifier>&,
+                         const core::Character& x);
+  void FreeVariablesImpl(flat_set<core::Identifier>&,
+                         flat_set<core::Identifier>&, const core::Tuple& x);
+  void FreeVariablesImpl(flat_set<core::Identifier>&,
+                         flat_set<core::Identifier>&,
+                         const core::UnionConstructor& x);
+  void FreeVariablesImpl(flat_set<core::Identifier>&,
+                         flat_set<core::Identifier>&, const core::Apply& x);
+  void FreeVariablesImpl(flat_set<core::Identifier>&,
+                         flat_set<core::Identifier>&, const core::Lambda& x);
+  void FreeVariablesImpl(flat_set<core::Identifier>&,
+                         flat_set<core::Identifier>&, const core::Let& x);
+  void FreeVariablesImpl(flat_set<core::Identifier>&,
+                         flat_set<core::Identifier>&,
+                         const core::LetRecursive& x);
+  void FreeVariablesImpl(flat_set<core::Identifier>&,
+                         flat_set<core::Identifier>&,
+                         const core::Case::Alternative& x);
+  void FreeVariablesImpl(flat_set<core::Identifier>&,
+                         flat_set<core::Identifier>&, const core::Case& x);
+  void FreeVariables(flat_set<core::Identifier>& bound,
+                     flat_set<core::Identifier>& result,
+                     const core::Expression& x);
+
+  flat_set<core::Identifier> GetBindingsImpl(const core::Identifier&);
+  flat_set<core::Identifier> GetBindingsImpl(const core::MatchTuple&);
+  flat_set<core::Identifier> GetBindingsImpl(const core::MatchUnion&);
+  flat_set<core::Identifier> GetBindingsImpl(const core::Integer&);
+  flat_set<core::Identifier> GetBindingsImpl(const core::Character&);
+  flat_set<core::Identifier> GetBindings(const core::Pattern&);
+
+  const StrictnessAnalyzer::Result& strict_;
+  const TupleResultAnalyzer::Result& results_;
+  const SelfTailCallFinder::Result& loops_;
+  Frame* frame_ = nullptr;
+  int next_function_id_ = 0;
+  std::vector<resolved::Expression> constants_;
+  std::map<std::string, int> strings_;
+};
+
+int Resolver::Bind(core::Identifier id) {
+  const int slot = frame_->next_slot++;
+  frame_->size = std::max(frame_->size, frame_->next_slot);
+  frame_->slots[id].push_back(slot);
+  frame_->arities.erase(slot);
+  return slot;
+}
+
+void Resolver::Unbind(core::Identifier id) {
+  frame_->next_slot--;
+  frame_->slots.at(id).pop_back();
+}
+
+int Resolver::Lookup(const Frame& frame, core::Identifier id) const {
+  auto i = frame.slots.find(id);
+  if (i == frame.slots.end() || i->second.empty()) {
+    throw std::logic_error(StrCat("unresolved variable ", id));
+  }
+  return i->second.back();
+}
+
+resolved::Constant Resolver::AddConstant(resolved::Expression x) {
+  constants_.push_back(std::move(x));
+  return resolved::Constant(constants_.size() - 1);
+}
+
+resolved::Constant Resolver::AddString(std::string text) {
+  auto [i, is_new] = strings_.emplace(std::move(text), constants_.size());
+  if (is_new) constants_.push_back(resolved::String(i->first));
+  return resolved::Constant(i->second);
+}
+
+// Whether `x` is a constant which can be part of a larger one in the pool.
+bool IsConstant(const resolved::Expression& x) {
+  const resolved::Expression& value =
+      std::holds_alternative<resolved::Strict>(x->value)
+          ? std::get<resolved::Strict>(x->value).value
+          : x;
+  return std::holds_alternative<core::Builtin>(value->value) ||
+         std::holds_alternative<core::Integer>(value->value) ||
+         std::holds_alternative<core::Character>(value->value) ||
+         std::holds_alternative<core::UnionConstructor>(value->value) ||
+         std::holds_alternative<resolved::Constant>(value->value);
+}
+
+resolved::Function Resolver::ResolveFunction(
+    std::span<const core::Identifier> parameters,
+    const core::Expression& body) {
+  flat_set<core::Identifier> bound;
+  for (core::Identifier parameter : parameters) bound.insert(parameter);
+  flat_set<core::Identifier> free;
+  FreeVariables(bound, free, body);
+  const int id = next_function_id_++;
+  Frame frame{.parent = frame_, .slots = {}, .arities = {}};
+  std::vector<int> captures;
+  for (core::Identifier id : free) {
+    captures.push_back(Lookup(*frame_, id));
+  }
+  frame_ = &frame;
+  int i = 0;
+  for (core::Identifier id : free) {
+    // A captured lambda keeps its known arity.
+    const int slot = Bind(id);
+    auto arity = frame.parent->arities.find(captures[i++]);
+    if (arity != frame.parent->arities.end()) {
+      frame.arities.emplace(slot, arity->second);
+    }
+  }
+  for (core::Identifier parameter : parameters) Bind(parameter);
+  resolved::Expression result = Resolve(body);
+  frame_ = frame.parent;
+  return resolved::Function{.id = id,
+                            .captures = std::move(captures),
+                            .num_parameters = (int)parameters.size(),
+                            .frame_size = frame.size,
+                            .body = std::move(result)};
+}
+
+resolved::Program Resolver::ResolveProgram(const core::Expression& program) {
+  const int id = next_function_id_++;
+  Frame frame{.parent = nullptr, .slots = {}, .arities = {}};
+  frame_ = &frame;
+  resolved::Expression body = Resolve(program);
+  frame_ = nullptr;
+  return resolved::Program{.main = {.id = id,
+                                    .captures = {},
+                                    .num_parameters = 0,
+                                    .frame_size = frame.size,
+                                    .body = std::move(body)},
+                           .constants = std::move(constants_)};
+}
+
+resolved::Expression Resolver::Resolve(const core::Builtin& x) { return x; }
+
+resolved::Expression Resolver::Resolve(const core::Identifier& x) {
+  return resolved::Variable(Lookup(*frame_, x));
+}
+
+resolved::Expression Resolver::Resolve(const core::Integer& x) { return x; }
+
+resolved::Expression Resolver::Resolve(const core::Character& x) { return x; }
+
+resolved::Expression Resolver::Resolve(const core::Tuple& x) {
+  std::vector<resolved::Expression> elements;
+  for (const auto& element : x.elements) {
+    elements.push_back(ResolveLazy(element));
+  }
+  if (std::ranges::all_of(elements, IsConstant)) {
+    return AddConstant(resolved::Tuple(std::move(elements)));
+  }
+  return resolved::Tuple(std::move(elements));
+}
+
+// Checks the limits on the type and index of a constructor.
+void CheckLimits(const core::UnionConstructor& x) {
+  if ((int)x.type->id > kMaxUnionTypeId || x.index > kMaxUnionIndex) {
+    throw std::runtime_error("too many data types or constructors");
+  }
+}
+
+resolved::Expression Resolver::Resolve(const core::UnionConstructor& x) {
+  CheckLimits(x);
+  // Booleans are immediates, but other constructors are allocated.
+  if (x.type->id == core::UnionType::Id::kBool) return x;
+  return AddConstant(x);
+}
+
+resolved::Expression Resolver::Resolve(const core::Apply& x) {
+  if (std::optional<std::string> text = AsStringLiteral(x)) {
+    return AddString(std::move(*text));
+  }
+  if (auto loop = loops_.find(&x); loop != loops_.end()) {
+    return ResolveLoop(x, *loop->second);
+  }
+  if (std::optional<resolved::Expression> call = ResolveCall(x)) return *call;
+  return resolved::Apply(Resolve(x.f),
+                         ResolveDemanded(x.x, strict_.arguments.contains(&x)));
+}
+
+std::optional<resolved::Expression> Resolver::ResolveCall(
+    const core::Apply& x) {
+  std::vector<const core::Apply*> spine = {&x};
+  while (const auto* f = std::get_if<core::Apply>(&spine.back()->f->value)) {
+    spine.push_back(f);
+  }
+  const core::Expression& f = spine.back()->f;
+  resolved::Call result;
+  int arity;
+  if (const auto* builtin = std::get_if<core::Builtin>(&f->value)) {
+    result.function = *builtin;
+    arity = StrictnessAnalyzer::BuiltinSignature(*builtin).strict.size();
+  } else if (const auto* constructor =
+                 std::get_if<core::UnionConstructor>(&f->value)) {
+    CheckLimits(*constructor);
+    result.function = *constructor;
+    arity = constructor->type->alternatives.at(constructor->index).num_members;
+  } else if (const auto* id = std::get_if<core::Identifier>(&f->value)) {
+    const int slot = Lookup(*frame_, *id);
+    auto i = frame_->arities.find(slot);
+    if (i == frame_->arities.end()) return std::nullopt;
+    result.function = resolved::Variable(slot);
+    arity = i->second;
+    auto size = results_.functions.find(*id);
+    if (size != results_.functions.end()) result.result_size = size->second;
+  } else {
+    return std::nullopt;
+  }
+  // An over-saturated application is a call with further arguments applied to
+  // its result, which is found when resolving the function of the outer ones.
+  if ((int)spine.size() != arity) return std::nullopt;
+  for (auto i = spine.rbegin(); i != spine.rend(); i++) {
+    const core::Apply* apply = *i;
+    if (IsConditional(result) && !result.arguments.empty()) {
+      result.arguments.push_back(Resolve(apply->x));
+    } else {
+      result.arguments.push_back(
+          ResolveDemanded(apply->x, strict_.arguments.contains(apply)));
+    }
+  }
+  if (std::holds_alternative<core::UnionConstructor>(result.function) &&
+      std::ranges::all_of(result.arguments, IsConstant)) {
+    return AddConstant(resolved::Strict(std::move(result)));
+  }
+  return result;
+}
+
+resolved::Expression Resolver::ResolveLoop(const core::Apply& x,
+                                           const core::Lambda& lambda) {
+  resolved::Loop result;
+  const core::Lambda* parameter = &lambda;
+  while (parameter) {
+    result.slots.push_back(Lookup(*frame_, parameter->parameter));
+    parameter = std::get_if<core::Lambda>(&parameter->result->value);
+  }
+  std::vector<const core::Apply*> spine = {&x};
+  while (const auto* f = std::get_if<core::Apply>(&spine.back()->f->value)) {
+    spine.push_back(f);
+  }
+  for (auto i = spine.rbegin(); i != spine.rend(); i++) {
+    const core::Apply* apply = *i;
+    result.arguments.push_back(
+        ResolveDemanded(apply->x, strict_.arguments.contains(apply)));
+  }
+  return result;
+}
+
+resolved::Expression Resolver::Resolve(const core::Lambda& x) {
+  std::vector<core::Identifier> parameters = {x.parameter};
+  const core::Expression* body = &x.result;
+  while (const auto* lambda = std::get_if<core::Lambda>(&(*body)->value)) {
+    parameters.push_back(lambda->parameter);
+    body = &lambda->result;
+  }
+  resolved::Function function = ResolveFunction(parameters, *body);
+  auto size = results_.lambdas.find(&x);
+  if (size != results_.lambdas.end()) function.result_size = size->second;
+  return resolved::Lambda(std::move(function));
+}
+
+resolved::Expression Resolver::Resolve(const core::Let& x) {
+  resolved::Expression value =
+      ResolveDemanded(x.binding.value, strict_.bindings.contains(&x));
+  const int slot = Bind(x.binding.variable);
+  if (const int arity = NumParameters(x.binding.value)) {
+    frame_->arities.emplace(slot, arity);
+  }
+  resolved::Expression body = Resolve(x.value);
+  Unbind(x.binding.variable);
+  return resolved::Let(slot, std::move(value), std::move(body));
+}
+
+resolved::Expression Resolver::Resolve(const core::LetRecursive& x) {
+  std::vector<int> slots;
+  for (const auto& binding : x.bindings) {
+    slots.push_back(Bind(binding.variable));
+    if (const int arity = NumParameters(binding.value)) {
+      frame_->arities.emplace(slots.back(), arity);
+    }
+  }
+  std::vector<resolved::LetRecursive::Binding> bindings;
+  for (int i = 0, n = x.bindings.size(); i < n; i++) {
+    bindings.push_back({slots[i], ResolveLazy(x.bindings[i].value)});
+  }
+  resolved::Expression body = Resolve(x.value);
+  for (int i = x.bindings.size() - 1; i >= 0; i--) {
+    Unbind(x.bindings[i].variable);
+  }
+  return resolved::LetRecursive(std::move(bindings), std::move(body));
+}
+
+resolved::Expression Resolver::Resolve(const core::Case& x) {
+  resolved::Case result{.value = Resolve(x.value),
+                        .alternatives = {},
+                        .dispatch = {},
+                        .type_id = {},
+                        .source = &x};
+  for (const auto& alternative : x.alternatives) {
+    const std::size_t next_slot = frame_->next_slot;
+    resolved::Pattern pattern =
+        std::visit([&](const auto& x) { return ResolvePattern(x); },
+                   alternative.pattern->value);
+    result.alternatives.push_back({std::move(pattern),
+                                   Resolve(alternative.value)});
+    for (core::Identifier id : GetBindings(alternative.pattern)) Unbind(id);
+    if (frame_->next_slot != (int)next_slot) {
+      throw std::logic_error("unbalanced pattern bindings");
+    }
+  }
+  const core::UnionType* type = nullptr;
+  for (const auto& alternative : x.alternatives) {
+    if (std::holds_alternative<core::Identifier>(alternative.pattern->value)) {
+      continue;
+    }
+    const auto* u = std::get_if<core::MatchUnion>(&alternative.pattern->value);
+    if (!u || (type && type->id != u->type->id)) return result;
+    type = u->type.get();
+  }
+  if (!type) return result;
+  result.type_id = type->id;
+  for (int tag = 0, n = type->alternatives.size(); tag < n; tag++) {
+    int selected = -1;
+    for (int i = 0, m = x.alternatives.size(); i < m && selected == -1; i++) {
+      const auto* u =
+          std::get_if<core::MatchUnion>(&x.alternatives[i].pattern->value);
+      if (!u || u->index == tag) selected = i;
+    }
+    result.dispatch.push_back(selected);
+  }
+  return result;
+}
+
+resolved::Expression Resolver::Resolve(const core::Expression& x) {
+  return std::visit([this](const auto& x) { return Resolve(x); }, x->value);
+}
+
+resolved::Expression Resolver::ResolveLazy(const core::Apply& x) {
+  return resolved::Apply(ResolveLazy(x.f), ResolveLazy(x.x));
+}
+
+resolved::Expression Resolver::ResolveLazy(const core::Expression& x) {
+  return std::visit(
+      [&](const auto& value) -> resolved::Expression {
+        using T = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same_v<T, core::Let> ||
+                      std::is_same_v<T, core::LetRecursive> ||
+                      std::is_same_v<T, core::Case>) {
+          return resolved::Suspend(ResolveFunction({}, x));
+        } else if constexpr (std::is_same_v<T, core::Apply>) {
+          if (std::optional<std::string> text = AsStringLiteral(value)) {
+            return AddString(std::move(*text));
+          }
+          const core::Apply* apply = &value;
+          int num_arguments = 1;
+          bool demanded = false;
+          while (true) {
+            demanded = demanded || (!IsAtom(apply->x) &&
+                                    strict_.arguments.contains(apply));
+            const auto* f = std::get_if<core::Apply>(&apply->f->value);
+            if (!f) break;
+            apply = f;
+            num_arguments++;
+          }
+          const auto* constructor =
+              std::get_if<core::UnionConstructor>(&apply->f->value);
+          if (constructor &&
+              constructor->type->alternatives.at(constructor->index)
+                      .num_members == num_arguments) {
+            return resolved::Strict(Resolve(value));
+          } else if (demanded || num_arguments > 1) {
+            // A single suspension is smaller than a chain of partial
+            // applications, one for each argument.
+            return resolved::Suspend(ResolveFunction({}, x));
+          } else {
+            return ResolveLazy(value);
+          }
+        } else {
+          return ResolveLazy(value);
+        }
+      },
+      x->value);
+}
+
+resolved::Expression Resolver::ResolveDemanded(const core::Expression& x,
+                                               bool demanded) {
+  if (demanded) return resolved::Strict(Resolve(x));
+  return ResolveLazy(x);
+}
+
+resolved::Pattern Resolver::ResolvePattern(const core::Identifier& x) {
+  return resolved::Variable(Bind(x));
+}
+
+resolved::Pattern Resolver::ResolvePattern(const core::MatchTuple& x) {
+  resolved::MatchTuple result;
+  for (core::Identifier id : x.elements) result.slots.push_back(Bind(id));
+  return result;
+}
+
+resolved::Pattern Resolver::ResolvePattern(const core::MatchUnion& x) {
+  resolved::MatchUnion result{
+      .type_id = x.type->id, .index = x.index, .slots = {}};
+  for (core::Identifier id : x.elements) result.slots.push_back(Bind(id));
+  return result;
+}
+
+resolved::Pattern Resolver::ResolvePattern(const core::Integer& x) {
+  return x;
+}
+
+resolved::Pattern Resolver::ResolvePattern(const core::Character& x) {
+  return x;
+}
+
+void Resolver::FreeVariablesImpl(flat_set<core::Identifier>&,
+                                 flat_set<core::Identifier>&,
+                                 const core::Builtin&) {}
+
+void Resolver::FreeVariablesImpl(flat_set<core::Identifier>& bound,
+                                 flat_set<core::Identifier>& result,
+                                 const core::Identifier& x) {
+  if (!bound.contains(x)) result.insert(x);
+}
+
+void Resolver::FreeVariablesImpl(flat_set<core::Identifier>&,
+                                 flat_set<core::Identifier>&,
+                                 const core::Integer&) {}
+
+void Resolver::FreeVariablesImpl(flat_set<core::Identifier>&,
+                                 flat_set<core::Identifier>&,
+                                 const core::Character&) {}
+
+void Resolver::FreeVariablesImpl(flat_set<core::Identifier>& bound,
+                                 flat_set<core::Identifier>& result,
+                                 const core::Tuple& x) {
+  for (const auto& element : x.elements) {
+    FreeVariables(bound, result, element);
+  }
+}
+
+void Resolver::FreeVariablesImpl(flat_set<core::Identifier>&,
+                                 flat_set<core::Identifier>&,
+                                 const core::UnionConstructor&) {}
+
+void Resolver::FreeVariablesImpl(flat_set<core::Identifier>& bound,
+                                 flat_set<core::Identifier>& result,
+                                 const core::Apply& x) {
+  FreeVariables(bound, result, x.f);
+  FreeVariables(bound, result, x.x);
+}
+
+void Resolver::FreeVariablesImpl(flat_set<core::Identifier>& bound,
+                                 flat_set<core::Identifier>& result,
+                                 const core::Lambda& x) {
+  auto [i, is_new] = bound.emplace(x.parameter);
+  FreeVariables(bound, result, x.result);
+  if (is_new) bound.erase(x.parameter);
+}
+
+void Resolver::FreeVariablesImpl(flat_set<core::Identifier>& bound,
+                                 flat_set<core::Identifier>& result,
+                                 const core::Let& x) {
+  FreeVariables(bound, result, x.binding.value);
+  auto [i, is_new] = bound.emplace(x.binding.variable);
+  FreeVariables(bound, result, x.value);
+  if (is_new) bound.erase(x.binding.variable);
+}
+
+void Resolver::FreeVariablesImpl(flat_set<core::Identifier>& bound,
+                                 flat_set<core::Identifier>& result,
+                                 const core::LetRecursive& x) {
+  std::vector<core::Identifier> newly_bound;
+  for (const auto& binding : x.bindings) {
+    auto [i, is_new] = bound.emplace(binding.variable);
+    if (is_new) newly_bound.push_back(binding.variable);
+  }
+  for (const auto& binding : x.bindings) {
+    FreeVariables(bound, result, binding.value);
+  }
+  FreeVariables(bound, result, x.value);
+  for (const auto& id : newly_bound) bound.erase(id);
+}
+
+void Resolver::FreeVariablesImpl(flat_set<core::Identifier>& bound,
+                                 flat_set<core::Identifier>& result,
+                                 const core::Case::Alternative& x) {
+  flat_set<core::Identifier> bindings = GetBindings(x.pattern);
+  flat_set<core::Identifier> newly_bound;
+  for (const auto& binding : bindings) {
+    auto [i, is_new] = bound.emplace(binding);
+    if (is_new) newly_bound.insert(binding);
+  }
+  FreeVariables(bound, result, x.value);
+  for (const auto& id : newly_bound) bound.erase(id);
+}
+
+void Resolver::FreeVariablesImpl(flat_set<core::Identifier>& bound,
+                                 flat_set<core::Identifier>& result,
+                                 const core::Case& x) {
+  FreeVariables(bound, result, x.value);
+  for (const auto& alternative : x.alternatives) {
+    FreeVariablesImpl(bound, result, alternative);
+  }
+}
+
+void Resolver::FreeVariables(flat_set<core::Identifier>& bound,
+                             flat_set<core::Identifier>& result,
+                             const core::Expression& x) {
+  return std::visit(
+      [this, &bound, &result](const auto& x) {
+        return FreeVariablesImpl(bound, result, x);
+      },
+      x->value);
+}
+
+flat_set<core::Identifier> Resolver::GetBindingsImpl(
+    const core::Identifier& x) {
+  return {x};
+}
+
+flat_set<core::Identifier> Resolver::GetBindingsImpl(
+    const core::MatchTuple& x) {
+  return flat_set<core::Identifier>(x.elements);
+}
+
+flat_set<core::Identifier> Resolver::GetBindingsImpl(
+    const core::MatchUnion& x) {
+  return flat_set<core::Identifier>(x.elements);
+}
+
+flat_set<core::Identifier> Resolver::GetBindingsImpl(const core::Integer&) {
+  return {};
+}
+
+flat_set<core::Identifier> Resolver::GetBindingsImpl(
+    const core::Character&) {
+  return {};
+}
+
+flat_set<core::Identifier> Resolver::GetBindings(const core::Pattern& x) {
+  return std::visit([this](const auto& x) { return GetBindingsImpl(x); },
+                    x->value);
+}
+
+// A flat encoding of resolved functions for the bytecode backend. Each
+// function body is a sequence of instructions for a simple stack machine:
+// strict values are computed into an accumulator, while lazy values (and the
+// arguments of applications) are pushed onto the interpreter's stack. Case
+// alternatives become conditional jumps.
+//
+// The machine never recurses natively to call a function or to evaluate a
+// thunk. Instead, whatever remains to be done once the value arrives is pushed
+// onto an explicit continuation stack, so the depth of evaluation is limited
+// only by memory. Applications and variables in tail position discard the
+// current frame before transferring control, so tail calls run in constant
+// space.
+namespace bytecode {
+
+enum class Op : std::uint8_t {
+  // Strict operations, which replace the accumulator.
+  kBuiltin,        // builtin a
+  kInteger,        // integers[a]
+  kCharacter,      // the character a
+  kConstructor,    // constructors[a]
+  kLoad,           // the value of slot a
+  kForce,          // the value of the popped top of the stack
+  kTuple,          // a tuple of the top a stack entries, which are popped
+  kLambda,         // a closure for functions[a]
+  kConstant,       // the value of constant a
+  kApply,          // the result of applying the accumulator to the popped top
+                   // of the stack
+  kCallBuiltin,    // the result of builtin a applied to the top b stack
+                   // entries, which are popped
+  kConstruct,      // constructors[a] applied to the top b stack entries, which
+                   // are popped
+  kEnter,          // the result of the accumulator, a lambda of b parameters,
+                   // applied to the top b stack entries, which are popped
+  kEnterUnboxed,   // as for kEnter, but the function has a result_size, and
+                   // pushes the elements of its result onto the stack
+  kOperator,       // the result of builtin a, an operator, applied to the
+                   // popped top of the stack and the accumulator
+  // Lazy operations, which push onto the stack.
+  kPush,           // slot a
+  kPushValue,      // the accumulator
+  kPushApply,      // a thunk applying the next entry to the top, both popped
+  kPushSuspension, // a thunk for functions[a]
+  kPushConstant,   // constant a
+  kSpread,         // the elements of the accumulator, a tuple
+  // Bindings.
+  kStore,          // pops into slot a
+  kHole,           // stores a hole for a recursive binding in slot a
+  kFill,           // pops the definition for the hole in slot a
+  // Pattern matching against the accumulator. On a mismatch, the refutable
+  // patterns jump to a and the irrefutable ones raise an error.
+  kBind,           // stores the accumulator in slot a
+  kMatchTuple,     // tuples[b]
+  kMatchUnion,     // unions[b]
+  kMatchInteger,   // integers[b]
+  kMatchCharacter, // the character b
+  kNoMatch,        // raises an error for cases[a]
+  kSwitch,         // jumps to the target in switches[a] for the accumulator's
+                   // constructor
+  kUnpack,         // binds the members of the accumulator as for unions[b],
+                   // which it is already known to match
+  // Control flow.
+  kJump,           // to a
+  kJumpIf,         // to a if the accumulator is the bool b
+  kReturn,         // the accumulator
+  kTailLoad,       // the value of slot a
+  kTailApply,      // the result of kApply
+  kTailCallBuiltin, // the result of kCallBuiltin
+  kTailEnter,      // the result of kEnter
+  kTailEnterUnboxed, // the result of kEnterUnboxed
+};
+
+struct Instruction {
+  Op op;
+  std::int32_t a = 0;
+  std::int32_t b = 0;
+};
+
+// A jump table for a case over the constructors of a union type, giving the
+// address of the alternative for each constructor.
+struct Switch {
+  core::UnionType::Id type_id;
+  std::vector<std::int32_t> targets;
+};
+
+// The compiled body of a resolved function, along with the constants which
+// its instructions refer to.
+struct Code {
+  std::vector<Instruction> instructions;
+  // For a function with a result_size, the start of a second version of the
+  // body which returns the elements of its result on the stack.
+  std::int32_t unboxed_entry = -1;
+  std::vector<std::int64_t> integers;
+  std::vector<core::UnionConstructor> constructors;
+  std::vector<const resolved::Function*> functions;
+  std::vector<const resolved::MatchTuple*> tuples;
+  std::vector<const resolved::MatchUnion*> unions;
+  std::vector<const resolved::Case*> cases;
+  std::vector<Switch> switches;
+};
+
+// A step of the machine which is waiting for a value in the accumulator.
+struct Continuation {
+  enum class Kind : std::uint8_t {
+    // Resumes `code` at `pc`, in the frame starting at `frame`.
+    kResume,
+    // Stores the value as the result of the thunk `node`.
+    kUpdate,
+    // Applies the value to the popped top of the stack.
+    kApply,
+    // Evaluates the stack entries from `index` to `end`, which are strict
+    // arguments of the native lambda `node`, and then invokes it.
+    kArguments,
+    // Returns the value from Interpreter::Execute.
+    kStop,
+  };
+  Kind kind;
+  std::uint32_t index = 0;
+  std::uint32_t end = 0;
+  Node* node = nullptr;
+  const Code* code = nullptr;
+  const Instruction* pc = nullptr;
+  std::size_t frame = 0;
+};
+
+}  // namespace bytecode
+
+// Lowers every function of a resolved program to bytecode. The result is
+// indexed by function id and refers back into the resolved program, which must
+// outlive it.
+class BytecodeCompiler {
+ public:
+  std::vector<bytecode::Code> CompileProgram(const resolved::Function& main);
+
+ private:
+  void CompileFunction(const resolved::Function& function);
+
+  int Emit(bytecode::Op op, int a = 0, int b = 0);
+  template <typename T>
+  int Add(std::vector<T>& table, T value);
+
+  // Strict compilation leaves the value in the accumulator, or returns it from
+  // the function if `tail` is set.
+  void Compile(const core::Builtin& x);
+  void Compile(const resolved::Variable& x, bool tail);
+  void Compile(const core::Integer& x);
+  void Compile(const core::Character& x);
+  void Compile(const resolved::Tuple& x);
+  void Compile(const core::UnionConstructor& x);
+  void Compile(const resolved::Apply& x, bool tail);
+  void Compile(const resolved::Call& x, bool tail);
+  void Compile(const resolved::Loop& x, bool tail);
+  void Compile(const resolved::Lambda& x);
+  void Compile(const resolved::Suspend& x);
+  void Compile(const resolved::Strict& x, bool tail);
+  void Compile(const resolved::String& x);
+  void Compile(const resolved::Constant& x);
+  void Compile(const resolved::Let& x, bool tail);
+  void Compile(const resolved::LetRecursive& x, bool tail);
+  void Compile(const resolved::Case& x, bool tail);
+  void Compile(const resolved::Expression& x, bool tail);
+
+  // Lazy compilation pushes the value onto the stack.
+  void CompileLazy(const resolved::Variable& x);
+  void CompileLazy(const resolved::Apply& x);
+  void CompileLazy(const resolved::Call& x);
+  void CompileLazy(const resolved::Loop& x);
+  void CompileLazy(const resolved::Suspend& x);
+  void CompileLazy(const resolved::Strict& x);
+  void CompileLazy(const resolved::String& x);
+  void CompileLazy(const resolved::Constant& x);
+  void CompileLazy(const resolved::Let& x);
+  void CompileLazy(const resolved::LetRecursive& x);
+  void CompileLazy(const resolved::Case& x);
+  void CompileLazy(const auto& x);
+  void CompileLazy(const resolved::Expression& x);
+
+  // Emits a test of the accumulator against `x`, returning the index of the
+  // instruction whose jump target must be patched to the next alternative.
+  std::optional<int> CompilePattern(const resolved::Variable& x);
+  std::optional<int> CompilePattern(const resolved::MatchTuple& x);
+  std::optional<int> CompilePattern(const resolved::MatchUnion& x);
+  std::optional<int> CompilePattern(const core::Integer& x);
+  std::optional<int> CompilePattern(const core::Character& x);
+
+  // Returns the elements of the tuple which `x` evaluates to on the stack,
+  // from the unboxed version of a function.
+  void CompileUnboxed(const resolved::Expression& x);
+
+  std::vector<bytecode::Code> program_;
+  std::vector<const resolved::Function*> pending_;
+  bytecode::Code* code_ = nullptr;
+  // The result_size of the function being compiled, while compiling its
+  // unboxed version, or zero otherwise.
+  int unboxed_ = 0;
+  // The start of the version of the body being compiled.
+  int entry_ = 0;
+};
+
+std::vector<bytecode::Code> BytecodeCompiler::CompileProgram(
+    const resolved::Function& main) {
+  pending_.push_back(&main);
+  while (!pending_.empty()) {
+    const resolved::Function* function = pending_.back();
+    pending_.pop_back();
+    CompileFunction(*function);
+  }
+  return std::move(program_);
+}
+
+void BytecodeCompiler::CompileFunction(const resolved::Function& function) {
+  if (function.id >= (int)program_.size()) program_.resize(function.id + 1);
+  code_ = &program_[function.id];
+  // The body of a function with a result size is compiled twice, so the
+  // functions within it are found twice too.
+  if (!code_->instructions.empty()) return;
+  entry_ = 0;
+  Compile(function.body, true);
+  if (function.result_size) {
+    code_->unboxed_entry = entry_ = code_->instructions.size();
+    unboxed_ = function.result_size;
+    Compile(function.body, true);
+    unboxed_ = 0;
+  }
+  code_ = nullptr;
+}
+
+int BytecodeCompiler::Emit(bytecode::Op op, int a, int b) {
+  code_->instructions.push_back({.op = op, .a = a, .b = b});
+  return code_->instructions.size() - 1;
+}
+
+template <typename T>
+int BytecodeCompiler::Add(std::vector<T>& table, T value) {
+  table.push_back(std::move(value));
+  return table.size() - 1;
+}
+
+void BytecodeCompiler::Compile(const core::Builtin& x) {
+  Emit(bytecode::Op::kBuiltin, static_cast<int>(x));
+}
+
+void BytecodeCompiler::Compile(const resolved::Variable& x, bool tail) {
+  Emit(tail ? bytecode::Op::kTailLoad : bytecode::Op::kLoad, x.slot);
+}
+
+void BytecodeCompiler::Compile(const core::Integer& x) {
+  Emit(bytecode::Op::kInteger, Add(code_->integers, x.value));
+}
+
+void BytecodeCompiler::Compile(const core::Character& x) {
+  Emit(bytecode::Op::kCharacter, x.value);
+}
+
+void BytecodeCompiler::Compile(const resolved::Tuple& x) {
+  for (const auto& element : x.elements) CompileLazy(element);
+  Emit(bytecode::Op::kTuple, x.elements.size());
+}
+
+void BytecodeCompiler::Compile(const core::UnionConstructor& x) {
+  Emit(bytecode::Op::kConstructor, Add(code_->constructors, x));
+}
+
+void BytecodeCompiler::Compile(const resolved::Apply& x, bool tail) {
+  CompileLazy(x.x);
+  Compile(x.f, false);
+  Emit(tail ? bytecode::Op::kTailApply : bytecode::Op::kApply);
+}
+
+void BytecodeCompiler::Compile(const resolved::Call& x, bool tail) {
+  if (resolved::IsConditional(x)) {
+    // The result is the first argument if that decides it, and the second
+    // one otherwise.
+    const bool decided = std::get<core::Builtin>(x.function) ==
+                         core::Builtin::kOr;
+    Compile(x.arguments[0], false);
+    const int skip = Emit(bytecode::Op::kJumpIf, 0, decided);
+    Compile(x.arguments[1], tail);
+    code_->instructions[skip].a = code_->instructions.size();
+    if (tail) Emit(bytecode::Op::kReturn);
+    return;
+  }
+  if (resolved::IsOperator(x)) {
+    // Both operands are values, so they are computed in place instead of
+    // being pushed as lazy arguments.
+    Compile(x.arguments[0], false);
+    Emit(bytecode::Op::kPushValue);
+    Compile(x.arguments[1], false);
+    Emit(bytecode::Op::kOperator,
+         static_cast<int>(std::get<core::Builtin>(x.function)));
+    if (tail) Emit(bytecode::Op::kReturn);
+    return;
+  }
+  for (const auto& argument : x.arguments) CompileLazy(argument);
+  const int n = x.arguments.size();
+  if (const auto* builtin = std::get_if<core::Builtin>(&x.function)) {
+    // Builtins such as (++) may force a lazy argument, so a call in tail
+    // position releases the frame first, just like an application.
+    Emit(tail ? bytecode::Op::kTailCallBuiltin : bytecode::Op::kCallBuiltin,
+         static_cast<int>(*builtin), n);
+  } else if (const auto* f = std::get_if<resolved::Variable>(&x.function)) {
+    Emit(bytecode::Op::kLoad, f->slot);
+    Emit(tail ? bytecode::Op::kTailEnter : bytecode::Op::kEnter, 0, n);
+  } else {
+    const auto& constructor = std::get<core::UnionConstructor>(x.function);
+    Emit(bytecode::Op::kConstruct, Add(code_->constructors, constructor), n);
+    if (tail) Emit(bytecode::Op::kReturn);
+  }
+}
+
+void BytecodeCompiler::Compile(const resolved::Loop& x, bool tail) {
+  if (!tail) throw std::logic_error("loop outside of tail position");
+  // Every argument is computed before any parameter is overwritten, since the
+  // arguments may refer to the parameters.
+  for (const auto& argument : x.arguments) CompileLazy(argument);
+  for (int i = x.slots.size() - 1; i >= 0; i--) {
+    Emit(bytecode::Op::kStore, x.slots[i]);
+  }
+  Emit(bytecode::Op::kJump, entry_);
+}
+
+void BytecodeCompiler::Compile(const resolved::Lambda& x) {
+  pending_.push_back(&x.function);
+  Emit(bytecode::Op::kLambda, Add(code_->functions, &x.function));
+}
+
+void BytecodeCompiler::Compile(const resolved::Suspend& x) {
+  CompileLazy(x);
+  Emit(bytecode::Op::kForce);
+}
+
+void BytecodeCompiler::Compile(const resolved::Strict& x, bool tail) {
+  Compile(x.value, tail);
+}
+
+void BytecodeCompiler::Compile(const resolved::String&) {
+  throw std::logic_error("string literal outside of the constant pool");
+}
+
+void BytecodeCompiler::Compile(const resolved::Constant& x) {
+  Emit(bytecode::Op::kConstant, x.index);
+}
+
+void BytecodeCompiler::Compile(const resolved::Let& x, bool tail) {
+  CompileLazy(x.value);
+  Emit(bytecode::Op::kStore, x.slot);
+  Compile(x.body, tail);
+}
+
+void BytecodeCompiler::Compile(const resolved::LetRecursive& x, bool tail) {
+  for (const auto& binding : x.bindings) {
+    Emit(bytecode::Op::kHole, binding.slot);
+  }
+  for (const auto& binding : x.bindings) {
+    CompileLazy(binding.value);
+    Emit(bytecode::Op::kFill, binding.slot);
+  }
+  Compile(x.body, tail);
+}
+
+void BytecodeCompiler::Compile(const resolved::Case& x, bool tail) {
+  const auto* call = std::get_if<resolved::Call>(&x.value->value);
+  const auto* tuple =
+      std::get_if<resolved::MatchTuple>(&x.alternatives.front().pattern);
+  if (call && call->result_size && tuple) {
+    // The tuple pattern always matches, so the elements can be stored
+    // straight into its slots.
+    assert(call->result_size == (int)tuple->slots.size());
+    for (const auto& argument : call->arguments) CompileLazy(argument);
+    const auto& f = std::get<resolved::Variable>(call->function);
+    Emit(bytecode::Op::kLoad, f.slot);
+    Emit(bytecode::Op::kEnterUnboxed, 0, call->arguments.size());
+    for (int i = tuple->slots.size() - 1; i >= 0; i--) {
+      Emit(bytecode::Op::kStore, tuple->slots[i]);
+    }
+    Compile(x.alternatives.front().value, tail);
+    return;
+  }
+  Compile(x.value, false);
+  std::vector<int> exits;
+  if (!x.dispatch.empty()) {
+    const int s = Add(code_->switches, bytecode::Switch{x.type_id, {}});
+    Emit(bytecode::Op::kSwitch, s);
+    std::vector<int> entries;
+    for (const auto& alternative : x.alternatives) {
+      entries.push_back(code_->instructions.size());
+      const auto& pattern = alternative.pattern;
+      if (const auto* v = std::get_if<resolved::Variable>(&pattern)) {
+        Emit(bytecode::Op::kBind, v->slot);
+      } else {
+        const auto& u = std::get<resolved::MatchUnion>(pattern);
+        if (!u.slots.empty()) {
+          Emit(bytecode::Op::kUnpack, 0, Add(code_->unions, &u));
+        }
+      }
+      Compile(alternative.value, tail);
+      if (!tail) exits.push_back(Emit(bytecode::Op::kJump));
+    }
+    const int no_match = Emit(bytecode::Op::kNoMatch, Add(code_->cases, &x));
+    for (int i : x.dispatch) {
+      code_->switches[s].targets.push_back(i == -1 ? no_match : entries[i]);
+    }
+    for (int exit : exits) {
+      code_->instructions[exit].a = code_->instructions.size();
+    }
+    return;
+  }
+  for (const auto& alternative : x.alternatives) {
+    const std::optional<int> test = std::visit(
+        [&](const auto& pattern) { return CompilePattern(pattern); },
+        alternative.pattern);
+    Compile(alternative.value, tail);
+    if (!tail) exits.push_back(Emit(bytecode::Op::kJump));
+    if (test) code_->instructions[*test].a = code_->instructions.size();
+  }
+  Emit(bytecode::Op::kNoMatch, Add(code_->cases, &x));
+  for (int exit : exits) code_->instructions[exit].a = code_->instructions.size();
+}
+
+void BytecodeCompiler::Compile(const resolved::Expression& x, bool tail) {
+  if (tail && unboxed_ &&
+      !std::holds_alternative<resolved::Loop>(x->value) &&
+      !std::holds_alternative<resolved::Strict>(x->value) &&
+      !std::holds_alternative<resolved::Let>(x->value) &&
+      !std::holds_alternative<resolved::LetRecursive>(x->value) &&
+      !std::holds_alternative<resolved::Case>(x->value)) {
+    CompileUnboxed(x);
+    return;
+  }
+  std::visit(
+      [&](const auto& x) {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, resolved::Variable> ||
+                      std::is_same_v<T, resolved::Apply> ||
+                      std::is_same_v<T, resolved::Call> ||
+                      std::is_same_v<T, resolved::Loop> ||
+                      std::is_same_v<T, resolved::Strict> ||
+                      std::is_same_v<T, resolved::Let> ||
+                      std::is_same_v<T, resolved::LetRecursive> ||
+                      std::is_same_v<T, resolved::Case>) {
+          Compile(x, tail);
+        } else {
+          Compile(x);
+          if (tail) Emit(bytecode::Op::kReturn);
+        }
+      },
+      x->value);
+}
 
-  void Mark(std::vector<Node*>& frontier) {
-    if (reachable) return;
-    reachable = true;
-    AddChildren(frontier);
+void BytecodeCompiler::CompileUnboxed(const resolved::Expression& x) {
+  const auto* tuple = std::get_if<resolved::Tuple>(&x->value);
+  const auto* call = std::get_if<resolved::Call>(&x->value);
+  if (tuple) {
+    for (const auto& element : tuple->elements) CompileLazy(element);
+  } else if (call && call->result_size == unboxed_) {
+    for (const auto& argument : call->arguments) CompileLazy(argument);
+    const auto& f = std::get<resolved::Variable>(call->function);
+    Emit(bytecode::Op::kLoad, f.slot);
+    Emit(bytecode::Op::kTailEnterUnboxed, 0, call->arguments.size());
+    return;
+  } else {
+    // Any other result is a tuple of the same size, which is unpacked.
+    Compile(x, false);
+    Emit(bytecode::Op::kSpread, unboxed_);
   }
+  Emit(bytecode::Op::kReturn);
+}
 
-  virtual void AddChildren(std::vector<Node*>& frontier) = 0;
+void BytecodeCompiler::CompileLazy(const resolved::Variable& x) {
+  Emit(bytecode::Op::kPush, x.slot);
+}
 
-  bool reachable = false;
-};
+void BytecodeCompiler::CompileLazy(const resolved::Apply& x) {
+  CompileLazy(x.f);
+  CompileLazy(x.x);
+  Emit(bytecode::Op::kPushApply);
+}
 
-struct Value;
-struct Interpreter;
+void BytecodeCompiler::CompileLazy(const resolved::Call&) {
+  throw std::logic_error("call in lazy position was not suspended");
+}
 
-struct GCPtrBase {
-  virtual void Mark(std::vector<Node*>& frontier) = 0;
-  GCPtrBase* prev;
-  GCPtrBase* next;
-};
+void BytecodeCompiler::CompileLazy(const resolved::Loop&) {
+  throw std::logic_error("loop outside of tail position");
+}
 
-template <std::derived_from<Node> T>
-class GCPtr : public GCPtrBase {
- public:
-  GCPtr() = default;
-  GCPtr(std::nullptr_t) : GCPtr() {}
-  GCPtr(Interpreter* interpreter, T* value);
-  template <typename U = T>
-  requires std::convertible_to<U*, T*>
-  GCPtr(const GCPtr<U>& other) : GCPtr(other.interpreter_, other.value_) {}
-  GCPtr(const GCPtr& other) : GCPtr(other.interpreter_, other.value_) {}
-  GCPtr& operator=(const GCPtr& other);
+void BytecodeCompiler::CompileLazy(const resolved::Suspend& x) {
+  pending_.push_back(&x.function);
+  Emit(bytecode::Op::kPushSuspension, Add(code_->functions, &x.function));
+}
 
-  template <typename U = T>
-  requires std::convertible_to<U*, T*>
-  GCPtr(GCPtr<U>&& other);
-  GCPtr& operator=(GCPtr&& other);
+void BytecodeCompiler::CompileLazy(const resolved::Strict& x) {
+  Compile(x.value, false);
+  Emit(bytecode::Op::kPushValue);
+}
 
-  GCPtr& operator=(T* value) {
-    value_ = value;
-    return *this;
-  }
+void BytecodeCompiler::CompileLazy(const resolved::String&) {
+  throw std::logic_error("string literal outside of the constant pool");
+}
 
-  void Mark(std::vector<Node*>& frontier) override {
-    if (value_) value_->Mark(frontier);
-  }
+void BytecodeCompiler::CompileLazy(const resolved::Constant& x) {
+  Emit(bytecode::Op::kPushConstant, x.index);
+}
 
-  ~GCPtr();
+void BytecodeCompiler::CompileLazy(const resolved::Let&) {
+  throw std::logic_error("let in lazy position was not suspended");
+}
 
-  T* get() const { return value_; }
-  T& operator*() const { return *value_; }
-  T* operator->() const { return value_; }
+void BytecodeCompiler::CompileLazy(const resolved::LetRecursive&) {
+  throw std::logic_error("letrec in lazy position was not suspended");
+}
 
-  operator T*() const { return value_; }
-  explicit operator bool() const { return value_ != nullptr; }
+void BytecodeCompiler::CompileLazy(const resolved::Case&) {
+  throw std::logic_error("case in lazy position was not suspended");
+}
 
- private:
-  template <std::derived_from<Node> U>
-  friend class GCPtr;
+// Everything else is already in weak head normal form once evaluated, so it
+// is evaluated immediately and boxed.
+void BytecodeCompiler::CompileLazy(const auto& x) {
+  Compile(x);
+  Emit(bytecode::Op::kPushValue);
+}
 
-  Interpreter* interpreter_ = nullptr;
-  T* value_ = nullptr;
-};
+void BytecodeCompiler::CompileLazy(const resolved::Expression& x) {
+  std::visit([this](const auto& x) { CompileLazy(x); }, x->value);
+}
 
-class Lazy;
-class Union;
+std::optional<int> BytecodeCompiler::CompilePattern(
+    const resolved::Variable& x) {
+  Emit(bytecode::Op::kBind, x.slot);
+  return std::nullopt;
+}
 
-struct Value : public Node {
-  enum class Type {
-    kInt64,
-    kChar,
-    kLambda,
-    kTuple,
-    kUnion,
-  };
+std::optional<int> BytecodeCompiler::CompilePattern(
+    const resolved::MatchTuple& x) {
+  Emit(bytecode::Op::kMatchTuple, 0, Add(code_->tuples, &x));
+  return std::nullopt;
+}
 
-  virtual Type GetType() const = 0;
+std::optional<int> BytecodeCompiler::CompilePattern(
+    const resolved::MatchUnion& x) {
+  return Emit(bytecode::Op::kMatchUnion, 0, Add(code_->unions, &x));
+}
 
-  bool AsBool() const;
-  std::int64_t AsInt64() const;
-  char AsChar() const;
-  std::span<Lazy* const> AsTuple() const;
-  const Union& AsUnion() const;
-  void Enter(Interpreter&);
-};
+std::optional<int> BytecodeCompiler::CompilePattern(const core::Integer& x) {
+  return Emit(bytecode::Op::kMatchInteger, 0, Add(code_->integers, x.value));
+}
 
-struct Thunk : Node {
-  virtual Value* Run(Interpreter& interpreter) = 0;
-};
+std::optional<int> BytecodeCompiler::CompilePattern(const core::Character& x) {
+  return Emit(bytecode::Op::kMatchCharacter, 0, x.value);
+}
 
-class Lazy final : public Node {
+// The program's standard input. A regular file is mapped into memory in one
+// go, and anything else is read in large blocks as the program consumes it.
+// The input is never discarded, so a position in it remains valid for as long
+// as the interpreter runs.
+class Input {
  public:
-  Lazy(Value* value) : has_value_(true), value_(value) {}
-  Lazy(Thunk* thunk) : has_value_(false), thunk_(thunk) {}
-  Value* Get(Interpreter& interpreter) {
-    if (!has_value_) {
-      // Evaluation of the thunk relies on evaluating itself: the expression
-      // diverges without reaching weak head normal form.
-      if (computing_) throw std::runtime_error("divergence");
-      computing_ = true;
-      value_ = thunk_->Run(interpreter);
-      has_value_ = true;
-      computing_ = false;
+  Input() {
+    struct stat info;
+    if (fstat(STDIN_FILENO, &info) == 0 && S_ISREG(info.st_mode) &&
+        info.st_size > 0) {
+      void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE,
+                           STDIN_FILENO, 0);
+      if (mapping != MAP_FAILED) {
+        mapping_ = static_cast<const char*>(mapping);
+        data_ = std::string_view(mapping_, info.st_size);
+        at_end_ = true;
+      }
     }
-    return value_;
-  }
-  void AddChildren(std::vector<Node*>& frontier) override;
- private:
-  bool has_value_;
-  bool computing_ = false;
-  union {
-    Value* value_;
-    Thunk* thunk_;
-  };
-};
-
-template <typename K>
-class flat_set {
- public:
-  flat_set() = default;
-
-  flat_set(std::initializer_list<K> contents)
-      : flat_set(std::vector(contents)) {}
-
-  flat_set(std::vector<K> contents)
-      : contents_(std::move(contents)) {
-    std::sort(contents_.begin(), contents_.end());
-  }
-
-  bool contains(const K& k) const {
-    return !contents_.empty() && contents_[Index(k)] == k;
   }
-
-  template <typename... Args>
-  requires std::constructible_from<K, Args...>
-  std::pair<typename std::vector<K>::const_iterator, bool>
-  emplace(Args&&... args) {
-    if (contents_.empty()) {
-      return std::pair(
-          contents_.emplace(contents_.end(), std::forward<Args>(args)...),
-          true);
-    }
-    K k(std::forward<Args>(args)...);
-    const int i = Index(k);
-    if (contents_[i] == k) return std::pair(contents_.begin() + i, false);
-    return std::pair(contents_.emplace(contents_.begin() + i + 1, std::move(k)),
-                     true);
+  ~Input() {
+    if (mapping_) munmap(const_cast<char*>(mapping_), data_.size());
   }
-
-  std::pair<typename std::vector<K>::const_iterator, bool> insert(const K& k) {
-    return emplace(k);
+  Input(const Input&) = delete;
+  Input& operator=(const Input&) = delete;
+
+  // Returns whether there is a character at `offset`, reading more input if
+  // necessary.
+  bool Has(std::size_t offset) {
+    while (offset >= data_.size() && !at_end_) Fill();
+    return offset < data_.size();
   }
+  char operator[](std::size_t offset) const { return data_[offset]; }
 
-  void erase(const K& k) {
-    if (contents_.empty()) return;
-    const int i = Index(k);
-    if (contents_[i] == k) contents_.erase(contents_.begin() + i);
+  // Returns everything from `offset` to the end of the input.
+  std::string_view From(std::size_t offset) {
+    while (!at_end_) Fill();
+    return data_.substr(std::min(offset, data_.size()));
   }
 
-  bool empty() const { return contents_.empty(); }
-  auto size() const { return contents_.size(); }
-  auto begin() const { return contents_.begin(); }
-  auto end() const { return contents_.end(); }
-
  private:
-  int Index(const K& k) const {
-    int a = 0, b = contents_.size();
-    while (b - a > 1) {
-      const int i = (a + b) / 2;
-      if (k < contents_[i]) {
-        b = i;
-      } else {
-        a = i;
-      }
-    }
-    return a;
+  static constexpr std::size_t kBlockSize = 1 << 16;
+
+  void Fill() {
+    const std::size_t size = buffer_.size();
+    buffer_.resize(size + kBlockSize);
+    ssize_t n;
+    do {
+      n = read(STDIN_FILENO, buffer_.data() + size, kBlockSize);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) throw std::runtime_error("can't read input");
+    if (n == 0) at_end_ = true;
+    buffer_.resize(size + n);
+    data_ = buffer_;
   }
 
-  std::vector<K> contents_;
+  const char* mapping_ = nullptr;
+  std::string buffer_;
+  std::string_view data_;
+  bool at_end_ = false;
 };
 
-template <typename K, typename V>
-class flat_map {
+// The program's standard output, which is written in large blocks.
+class Output {
  public:
-  V& operator[](const K& k) {
-    if (contents_.empty()) {
-      auto& entry = contents_.emplace_back(k, V());
-      return entry.second;
+  void Write(char c) {
+    if (buffer_.size() == kBlockSize) Flush();
+    buffer_.push_back(c);
+  }
+  void Write(std::string_view text) {
+    if (buffer_.size() + text.size() > kBlockSize) Flush();
+    if (text.size() >= kBlockSize) {
+      WriteAll(text);
+    } else {
+      buffer_ += text;
     }
-    const int i = Index(k);
-    if (contents_[i].first == k) return contents_[i].second;
-    auto entry = contents_.emplace(contents_.begin() + i + 1, k, V());
-    return entry->second;
   }
-
-  const V& at(const K& k) const {
-    if (contents_.empty()) throw std::runtime_error("not found");
-    const int i = Index(k);
-    if (contents_[i].first != k) throw std::runtime_error("not found");
-    return contents_[i].second;
+  void Flush() {
+    WriteAll(buffer_);
+    buffer_.clear();
   }
 
-  bool empty() const { return contents_.empty(); }
-  auto size() const { return contents_.size(); }
-  auto begin() { return contents_.begin(); }
-  auto end() { return contents_.end(); }
-  auto begin() const { return contents_.begin(); }
-  auto end() const { return contents_.end(); }
-
  private:
-  int Index(const K& k) const {
-    int a = 0, b = contents_.size();
-    while (b - a > 1) {
-      const int i = (a + b) / 2;
-      if (k < contents_[i].first) {
-        b = i;
-      } else {
-        a = i;
+  static constexpr std::size_t kBlockSize = 1 << 16;
+
+  static void WriteAll(std::string_view text) {
+    while (!text.empty()) {
+      const ssize_t n = write(STDOUT_FILENO, text.data(), text.size());
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        throw std::runtime_error("can't write output");
       }
+      text.remove_prefix(n);
     }
-    return a;
   }
 
-  std::vector<std::pair<K, V>> contents_;
+  std::string buffer_;
 };
 
+// Returned by Evaluate(const resolved::Loop&) in place of a value, to make
+// Enter run the body of the function again. The marker is aligned, so this is
+// never confused with an immediate, and it is never dereferenced.
+alignas(Node) char loop_marker;
+Value* const kLoop = reinterpret_cast<Value*>(&loop_marker);
+
 struct Interpreter {
   template <std::derived_from<Node> T, typename... Args>
   requires std::constructible_from<T, Args...>
   GCPtr<T> Allocate(Args&&... args);
 
-  void AddPtr(GCPtrBase* p) {
-    if (live == nullptr) {
-      live = p;
-      p->next = p;
-      p->prev = p;
-    } else {
-      p->prev = live;
-      p->next = live->next;
-      p->next->prev = p;
-      p->prev->next = p;
-    }
-  }
-
-  void RemovePtr(GCPtrBase* p) {
-    if (p->next == p) {
-      live = nullptr;
-    } else {
-      live = p->prev;
-      p->next->prev = p->prev;
-      p->prev->next = p->next;
-    }
-  }
+  Interpreter();
 
   Value* Nil();
   Value* Cons(Lazy* head, Lazy* tail);
-  Value* Bool(bool value);
+  static Value* Bool(bool value);
+  static Value* Character(char value);
+  // Only allocates if `value` is too large to be immediate.
+  Value* Integer(std::int64_t value);
+  // Applies an operator, as identified by resolved::IsOperator, to two values.
+  Value* ApplyOperator(core::Builtin op, Value* l, Value* r);
+  // Returns an evaluated Lazy for `value`, which is just the value itself.
+  GCPtr<Lazy> Evaluated(Value* value);
+  // Returns the characters of `list` if it is a packed string which has not
+  // been unpacked into cons cells yet. The result is only valid until the
+  // next allocation.
+  std::optional<std::string_view> PendingString(Lazy* list);
   std::string EvaluateString(Lazy* list);
 
   void CollectGarbage();
 
-  using Captures = flat_map<core::Identifier, Lazy*>;
-  void ResolveImpl(flat_set<core::Identifier>&, Captures&,
-                   const core::Builtin& x);
-  void ResolveImpl(flat_set<core::Identifier>&, Captures&,
-                   const core::Identifier& x);
-  void ResolveImpl(flat_set<core::Identifier>&, Captures&,
-                   const core::Integer& x);
-  void ResolveImpl(flat_set<core::Identifier>&, Captures&,
-                   const core::Character& x);
-  void ResolveImpl(flat_set<core::Identifier>&, Captures&,
-                   const core::Tuple& x);
-  void ResolveImpl(flat_set<core::Identifier>&, Captures&,
-                   const core::UnionConstructor& x);
-  void ResolveImpl(flat_set<core::Identifier>&, Captures&,
-                   const core::Apply& x);
-  void ResolveImpl(flat_set<core::Identifier>&, Captures&,
-                   const core::Lambda& x);
-  void ResolveImpl(flat_set<core::Identifier>&, Captures&, const core::Let& x);
-  void ResolveImpl(flat_set<core::Identifier>&, Captures&,
-                   const core::LetRecursive& x);
-  void ResolveImpl(flat_set<core::Identifier>&, Captures&,
-                   const core::Case::Alternative& x);
-  void ResolveImpl(flat_set<core::Identifier>&, Captures&, const core::Case& x);
-  void Resolve(flat_set<core::Identifier>& bound, Captures&,
-               const core::Expression& x);
-  Captures Resolve(const core::Expression& x);
-
-  flat_set<core::Identifier> GetBindingsImpl(const core::Identifier&);
-  flat_set<core::Identifier> GetBindingsImpl(const core::MatchTuple&);
-  flat_set<core::Identifier> GetBindingsImpl(const core::MatchUnion&);
-  flat_set<core::Identifier> GetBindingsImpl(const core::Integer&);
-  flat_set<core::Identifier> GetBindingsImpl(const core::Character&);
-  flat_set<core::Identifier> GetBindings(const core::Pattern&);
+  // Runs `function` in a new frame, initialised with `values` (its captures
+  // and any arguments bound by a partial application) and then with
+  // `arguments`.
+  Value* Enter(const resolved::Function& function,
+               std::span<Lazy* const> values, std::span<Lazy* const> arguments);
+  // Pushes a new frame for `function`, initialised as for Enter.
+  void PushFrame(const resolved::Function& function,
+                 std::span<Lazy* const> values,
+                 std::span<Lazy* const> arguments);
+  // Evaluates `lazy` with the bytecode machine.
+  Value* Force(Lazy* lazy);
+  // Runs the bytecode machine until it returns a value, starting with `entry`
+  // in the current frame if it is not null and by forcing `lazy` otherwise.
+  Value* Execute(const bytecode::Code* entry, Lazy* lazy);
+  Lazy*& Local(int slot) { return locals[frame + slot]; }
+  std::span<Lazy* const> Frame() const {
+    return std::span<Lazy* const>(locals).subspan(frame);
+  }
 
+  Value* MakeBuiltin(core::Builtin x);
   Value* Evaluate(const core::Builtin& x);
-  Value* Evaluate(const core::Identifier& x);
+  Value* Evaluate(const resolved::Variable& x);
   Value* Evaluate(const core::Integer& x);
   Value* Evaluate(const core::Character& x);
-  Value* Evaluate(const core::Tuple& x);
+  Value* Evaluate(const resolved::Tuple& x);
   Value* Evaluate(const core::UnionConstructor& x);
-  Value* Evaluate(const core::Apply& x);
-  Value* Evaluate(const core::Lambda& x);
-  Value* Evaluate(const core::Let& x);
-  Value* Evaluate(const core::LetRecursive& x);
-  Value* Evaluate(const core::Case& x);
-  Value* Evaluate(const core::Expression& x);
+  Value* Evaluate(const resolved::Apply& x);
+  Value* Evaluate(const resolved::Call& x);
+  Value* Evaluate(const resolved::Loop& x);
+  Value* Evaluate(const resolved::Lambda& x);
+  Value* Evaluate(const resolved::Suspend& x);
+  Value* Evaluate(const resolved::Strict& x);
+  Value* Evaluate(const resolved::String& x);
+  Value* Evaluate(const resolved::Constant& x);
+  Value* Evaluate(const resolved::Let& x);
+  Value* Evaluate(const resolved::LetRecursive& x);
+  Value* Evaluate(const resolved::Case& x);
+  Value* Evaluate(const resolved::Expression& x);
 
   template <typename T>
   GCPtr<T> Wrap(T* x) { return GCPtr<T>(this, x); }
 
   Lazy* LazyEvaluate(const core::Builtin& x);
-  Lazy* LazyEvaluate(const core::Identifier& x);
+  Lazy* LazyEvaluate(const resolved::Variable& x);
   Lazy* LazyEvaluate(const core::Integer& x);
   Lazy* LazyEvaluate(const core::Character& x);
-  Lazy* LazyEvaluate(const core::Tuple& x);
+  Lazy* LazyEvaluate(const resolved::Tuple& x);
   Lazy* LazyEvaluate(const core::UnionConstructor& x);
-  Lazy* LazyEvaluate(const core::Apply& x);
-  Lazy* LazyEvaluate(const core::Lambda& x);
-  Lazy* LazyEvaluate(const core::Let& x);
-  Lazy* LazyEvaluate(const core::LetRecursive& x);
-  Lazy* LazyEvaluate(const core::Case& x);
-  Lazy* LazyEvaluate(const core::Expression& x);
-
-  Value* TryAlternative(Value*, const core::Case::Alternative& x);
-  Value* TryAlternative(Value*, const core::Identifier&,
-                        const core::Expression& x);
-  Value* TryAlternative(Value*, const core::MatchTuple&,
-                        const core::Expression& x);
-  Value* TryAlternative(Value*, const core::MatchUnion&,
-                        const core::Expression& x);
+  Lazy* LazyEvaluate(const resolved::Apply& x);
+  Lazy* LazyEvaluate(const resolved::Call& x);
+  Lazy* LazyEvaluate(const resolved::Loop& x);
+  Lazy* LazyEvaluate(const resolved::Lambda& x);
+  Lazy* LazyEvaluate(const resolved::Suspend& x);
+  Lazy* LazyEvaluate(const resolved::Strict& x);
+  Lazy* LazyEvaluate(const resolved::String& x);
+  Lazy* LazyEvaluate(const resolved::Constant& x);
+  Lazy* LazyEvaluate(const resolved::Let& x);
+  Lazy* LazyEvaluate(const resolved::LetRecursive& x);
+  Lazy* LazyEvaluate(const resolved::Case& x);
+  Lazy* LazyEvaluate(const resolved::Expression& x);
+
+  Value* TryAlternative(Value*, const resolved::Case::Alternative& x);
+  Value* TryAlternative(Value*, const resolved::Variable&,
+                        const resolved::Expression& x);
+  Value* TryAlternative(Value*, const resolved::MatchTuple&,
+                        const resolved::Expression& x);
+  Value* TryAlternative(Value*, const resolved::MatchUnion&,
+                        const resolved::Expression& x);
   Value* TryAlternative(Value*, const core::Integer&,
-                        const core::Expression& x);
+                        const resolved::Expression& x);
   Value* TryAlternative(Value*, const core::Character&,
-                        const core::Expression& x);
-
-  void Run(const core::Expression& program);
-
-  std::vector<std::unique_ptr<Node>> heap;
-  int collect_at_size = 128;
-  std::map<core::Identifier, std::vector<Lazy*>> names;
+                        const resolved::Expression& x);
+
+  void Run(const core::Expression& program, Backend backend);
+
+  Heap heap;
+  Input input;
+  Output output;
+  const void* stack_base = nullptr;
+  // The frames of every active function, innermost last.
+  std::vector<Lazy*> locals;
+  // The start of the innermost frame.
+  std::size_t frame = 0;
+  // The compiled program, indexed by function id. This is empty when running
+  // with the tree-walking backend.
+  std::vector<bytecode::Code> compiled;
+  std::vector<bytecode::Continuation> continuations;
   std::vector<Lazy*> stack;
-  GCPtrBase* live = nullptr;
+  // The slots referenced by every live GCPtr.
+  HandleStack handles;
+  // Shared values which are allocated once per interpreter: the builtins
+  // (indexed by core::Builtin), followed by the empty list.
+  std::vector<Value*> constants;
+  static constexpr int kNil = static_cast<int>(core::Builtin::kSubtract) + 1;
+  // The program's constant pool, indexed by resolved::Constant.
+  std::vector<Lazy*> pool;
 };
 
 template <std::derived_from<Node> T>
 GCPtr<T>::GCPtr(Interpreter* interpreter, T* value)
-    : interpreter_(interpreter), value_(value) {
-  if (interpreter_) interpreter_->AddPtr(this);
-}
-
-template <std::derived_from<Node> T>
-GCPtr<T>& GCPtr<T>::operator=(const GCPtr& other) {
-  if (interpreter_ != other.interpreter_) {
-    if (interpreter_) interpreter_->RemovePtr(this);
-    interpreter_ = other.interpreter_;
-    if (interpreter_) interpreter_->AddPtr(this);
-  }
-  value_ = other.value_;
-  return *this;
-}
-
-template <std::derived_from<Node> T>
-template <typename U>
-requires std::convertible_to<U*, T*>
-GCPtr<T>::GCPtr(GCPtr<U>&& other)
-    : interpreter_(other.interpreter_), value_(other.value_) {
-  if (interpreter_) {
-    next = other.next;
-    prev = other.prev;
-    other.next->prev = this;
-    other.prev->next = this;
-    other.interpreter_ = nullptr;
-  }
-}
+    : interpreter_(interpreter), slot_(interpreter->handles.Push(value)) {}
 
-template <std::derived_from<Node> T>
-GCPtr<T>& GCPtr<T>::operator=(GCPtr<T>&& other) {
-  if (interpreter_ != other.interpreter_) {
-    if (interpreter_) interpreter_->RemovePtr(this);
-    interpreter_ = other.interpreter_;
-    if (interpreter_) {
-      next = other.next;
-      prev = other.prev;
-      other.next->prev = this;
-      other.prev->next = this;
-      other.interpreter_ = nullptr;
-    }
-  }
-  value_ = other.value_;
-  return *this;
-}
+// Releases every GCPtr created while the scope is active.
+class HandleScope {
+ public:
+  explicit HandleScope(Interpreter& interpreter)
+      : handles_(interpreter.handles), mark_(handles_.GetMark()) {}
+  ~HandleScope() { handles_.Reset(mark_); }
+  HandleScope(const HandleScope&) = delete;
+  HandleScope& operator=(const HandleScope&) = delete;
 
-template <std::derived_from<Node> T>
-GCPtr<T>::~GCPtr() {
-  if (interpreter_) interpreter_->RemovePtr(this);
-}
+ private:
+  HandleStack& handles_;
+  HandleStack::Mark mark_;
+};
 
 const char* Name(Value::Type t) {
   switch (t) {
@@ -436,166 +3018,179 @@ const char* Name(Value::Type t) {
 }
 
 struct Int64 final : public Value {
-  Int64(std::int64_t value) : value(value) {}
-  Type GetType() const override { return Type::kInt64; }
-  void AddChildren(std::vector<Node*>& frontier) override {}
+  Int64(std::int64_t value) : Value(Type::kInt64), value(value) {}
+  void Trace(Heap&) override {}
   std::int64_t value;
 };
 
-struct Char final : public Value {
-  Char(char value) : value(value) {}
-  Type GetType() const override { return Type::kChar; }
-  void AddChildren(std::vector<Node*>& frontier) override {}
-  char value;
-};
+// The number of elements of a Tuple or Union is not stored, since it follows
+// from the size of the node.
+template <typename T>
+std::size_t NumElements(const T* node) {
+  return (node->size - sizeof(T)) / sizeof(Lazy*);
+}
 
 struct Tuple final : public Value {
-  Type GetType() const override { return Type::kTuple; }
-  void AddChildren(std::vector<Node*>& frontier) override {
-    frontier.insert(frontier.end(), elements.begin(), elements.end());
+  // The size of a node is only set once it has been constructed.
+  Tuple(std::span<Lazy* const> elements) : Value(Type::kTuple) {
+    std::ranges::copy(elements,
+                      TrailingElements<Lazy*>(this, elements.size()).begin());
+  }
+  static std::size_t ExtraSize(std::span<Lazy* const> elements) {
+    return elements.size() * sizeof(Lazy*);
+  }
+  void Trace(Heap& heap) override {
+    for (Lazy*& element : elements()) heap.Update(element);
+  }
+  std::span<Lazy*> elements() {
+    return TrailingElements<Lazy*>(this, NumElements(this));
+  }
+  std::span<Lazy* const> elements() const {
+    return TrailingElements<Lazy* const>(this, NumElements(this));
   }
-  std::vector<Lazy*> elements;
 };
 
+static_assert(sizeof(Tuple) == sizeof(Node));
+
 struct Union final : public Value {
   Union(core::UnionType::Id type_id, int index,
         std::span<Lazy* const> elements = {})
-      : type_id(type_id),
+      : Value(Type::kUnion),
         index(index),
-        elements(elements.begin(), elements.end()) {}
-  Type GetType() const override { return Type::kUnion; }
-  void AddChildren(std::vector<Node*>& frontier) override {
-    frontier.insert(frontier.end(), elements.begin(), elements.end());
+        type_id(static_cast<std::uint8_t>(type_id)) {
+    std::ranges::copy(elements,
+                      TrailingElements<Lazy*>(this, elements.size()).begin());
   }
-  core::UnionType::Id type_id;
-  int index;
-  std::vector<Lazy*> elements;
-};
-
-struct Closure : public Thunk {
-  Closure(Interpreter::Captures captures) : captures(std::move(captures)) {}
-  void AddChildren(std::vector<Node*>& frontier) override {
-    for (const auto& [id, value] : captures) frontier.push_back(value);
+  static std::size_t ExtraSize(core::UnionType::Id, int,
+                               std::span<Lazy* const> elements = {}) {
+    return elements.size() * sizeof(Lazy*);
   }
-  virtual Value* RunBody(Interpreter&) = 0;
-  Value* Run(Interpreter& interpreter) final {
-    for (const auto& [id, value] : captures) {
-      interpreter.names[id].push_back(value);
-    }
-    Value* result = RunBody(interpreter);
-    for (const auto& [id, value] : captures) {
-      interpreter.names[id].pop_back();
-    }
-    return result;
+  void Trace(Heap& heap) override {
+    for (Lazy*& element : elements()) heap.Update(element);
   }
-  Interpreter::Captures captures;
+  std::span<Lazy*> elements() {
+    return TrailingElements<Lazy*>(this, NumElements(this));
+  }
+  std::span<Lazy* const> elements() const {
+    return TrailingElements<Lazy* const>(this, NumElements(this));
+  }
+  core::UnionType::Id GetTypeId() const {
+    return static_cast<core::UnionType::Id>(type_id);
+  }
+  const std::uint8_t index;
+  const std::uint8_t type_id;
 };
 
-struct Let final : public Closure {
-  Let(Interpreter& interpreter, const core::Let& definition)
-      : Closure(interpreter.Resolve(definition)),
-        definition(definition) {}
-  Value* RunBody(Interpreter& interpreter) override {
-    interpreter.names[definition.binding.variable].push_back(
-        interpreter.LazyEvaluate(definition.binding.value));
-    Value* result = interpreter.Evaluate(definition.value);
-    interpreter.names[definition.binding.variable].pop_back();
-    return result;
+static_assert(sizeof(Union) == sizeof(Node));
+
+// Copies the captures of `function` out of `frame`, the frame in which a
+// closure for it is being created, and into `captures`.
+void CaptureInto(std::span<Lazy*> captures, const resolved::Function& function,
+                 std::span<Lazy* const> frame) {
+  for (int i = 0, n = captures.size(); i < n; i++) {
+    captures[i] = frame[function.captures[i]];
+  }
+}
+
+// A suspended let or case expression, along with the values it captures.
+struct Suspension final : public Thunk {
+  Suspension(const resolved::Function& function, std::span<Lazy* const> frame)
+      : Thunk(Type::kSuspension),
+        function(function),
+        num_captures(function.captures.size()) {
+    CaptureInto(captures(), function, frame);
   }
-  const core::Let& definition;
+  static std::size_t ExtraSize(const resolved::Function& function,
+                               std::span<Lazy* const>) {
+    return function.captures.size() * sizeof(Lazy*);
+  }
+  void Trace(Heap& heap) override {
+    for (Lazy*& value : captures()) heap.Update(value);
+  }
+  Value* Run(Interpreter& interpreter) override {
+    return interpreter.Enter(function, captures(), {});
+  }
+  std::span<Lazy*> captures() {
+    return TrailingElements<Lazy*>(this, num_captures);
+  }
+  const resolved::Function& function;
+  int num_captures;
 };
 
 struct Error final : public Thunk {
-  Error(std::string message) : message(std::move(message)) {}
-  void AddChildren(std::vector<Node*>&) override {}
+  Error(const char* message) : message(message) {}
+  void Trace(Heap&) override {}
   Value* Run(Interpreter&) override {
     throw std::runtime_error(message);
   }
-  std::string message;
+  const char* message;
 };
 
-struct LetRecursive final : public Closure {
-  LetRecursive(Interpreter& interpreter, const core::LetRecursive& definition)
-      : Closure(interpreter.Resolve(definition)), definition(definition) {}
-  Value* RunBody(Interpreter& interpreter) override {
-    std::vector<Lazy*> holes;
-    for (const auto& [id, value] : definition.bindings) {
-      Lazy* l = interpreter.Allocate<Lazy>(
-          interpreter.Allocate<Error>("this should never be executed"));
-      interpreter.names[id].push_back(l);
-      holes.push_back(l);
-    }
-    for (int i = 0, n = definition.bindings.size(); i < n; i++) {
-      // There are two possible cases for the return value here.
-      //
-      //   * The return value is the value itself, which is currently just
-      //     a hole. In this case, the expression has no weak head normal form:
-      //     it diverges, so we replace it with an error.
-      //   * The return value is *not* the value itself. In this case, we will
-      //     overwrite the hole with the thunk for the actual value. This may
-      //     refer to the value itself internally, at which point it will
-      //     evaluate as the newly-assigned value.
-      Lazy* value = interpreter.LazyEvaluate(definition.bindings[i].value);
-      if (holes[i] == value) {
-        *holes[i] = Lazy(interpreter.Allocate<Error>("divergence"));
-      } else {
-        *holes[i] = *value;
-      }
-    }
-    Value* result = interpreter.Evaluate(definition.value);
-    for (const auto& [id, value] : definition.bindings) {
-      interpreter.names[id].pop_back();
-    }
-    return result;
-  }
-  const core::LetRecursive& definition;
+struct Lambda : public Value {
+  Lambda(const resolved::Function* function)
+      : Value(Type::kLambda), function(function) {}
+  // Applies the lambda to the argument on the top of the stack, replacing it
+  // with the result.
+  virtual void Enter(Interpreter& interpreter) = 0;
+  // The body of a UserLambda, or null for a NativeLambda.
+  const resolved::Function* function;
 };
 
-struct Case final : public Closure {
-  Case(Interpreter& interpreter, const core::Case& definition)
-      : Closure(interpreter.Resolve(definition)), definition(definition) {}
-  Value* RunBody(Interpreter& interpreter) override {
-    GCPtr<Value> v(&interpreter, interpreter.Evaluate(definition.value));
-    for (const auto& alternative : definition.alternatives) {
-      if (Value* r = interpreter.TryAlternative(v, alternative)) return r;
-    }
-    throw std::runtime_error(StrCat("non-exhaustative case: nothing to match ",
-                                    Name(v->GetType()),
-                                    ". core: ", definition));
-  }
-  const core::Case& definition;
-};
+// A lambda implemented by a native function. The bytecode machine applies
+// these in two steps so that it can evaluate any strict arguments itself
+// before the native code runs.
+struct NativeLambda : public Lambda {
+  struct Arguments {
+    int count;
+    // The number of leading arguments which the function always evaluates.
+    int strict;
+  };
 
-struct Lambda : public Value {
-  Type GetType() const final { return Type::kLambda; };
-  virtual void Enter(Interpreter& interpreter) = 0;
+  NativeLambda() : Lambda(nullptr) {}
+  // Takes the argument on the top of the stack. If the function is then
+  // saturated, inserts the arguments bound by any earlier partial application
+  // beneath it and returns where they are. Otherwise, replaces the argument
+  // with a new partial application.
+  virtual std::optional<Arguments> Prepare(Interpreter& interpreter) = 0;
+  // Pops the prepared arguments and returns the result of the function.
+  virtual Value* Invoke(Interpreter& interpreter) = 0;
+  // The number of leading arguments which a saturated call evaluates.
+  virtual int NumStrict() const = 0;
 };
 
 struct NativeFunctionBase {
-  NativeFunctionBase(int arity) : arity(arity) {}
-  virtual void Enter(Interpreter& interpreter) = 0;
+  NativeFunctionBase(int arity, int strict) : arity(arity), strict(strict) {}
+  // Replaces the arguments on the top of the stack with the result.
+  void Enter(Interpreter& interpreter) {
+    Value* v = Invoke(interpreter);
+    interpreter.stack.push_back(interpreter.Evaluated(v));
+  }
+  virtual Value* Invoke(Interpreter& interpreter) = 0;
   const int arity;
+  const int strict;
 };
 
 struct UnionConstructor final : public NativeFunctionBase {
   UnionConstructor(const core::UnionConstructor& x)
-      : NativeFunctionBase(x.type->alternatives.at(x.index).num_members),
+      : NativeFunctionBase(x.type->alternatives.at(x.index).num_members, 0),
         type_id(x.type->id),
         index(x.index) {}
-  void Enter(Interpreter& interpreter) override {
-    Lazy* value = interpreter.Allocate<Lazy>(interpreter.Allocate<Union>(
-        type_id, index, std::span<Lazy*>(interpreter.stack).last(arity)));
-    interpreter.stack.resize(interpreter.stack.size() - arity + 1);
-    interpreter.stack.back() = value;
+  Value* Invoke(Interpreter& interpreter) override {
+    Value* value = interpreter.Allocate<Union>(
+        type_id, index, std::span<Lazy*>(interpreter.stack).last(arity));
+    interpreter.stack.resize(interpreter.stack.size() - arity);
+    return value;
   }
   core::UnionType::Id type_id;
   int index;
 };
 
-template <int n>
+// A native function of `n` arguments which evaluates the first `num_strict` of
+// them.
+template <int n, int num_strict = n>
 struct NativeFunction : public NativeFunctionBase {
-  NativeFunction() : NativeFunctionBase(n) {}
-  void Enter(Interpreter& interpreter) final {
+  NativeFunction() : NativeFunctionBase(n, num_strict) {}
+  Value* Invoke(Interpreter& interpreter) final {
     if (interpreter.stack.size() < n) {
       throw std::logic_error("invoking native function with too few arguments");
     }
@@ -603,8 +3198,8 @@ struct NativeFunction : public NativeFunctionBase {
     const int m = interpreter.stack.size();
     for (int i = 0; i < n; i++) args[i] = interpreter.stack[m - n + i];
     Value* v = Run(interpreter, args);
-    interpreter.stack.resize(interpreter.stack.size() - n + 1);
-    interpreter.stack.back() = interpreter.Allocate<Lazy>(interpreter.Wrap(v));
+    interpreter.stack.resize(interpreter.stack.size() - n);
+    return v;
   }
   virtual Value* Run(Interpreter& interpreter,
                      std::span<Lazy* const, n> args) = 0;
@@ -613,16 +3208,16 @@ struct NativeFunction : public NativeFunctionBase {
 struct Not : public NativeFunction<1> {
   Value* Run(Interpreter& interpreter,
              std::span<Lazy* const, 1> args) override {
-    return interpreter.Bool(!args[0]->Get(interpreter)->AsBool());
+    return interpreter.Bool(!AsBool(Get(interpreter, args[0])));
   }
 };
 
 struct Chr : public NativeFunction<1> {
   Value* Run(Interpreter& interpreter,
              std::span<Lazy* const, 1> args) override {
-    const std::int64_t i = args[0]->Get(interpreter)->AsInt64();
+    const std::int64_t i = AsInt64(Get(interpreter, args[0]));
     if (0 <= i && i < 128) {
-      return interpreter.Allocate<Char>(static_cast<char>(i));
+      return interpreter.Character(static_cast<char>(i));
     } else {
       throw std::runtime_error(StrCat("Value ", i, " is out of range for chr"));
     }
@@ -632,77 +3227,82 @@ struct Chr : public NativeFunction<1> {
 struct Ord : public NativeFunction<1> {
   Value* Run(Interpreter& interpreter,
              std::span<Lazy* const, 1> args) override {
-    const char c = args[0]->Get(interpreter)->AsChar();
-    return interpreter.Allocate<Int64>(static_cast<std::int64_t>(c));
+    const char c = AsChar(Get(interpreter, args[0]));
+    return interpreter.Integer(static_cast<std::int64_t>(c));
   }
 };
 
-template <auto F>
-struct BinaryOperatorInt64 : public NativeFunction<2> {
+// The closure for an operator, for when it is not called directly.
+template <core::Builtin op>
+struct BinaryOperator : public NativeFunction<2> {
   Value* Run(Interpreter& interpreter,
              std::span<Lazy* const, 2> args) override {
-    const std::int64_t l = args[0]->Get(interpreter)->AsInt64();
-    const std::int64_t r = args[1]->Get(interpreter)->AsInt64();
-    return interpreter.Allocate<Int64>(F(l, r));
-  }
-};
-
-using Add = BinaryOperatorInt64<[](auto l, auto r) { return l + r; }>;
-using Subtract = BinaryOperatorInt64<[](auto l, auto r) { return l - r; }>;
-using Multiply = BinaryOperatorInt64<[](auto l, auto r) { return l * r; }>;
-using Divide = BinaryOperatorInt64<[](auto l, auto r) { return l / r; }>;
-using Modulo = BinaryOperatorInt64<[](auto l, auto r) { return l % r; }>;
-using BitwiseAnd = BinaryOperatorInt64<[](auto l, auto r) { return l & r; }>;
-using BitwiseOr = BinaryOperatorInt64<[](auto l, auto r) { return l | r; }>;
-using BitShift = BinaryOperatorInt64<[](auto l, auto r) {
-  // These brackets look redundant, but the compiler cannot parse this without
-  // them, presumably because it is inside <> brackets for the template.
-  return (r > 0 ? l << r : l >> -r);
-}>;
-
-struct And : public NativeFunction<2> {
+    Value* l = Get(interpreter, args[0]);
+    Value* r = Get(interpreter, args[1]);
+    return interpreter.ApplyOperator(op, l, r);
+  }
+};
+
+using Add = BinaryOperator<core::Builtin::kAdd>;
+using Subtract = BinaryOperator<core::Builtin::kSubtract>;
+using Multiply = BinaryOperator<core::Builtin::kMultiply>;
+using Divide = BinaryOperator<core::Builtin::kDivide>;
+using Modulo = BinaryOperator<core::Builtin::kModulo>;
+using BitwiseAnd = BinaryOperator<core::Builtin::kBitwiseAnd>;
+using BitwiseOr = BinaryOperator<core::Builtin::kBitwiseOr>;
+using BitShift = BinaryOperator<core::Builtin::kBitShift>;
+using LessThan = BinaryOperator<core::Builtin::kLessThan>;
+
+struct And : public NativeFunction<2, 1> {
   Value* Run(Interpreter& interpreter,
              std::span<Lazy* const, 2> args) override {
-    Value* l = args[0]->Get(interpreter);
-    if (!l->AsBool()) return l;
-    return args[1]->Get(interpreter);
+    Value* l = Get(interpreter, args[0]);
+    if (!AsBool(l)) return l;
+    return Get(interpreter, args[1]);
   }
 };
 
-struct Or : public NativeFunction<2> {
+struct Or : public NativeFunction<2, 1> {
   Value* Run(Interpreter& interpreter,
              std::span<Lazy* const, 2> args) override {
-    Value* l = args[0]->Get(interpreter);
-    if (l->AsBool()) return l;
-    return args[1]->Get(interpreter);
+    Value* l = Get(interpreter, args[0]);
+    if (AsBool(l)) return l;
+    return Get(interpreter, args[1]);
   }
 };
 
 struct Equal : public NativeFunction<2> {
+  // Compares two values, pushing pairs of elements which must also be equal
+  // onto the stack.
   bool Run(Interpreter& interpreter, Lazy* lazy_l, Lazy* lazy_r) {
-    Value* l = lazy_l->Get(interpreter);
-    Value* r = lazy_r->Get(interpreter);
-    if (l->GetType() == r->GetType()) {
-      switch (l->GetType()) {
+    // Packed strings are compared without unpacking them.
+    if (std::optional<std::string_view> text_l =
+            interpreter.PendingString(lazy_l)) {
+      if (std::optional<std::string_view> text_r =
+              interpreter.PendingString(lazy_r)) {
+        return *text_l == *text_r;
+      }
+    }
+    Value* l = Get(interpreter, lazy_l);
+    Value* r = Get(interpreter, lazy_r);
+    if (TypeOf(l) == TypeOf(r)) {
+      switch (TypeOf(l)) {
         case Value::Type::kChar:
-          return l->AsChar() == r->AsChar();
+          return AsChar(l) == AsChar(r);
         case Value::Type::kInt64:
-          return l->AsInt64() == r->AsInt64();
+          return AsInt64(l) == AsInt64(r);
         case Value::Type::kTuple: {
-          const std::span<Lazy* const> elements_l = l->AsTuple();
-          const std::span<Lazy* const> elements_r = r->AsTuple();
+          const std::span<Lazy* const> elements_l = AsTuple(l);
+          const std::span<Lazy* const> elements_r = AsTuple(r);
           if (elements_l.size() != elements_r.size()) {
             throw std::runtime_error("tuple size mismatch in (==)");
           }
-          const int n = elements_l.size();
-          for (int i = 0; i < n; i++) {
-            if (!Run(interpreter, elements_l[i], elements_r[i])) return false;
-          }
+          Push(interpreter, elements_l, elements_r);
           return true;
         }
         case Value::Type::kUnion: {
-          const Union& union_l = l->AsUnion();
-          const Union& union_r = r->AsUnion();
+          const UnionView union_l = AsUnion(l);
+          const UnionView union_r = AsUnion(r);
           if (union_l.type_id != union_r.type_id) {
             throw std::runtime_error(
                 StrCat("unsupported (==) comparison between ", union_l.type_id,
@@ -715,61 +3315,77 @@ struct Equal : public NativeFunction<2> {
                 ", constructor ", union_l.index, ": ", union_l.elements.size(),
                 " vs ", union_r.elements.size()));
           }
-          for (int i = 0, n = union_l.elements.size(); i < n; i++) {
-            if (!Run(interpreter, union_l.elements[i], union_r.elements[i])) {
-              return false;
-            }
-          }
+          Push(interpreter, union_l.elements, union_r.elements);
           return true;
         }
         default:
           throw std::runtime_error(
-              StrCat("unsupported (==) comparison for ", Name(l->GetType())));
+              StrCat("unsupported (==) comparison for ", Name(TypeOf(l))));
       }
     } else {
       throw std::runtime_error(StrCat("unsupported (==) comparison between ",
-                                      Name(l->GetType()), " and ",
-                                      Name(r->GetType())));
+                                      Name(TypeOf(l)), " and ",
+                                      Name(TypeOf(r))));
     }
   }
-  Value* Run(Interpreter& interpreter,
-             std::span<Lazy* const, 2> args) override {
-    return interpreter.Bool(Run(interpreter, args[0], args[1]));
+  // Pushes the pairs in reverse so that they are compared from left to right.
+  void Push(Interpreter& interpreter, std::span<Lazy* const> l,
+            std::span<Lazy* const> r) {
+    for (int i = l.size() - 1; i >= 0; i--) {
+      interpreter.stack.push_back(l[i]);
+      interpreter.stack.push_back(r[i]);
+    }
   }
-};
-
-struct LessThan : public NativeFunction<2> {
   Value* Run(Interpreter& interpreter,
              std::span<Lazy* const, 2> args) override {
-    Value* l = args[0]->Get(interpreter);
-    Value* r = args[1]->Get(interpreter);
-    if (l->GetType() != r->GetType()) {
-      throw std::runtime_error(StrCat("unsupported (<) comparison between ",
-                                      Name(l->GetType()), " and ",
-                                      Name(r->GetType())));
-    }
-    switch (l->GetType()) {
-      case Value::Type::kChar:
-        return interpreter.Bool(l->AsChar() < r->AsChar());
-      case Value::Type::kInt64:
-        return interpreter.Bool(l->AsInt64() < r->AsInt64());
-      default:
-        throw std::runtime_error(
-            StrCat("unsupported (<) comparison for ", Name(l->GetType())));
+    // Structures are compared iteratively so that long lists do not recurse.
+    // The pending pairs live on the stack, where the collector can see them.
+    const std::size_t base = interpreter.stack.size();
+    interpreter.stack.push_back(args[0]);
+    interpreter.stack.push_back(args[1]);
+    while (interpreter.stack.size() > base) {
+      Lazy* r = interpreter.stack.back();
+      interpreter.stack.pop_back();
+      Lazy* l = interpreter.stack.back();
+      interpreter.stack.pop_back();
+      if (!Run(interpreter, l, r)) {
+        interpreter.stack.resize(base);
+        return interpreter.Bool(false);
+      }
     }
+    return interpreter.Bool(true);
+  }
+};
+
+// A string literal, which is unpacked into cons cells one character at a time
+// as it is forced. The text belongs to the program, so it outlives the heap.
+struct Text final : public Thunk {
+  explicit Text(const std::string& text, std::size_t offset = 0)
+      : Thunk(Type::kText), text(&text), offset(offset) {}
+  void Trace(Heap&) override {}
+  Value* Run(Interpreter& interpreter) override {
+    if (offset == text->size()) return interpreter.Nil();
+    return interpreter.Cons(
+        interpreter.Evaluated(interpreter.Character((*text)[offset])),
+        interpreter.Allocate<Text>(*text, offset + 1));
+  }
+  // The characters which have not been unpacked yet.
+  std::string_view rest() const {
+    return std::string_view(*text).substr(offset);
   }
+  const std::string* text;
+  std::size_t offset;
 };
 
 struct ShowInt : public NativeFunction<1> {
   Value* Run(Interpreter& interpreter,
              std::span<Lazy* const, 1> args) override {
-    const std::int64_t value = args[0]->Get(interpreter)->AsInt64();
-    std::string text = std::to_string(value);
-    GCPtr<Value> result(&interpreter, interpreter.Nil());
+    const std::string text = std::to_string(AsInt64(Get(interpreter, args[0])));
+    Value* result = interpreter.Nil();
     for (int i = text.size() - 1; i >= 0; i--) {
       result = interpreter.Cons(
-          interpreter.Allocate<Lazy>(interpreter.Allocate<Char>(text[i])),
-          interpreter.Allocate<Lazy>(result));
+          interpreter.Evaluated(interpreter.Character(text[i])),
+          interpreter.Evaluated(result));
     }
     return result;
   }
@@ -785,71 +3401,130 @@ struct ReadInt : public NativeFunction<1> {
     if (error != std::errc()) {
       throw std::runtime_error("bad int in string: " + text);
     }
-    return interpreter.Allocate<Int64>(value);
+    return interpreter.Integer(value);
   }
 };
 
 template <typename F>
-struct NativeClosure : public Lambda {
-  NativeClosure(F f = F(), std::vector<Lazy*> b = {})
-      : f(std::move(f)), bound(std::move(b)) {
-    if ((int)bound.size() >= f.arity) {
+struct NativeClosure : public NativeLambda {
+  NativeClosure(F f = F()) : f(std::move(f)), num_bound(0) {}
+  // Partially applies `partial` to one more argument.
+  NativeClosure(const NativeClosure& partial, Lazy* argument)
+      : f(partial.f), num_bound(partial.num_bound + 1) {
+    if (num_bound >= f.arity) {
       throw std::logic_error("creating (over)saturated native closure");
     }
+    std::ranges::copy(partial.bound(), bound().begin());
+    bound().back() = argument;
   }
-  void AddChildren(std::vector<Node*>& frontier) override {
-    frontier.insert(frontier.end(), bound.begin(), bound.end());
+  static std::size_t ExtraSize(const NativeClosure& partial, Lazy*) {
+    return (partial.num_bound + 1) * sizeof(Lazy*);
+  }
+  void Trace(Heap& heap) override {
+    for (Lazy*& argument : bound()) heap.Update(argument);
   }
   void Enter(Interpreter& interpreter) override {
-    const int required = f.arity - bound.size();
+    HandleScope scope(interpreter);
+    if (Prepare(interpreter)) f.Enter(interpreter);
+  }
+  std::optional<Arguments> Prepare(Interpreter& interpreter) override {
+    const int required = f.arity - num_bound;
     if (required > 1) {
-      std::vector<Lazy*> newly_bound = bound;
-      newly_bound.push_back(interpreter.stack.back());
-      interpreter.stack.back() = interpreter.Allocate<Lazy>(
-          interpreter.Allocate<NativeClosure<F>>(f, std::move(newly_bound)));
+      interpreter.stack.back() = interpreter.Allocate<NativeClosure<F>>(
+          *this, interpreter.stack.back());
+      return std::nullopt;
     } else {
-      interpreter.stack.insert(interpreter.stack.end() - 1, bound.begin(),
-                               bound.end());
-      f.Enter(interpreter);
+      interpreter.stack.insert(interpreter.stack.end() - 1, bound().begin(),
+                               bound().end());
+      return Arguments{.count = f.arity, .strict = f.strict};
     }
   }
+  Value* Invoke(Interpreter& interpreter) override {
+    return f.Invoke(interpreter);
+  }
+  int NumStrict() const override { return f.strict; }
+  std::span<Lazy*> bound() {
+    return TrailingElements<Lazy*>(this, num_bound);
+  }
+  std::span<Lazy* const> bound() const {
+    return TrailingElements<Lazy* const>(this, num_bound);
+  }
   F f;
-  std::vector<Lazy*> bound;
+  int num_bound;
 };
 
+// A closure for a lambda of one or more parameters. Applying it to fewer
+// arguments than that builds a partial application, which holds the arguments
+// so far after the captures, and the last argument enters the body.
 struct UserLambda final : public Lambda {
-  UserLambda(Interpreter& interpreter, const core::Lambda& definition)
-      : definition(definition), captures(interpreter.Resolve(definition)) {}
-  void Enter(Interpreter& interpreter) override {
-    for (const auto& [id, value] : captures) {
-      interpreter.names[id].push_back(value);
+  UserLambda(const resolved::Function& function, std::span<Lazy* const> frame)
+      : Lambda(&function), num_captures(function.captures.size()) {
+    CaptureInto(values(), function, frame);
+  }
+  static std::size_t ExtraSize(const resolved::Function& function,
+                               std::span<Lazy* const>) {
+    return function.captures.size() * sizeof(Lazy*);
+  }
+  // Partially applies `partial` to one more argument.
+  UserLambda(const UserLambda& partial, Lazy* argument)
+      : Lambda(partial.function),
+        num_captures(partial.num_captures),
+        num_bound(partial.num_bound + 1) {
+    if (num_bound >= function->num_parameters) {
+      throw std::logic_error("creating (over)saturated closure");
     }
-    Lazy* v = interpreter.stack.back();
-    interpreter.names[definition.parameter].push_back(v);
-    interpreter.stack.back() = interpreter.Allocate<Lazy>(
-        interpreter.Wrap(interpreter.Evaluate(definition.result)));
-    interpreter.names[definition.parameter].pop_back();
-    for (const auto& [id, value] : captures) {
-      interpreter.names[id].pop_back();
+    std::ranges::copy(partial.values(), values().begin());
+    values().back() = argument;
+  }
+  static std::size_t ExtraSize(const UserLambda& partial, Lazy*) {
+    return (partial.num_captures + partial.num_bound + 1) * sizeof(Lazy*);
+  }
+  void Enter(Interpreter& interpreter) override {
+    HandleScope scope(interpreter);
+    if (num_bound + 1 < function->num_parameters) {
+      interpreter.stack.back() =
+          interpreter.Allocate<UserLambda>(*this, interpreter.stack.back());
+    } else {
+      interpreter.stack.back() = interpreter.Evaluated(interpreter.Enter(
+          *function, values(), std::span<Lazy*>(interpreter.stack).last(1)));
     }
   }
-  void AddChildren(std::vector<Node*>& frontier) override {
-    for (const auto& [id, value] : captures) frontier.push_back(value);
+  void Trace(Heap& heap) override {
+    for (Lazy*& value : values()) heap.Update(value);
   }
-  const core::Lambda& definition;
-  Interpreter::Captures captures;
+  // The captures followed by the bound arguments.
+  std::span<Lazy*> values() {
+    return TrailingElements<Lazy*>(this, num_captures + num_bound);
+  }
+  std::span<Lazy* const> values() const {
+    return TrailingElements<Lazy* const>(this, num_captures + num_bound);
+  }
+  int num_captures;
+  int num_bound = 0;
 };
 
+// The closure entered by a call to a variable which is known to hold a lambda
+// of `arity` parameters.
+UserLambda* AsKnownLambda(Value* value, int arity) {
+  Lambda* f = AsLambda(value);
+  auto* lambda = static_cast<UserLambda*>(f);
+  if (!f->function || lambda->num_bound != 0 ||
+      f->function->num_parameters != arity) {
+    throw std::logic_error("known call to a lambda of a different arity");
+  }
+  return lambda;
+}
+
 struct Apply final : public Thunk {
-  Apply(Lazy* f, Lazy* x) : f(f), x(x) {}
-  void AddChildren(std::vector<Node*>& frontier) override {
-    frontier.push_back(f);
-    frontier.push_back(x);
+  Apply(Lazy* f, Lazy* x) : Thunk(Type::kApply), f(f), x(x) {}
+  void Trace(Heap& heap) override {
+    heap.Update(f);
+    heap.Update(x);
   }
   Value* Run(Interpreter& interpreter) override {
     interpreter.stack.push_back(x);
-    f->Get(interpreter)->Enter(interpreter);
-    Value* v = interpreter.stack.back()->Get(interpreter);
+    AsLambda(Get(interpreter, f))->Enter(interpreter);
+    Value* v = Get(interpreter, interpreter.stack.back());
     interpreter.stack.pop_back();
     return v;
   }
@@ -857,51 +3532,53 @@ struct Apply final : public Thunk {
   Lazy* x;
 };
 
+// The program's input from `offset` onwards, which is unpacked into cons cells
+// one character at a time as it is forced.
 struct Read final : public Thunk {
-  void AddChildren(std::vector<Node*>&) override {}
+  explicit Read(std::size_t offset) : Thunk(Type::kRead), offset(offset) {}
+  void Trace(Heap&) override {}
   Value* Run(Interpreter& interpreter) override {
-    char c;
-    if (std::cin.get(c)) {
-      return interpreter.Cons(
-          interpreter.Allocate<Lazy>(interpreter.Allocate<Char>(c)),
-          interpreter.Allocate<Lazy>(this));
-    } else {
-      return interpreter.Nil();
-    }
+    if (!interpreter.input.Has(offset)) return interpreter.Nil();
+    const char c = interpreter.input[offset];
+    return interpreter.Cons(interpreter.Evaluated(interpreter.Character(c)),
+                            interpreter.Allocate<Read>(offset + 1));
   }
+  std::size_t offset;
 };
 
 struct ConcatThunk final : public Thunk {
-  ConcatThunk(Lazy* l, Lazy* r) : l(l), r(r) {}
+  ConcatThunk(Lazy* l, Lazy* r) : Thunk(Type::kConcat), l(l), r(r) {}
   Value* Run(Interpreter& interpreter) override {
-    GCPtr<Value> v(&interpreter, l->Get(interpreter));
-    if (v->GetType() != Value::Type::kUnion) {
+    GCPtr<Value> v(&interpreter, Get(interpreter, l));
+    if (TypeOf(v) != Value::Type::kUnion) {
       throw std::runtime_error(StrCat("malformed string: tail is ",
-                                      Name(v->GetType()), ", not list"));
+                                      Name(TypeOf(v)), ", not list"));
     }
-    const Union& u = v->AsUnion();
+    const UnionView u = AsUnion(v);
     if (u.type_id != core::UnionType::Id::kList) {
       throw std::runtime_error(
           StrCat("malformed string: tail is ", u.type_id, ", not list"));
     }
     if (u.index == 0) {
-      l = u.elements[1];
-      return interpreter.Cons(u.elements[0], interpreter.Allocate<Lazy>(this));
+      Lazy* head = u.elements[0];
+      Lazy* tail = u.elements[1];
+      return interpreter.Cons(head,
+                              interpreter.Allocate<ConcatThunk>(tail, r));
     } else if (u.index == 1) {
-      return r->Get(interpreter);
+      return Get(interpreter, r);
     } else {
       throw std::runtime_error("concat argument is not a list");
     }
   }
-  void AddChildren(std::vector<Node*>& frontier) override {
-    frontier.push_back(l);
-    frontier.push_back(r);
+  void Trace(Heap& heap) override {
+    heap.Update(l);
+    heap.Update(r);
   }
   Lazy* l;
   Lazy* r;
 };
 
-struct Concat : public NativeFunction<2> {
+struct Concat : public NativeFunction<2, 1> {
   Value* Run(Interpreter& interpreter,
              std::span<Lazy* const, 2> args) override {
     return interpreter.Allocate<ConcatThunk>(args[0], args[1])
@@ -909,89 +3586,199 @@ struct Concat : public NativeFunction<2> {
   }
 };
 
-struct MakeError : public NativeFunction<1> {
+struct MakeError : public NativeFunction<1, 0> {
   Value* Run(Interpreter& interpreter,
              std::span<Lazy* const, 1> args) override {
     throw std::runtime_error("error: " + interpreter.EvaluateString(args[0]));
   }
 };
 
-void Lazy::AddChildren(std::vector<Node*>& frontier) {
-  if (has_value_) {
-    frontier.push_back(value_);
-  } else {
-    frontier.push_back(thunk_);
+Value* Get(Interpreter& interpreter, Lazy* lazy) {
+  if (Value* value = TryGet(lazy)) return value;
+  // The bytecode machine evaluates thunks without native recursion.
+  if (!interpreter.compiled.empty()) return interpreter.Force(lazy);
+  HandleScope scope(interpreter);
+  Thunk* thunk = static_cast<Thunk*>(Follow(lazy));
+  thunk->Claim();
+  Value* value = thunk->Run(interpreter);
+  thunk->Update(interpreter, value);
+  return value;
+}
+
+void Thunk::Claim() {
+  // Evaluation of the thunk relies on evaluating itself: the expression
+  // diverges without reaching weak head normal form.
+  if (computing) throw std::runtime_error("divergence");
+  computing = true;
+}
+
+void Thunk::Update(Interpreter& interpreter, Value* value) {
+  interpreter.heap.WriteBarrier(Become<Indirection>(this, value));
+}
+
+Value::Type TypeOf(const Value* value) {
+  if (!IsImmediate(value)) return value->GetType();
+  switch (KindOf(value)) {
+    case Immediate::kInt64:
+      return Value::Type::kInt64;
+    case Immediate::kChar:
+      return Value::Type::kChar;
+    case Immediate::kBool:
+      return Value::Type::kUnion;
   }
+  std::abort();
+}
+
+// The type checker guarantees that every value has the type that its use
+// expects, so these conversions only check it in debug builds.
+bool AsBool(const Value* value) {
+  assert(IsImmediate(value) && KindOf(value) == Immediate::kBool);
+  return PayloadOf(value);
 }
 
-bool Value::AsBool() const {
-  if (GetType() != Type::kUnion ||
-      AsUnion().type_id != core::UnionType::Id::kBool) {
-    throw std::runtime_error("not a bool");
+std::int64_t AsInt64(const Value* value) {
+  if (IsImmediate(value) && KindOf(value) == Immediate::kInt64) {
+    return PayloadOf(value);
   }
-  return AsUnion().index;
+  assert(TypeOf(value) == Value::Type::kInt64);
+  return static_cast<const Int64*>(value)->value;
 }
 
-std::int64_t Value::AsInt64() const {
-  if (GetType() != Type::kInt64) throw std::runtime_error("not an int64");
-  return static_cast<const Int64*>(this)->value;
+char AsChar(const Value* value) {
+  assert(IsImmediate(value) && KindOf(value) == Immediate::kChar);
+  return static_cast<char>(PayloadOf(value));
 }
 
-char Value::AsChar() const {
-  if (GetType() != Type::kChar) throw std::runtime_error("not a char");
-  return static_cast<const Char*>(this)->value;
+std::span<Lazy* const> AsTuple(const Value* value) {
+  assert(TypeOf(value) == Value::Type::kTuple);
+  return static_cast<const Tuple*>(value)->elements();
 }
 
-std::span<Lazy* const> Value::AsTuple() const {
-  if (GetType() != Type::kTuple) throw std::runtime_error("not a tuple");
-  return static_cast<const Tuple*>(this)->elements;
+UnionView AsUnion(const Value* value) {
+  assert(TypeOf(value) == Value::Type::kUnion);
+  if (IsImmediate(value)) {
+    return {.type_id = core::UnionType::Id::kBool,
+            .index = static_cast<int>(PayloadOf(value)),
+            .elements = {}};
+  }
+  const Union& u = *static_cast<const Union*>(value);
+  return {.type_id = u.GetTypeId(), .index = u.index, .elements = u.elements()};
 }
 
-const Union& Value::AsUnion() const {
-  if (GetType() != Type::kUnion) throw std::runtime_error("not a union");
-  return *static_cast<const Union*>(this);
+UnionView AsUnion(const Value* value, core::UnionType::Id type_id) {
+  const UnionView result = AsUnion(value);
+  assert(result.type_id == type_id);
+  return result;
 }
 
-void Value::Enter(Interpreter& interpreter) {
-  if (GetType() != Type::kLambda) throw std::runtime_error("not a lambda");
-  return static_cast<Lambda*>(this)->Enter(interpreter);
+Lambda* AsLambda(Value* value) {
+  assert(TypeOf(value) == Value::Type::kLambda);
+  return static_cast<Lambda*>(value);
 }
 
 template <std::derived_from<Node> T, typename... Args>
 requires std::constructible_from<T, Args...>
 GCPtr<T> Interpreter::Allocate(Args&&... args) {
-  if (int(heap.size()) >= collect_at_size) CollectGarbage();
-  auto u = std::make_unique<T>(std::forward<Args>(args)...);
-  GCPtr<T> p(this, u.get());
-  heap.push_back(std::move(u));
+  static_assert(std::is_trivially_destructible_v<T>);
+  static_assert(alignof(T) <= alignof(Node));
+  std::size_t size = sizeof(T);
+  if constexpr (requires { T::ExtraSize(args...); }) {
+    size += T::ExtraSize(args...);
+  }
+  T* node = new (heap.Allocate(size)) T(std::forward<Args>(args)...);
+  node->size = size;
+  // Collection happens after construction so that the arguments, which may
+  // refer to nodes from outside of any root, have been consumed.
+  GCPtr<T> p(this, node);
+  if (heap.ShouldCollect()) CollectGarbage();
   return p;
 }
 
-Union nil(core::UnionType::Id::kList, 1);
-
-Value* Interpreter::Nil() { return &nil; }
+Value* Interpreter::Nil() { return constants[kNil]; }
 
 Value* Interpreter::Cons(Lazy* head, Lazy* tail) {
   return Allocate<Union>(core::UnionType::Id::kList, 0,
                          std::span<Lazy* const>({head, tail}));
 }
 
-Union true_value(core::UnionType::Id::kBool, 1);
-Union false_value(core::UnionType::Id::kBool, 0);
-
 Value* Interpreter::Bool(bool value) {
-  return value ? &true_value : &false_value;
+  return MakeImmediate<Value>(Immediate::kBool, value);
+}
+
+Value* Interpreter::Character(char value) {
+  return MakeImmediate<Value>(Immediate::kChar, value);
+}
+
+Value* Interpreter::Integer(std::int64_t value) {
+  Value* immediate = MakeImmediate<Value>(Immediate::kInt64, value);
+  if (PayloadOf(immediate) == value) return immediate;
+  return Allocate<Int64>(value);
+}
+
+Value* Interpreter::ApplyOperator(core::Builtin op, Value* l, Value* r) {
+  if (op == core::Builtin::kLessThan) {
+    if (TypeOf(l) == Value::Type::kChar) return Bool(AsChar(l) < AsChar(r));
+    if (TypeOf(l) != Value::Type::kInt64) {
+      throw std::runtime_error(
+          StrCat("unsupported (<) comparison for ", Name(TypeOf(l))));
+    }
+  }
+  const std::int64_t a = AsInt64(l);
+  const std::int64_t b = AsInt64(r);
+  switch (op) {
+    case core::Builtin::kAdd:
+      return Integer(a + b);
+    case core::Builtin::kBitShift:
+      return Integer(b > 0 ? a << b : a >> -b);
+    case core::Builtin::kBitwiseAnd:
+      return Integer(a & b);
+    case core::Builtin::kBitwiseOr:
+      return Integer(a | b);
+    case core::Builtin::kDivide:
+      return Integer(a / b);
+    case core::Builtin::kLessThan:
+      return Bool(a < b);
+    case core::Builtin::kModulo:
+      return Integer(a % b);
+    case core::Builtin::kMultiply:
+      return Integer(a * b);
+    case core::Builtin::kSubtract:
+      return Integer(a - b);
+    default:
+      throw std::logic_error(StrCat("not an operator: ", op));
+  }
+}
+
+GCPtr<Lazy> Interpreter::Evaluated(Value* value) {
+  return Wrap<Lazy>(value);
+}
+
+std::optional<std::string_view> Interpreter::PendingString(Lazy* list) {
+  Thunk* thunk = TryGetThunk(list);
+  if (!thunk) return std::nullopt;
+  switch (thunk->GetType()) {
+    case Thunk::Type::kRead:
+      return input.From(static_cast<Read*>(thunk)->offset);
+    case Thunk::Type::kText:
+      return static_cast<Text*>(thunk)->rest();
+    default:
+      return std::nullopt;
+  }
 }
 
 std::string Interpreter::EvaluateString(Lazy* list) {
   std::string text;
   while (true) {
-    Value* v = list->Get(*this);
-    if (v->GetType() != Value::Type::kUnion) {
+    if (std::optional<std::string_view> rest = PendingString(list)) {
+      text += *rest;
+      return text;
+    }
+    Value* v = Get(*this, list);
+    if (TypeOf(v) != Value::Type::kUnion) {
       throw std::runtime_error(StrCat("malformed string: tail is ",
-                                      Name(v->GetType()), ", not list"));
+                                      Name(TypeOf(v)), ", not list"));
     }
-    const Union& u = v->AsUnion();
+    const UnionView u = AsUnion(v);
     if (u.type_id != core::UnionType::Id::kList) {
       throw std::runtime_error(
           StrCat("malformed string: tail is ", u.type_id, ", not list"));
@@ -1000,485 +3787,858 @@ std::string Interpreter::EvaluateString(Lazy* list) {
     if (u.elements.size() != 2) {
       throw std::logic_error("corrupt cons in string");
     }
-    Value* head = u.elements[0]->Get(*this);
-    text.push_back(head->AsChar());
+    text.push_back(AsChar(Get(*this, u.elements[0])));
     list = u.elements[1];
   }
   return text;
 }
 
 void Interpreter::CollectGarbage() {
-  for (auto& node : heap) node->reachable = false;
-  std::vector<Node*> frontier;
-  auto dfs = [&frontier](auto* n) {
-    frontier.clear();
-    n->Mark(frontier);
-    while (!frontier.empty()) {
-      Node* n = frontier.back();
-      frontier.pop_back();
-      n->Mark(frontier);
-    }
-  };
-  for (auto& [name, nodes] : names) {
-    for (const auto& node : nodes) dfs(node);
-  }
-  for (auto& node : stack) dfs(node);
-  if (live) {
-    GCPtrBase* i = live;
-    do {
-      dfs(i);
-      i = i->next;
-    } while (i != live);
-  }
-  std::erase_if(heap, [](const auto& node) { return !node->reachable; });
-  collect_at_size = std::max<int>(128, 8 * heap.size());
-}
-
-void Interpreter::ResolveImpl(flat_set<core::Identifier>&, Captures&,
-                              const core::Builtin&) {}
-
-void Interpreter::ResolveImpl(flat_set<core::Identifier>& bound,
-                              Captures& result, const core::Identifier& x) {
-  if (!bound.contains(x)) result[x] = names.at(x).back();
-}
-
-void Interpreter::ResolveImpl(flat_set<core::Identifier>&, Captures&,
-                              const core::Integer&) {}
-
-void Interpreter::ResolveImpl(flat_set<core::Identifier>&, Captures&,
-                              const core::Character&) {}
-
-void Interpreter::ResolveImpl(flat_set<core::Identifier>& bound,
-                              Captures& result,
-                              const core::Tuple& x) {
-  for (const auto& element : x.elements) {
-    Resolve(bound, result, element);
-  }
-}
-
-void Interpreter::ResolveImpl(flat_set<core::Identifier>& bound,
-                              Captures& result,
-                              const core::UnionConstructor& x) {}
-
-void Interpreter::ResolveImpl(flat_set<core::Identifier>& bound,
-                              Captures& result, const core::Apply& x) {
-  Resolve(bound, result, x.f);
-  Resolve(bound, result, x.x);
-}
-
-void Interpreter::ResolveImpl(flat_set<core::Identifier>& bound,
-                              Captures& result, const core::Lambda& x) {
-  auto [i, is_new] = bound.emplace(x.parameter);
-  Resolve(bound, result, x.result);
-  if (is_new) bound.erase(x.parameter);
-}
-
-void Interpreter::ResolveImpl(flat_set<core::Identifier>& bound,
-                              Captures& result, const core::Let& x) {
-  Resolve(bound, result, x.binding.value);
-  auto [i, is_new] = bound.emplace(x.binding.variable);
-  Resolve(bound, result, x.value);
-  if (is_new) bound.erase(x.binding.variable);
-}
-
-void Interpreter::ResolveImpl(flat_set<core::Identifier>& bound,
-                              Captures& result, const core::LetRecursive& x) {
-  std::vector<core::Identifier> newly_bound;
-  for (const auto& binding : x.bindings) {
-    auto [i, is_new] = bound.emplace(binding.variable);
-    if (is_new) newly_bound.push_back(binding.variable);
-  }
-  for (const auto& binding : x.bindings) {
-    Resolve(bound, result, binding.value);
-  }
-  Resolve(bound, result, x.value);
-  for (const auto& id : newly_bound) bound.erase(id);
-}
-
-void Interpreter::ResolveImpl(flat_set<core::Identifier>& bound,
-                              Captures& result,
-                              const core::Case::Alternative& x) {
-  flat_set<core::Identifier> bindings = GetBindings(x.pattern);
-  flat_set<core::Identifier> newly_bound;
-  for (const auto& binding : bindings) {
-    auto [i, is_new] = bound.emplace(binding);
-    if (is_new) newly_bound.insert(binding);
-  }
-  Resolve(bound, result, x.value);
-  for (const auto& id : newly_bound) bound.erase(id);
-}
-
-void Interpreter::ResolveImpl(flat_set<core::Identifier>& bound,
-                              Captures& result, const core::Case& x) {
-  Resolve(bound, result, x.value);
-  for (const auto& alternative : x.alternatives) {
-    ResolveImpl(bound, result, alternative);
-  }
-}
-
-void Interpreter::Resolve(flat_set<core::Identifier>& bound, Captures& result,
-                          const core::Expression& x) {
-  return std::visit(
-      [this, &bound, &result](const auto& x) {
-        return ResolveImpl(bound, result, x);
-      },
-      x->value);
-}
-
-Interpreter::Captures Interpreter::Resolve(const core::Expression& x) {
-  flat_set<core::Identifier> bound;
-  Captures result;
-  Resolve(bound, result, x);
-  return result;
-}
-
-flat_set<core::Identifier> Interpreter::GetBindingsImpl(
-    const core::Identifier& x) {
-  return {x};
-}
-
-flat_set<core::Identifier> Interpreter::GetBindingsImpl(
-    const core::MatchTuple& x) {
-  return flat_set<core::Identifier>(x.elements);
-}
-
-flat_set<core::Identifier> Interpreter::GetBindingsImpl(
-    const core::MatchUnion& x) {
-  return flat_set<core::Identifier>(x.elements);
-}
-
-flat_set<core::Identifier> Interpreter::GetBindingsImpl(const core::Integer&) {
-  return {};
-}
-
-flat_set<core::Identifier> Interpreter::GetBindingsImpl(
-    const core::Character&) {
-  return {};
-}
-
-flat_set<core::Identifier> Interpreter::GetBindings(const core::Pattern& x) {
-  return std::visit([this](const auto& x) { return GetBindingsImpl(x); },
-                    x->value);
+  const std::size_t root_size =
+      locals.size() * sizeof(Lazy*) +
+      continuations.size() * sizeof(bytecode::Continuation) +
+      stack.size() * sizeof(Lazy*);
+  heap.BeginCollection(stack_base, root_size);
+  for (auto& node : locals) heap.Update(node);
+  for (auto& continuation : continuations) heap.Update(continuation.node);
+  for (auto& node : stack) heap.Update(node);
+  for (auto& node : constants) heap.Update(node);
+  for (auto& node : pool) heap.Update(node);
+  handles.Trace(heap);
+  heap.FinishCollection();
 }
 
-NativeClosure<Add> builtin_add;
-NativeClosure<And> builtin_and;
-NativeClosure<BitShift> builtin_bit_shift;
-NativeClosure<BitwiseAnd> builtin_bitwise_and;
-NativeClosure<BitwiseOr> builtin_bitwise_or;
-NativeClosure<Chr> builtin_chr;
-NativeClosure<Concat> builtin_concat;
-NativeClosure<Divide> builtin_divide;
-NativeClosure<MakeError> builtin_error;
-NativeClosure<Equal> builtin_equal;
-NativeClosure<LessThan> builtin_less_than;
-NativeClosure<Modulo> builtin_modulo;
-NativeClosure<Multiply> builtin_multiply;
-NativeClosure<Not> builtin_not;
-NativeClosure<Or> builtin_or;
-NativeClosure<Ord> builtin_ord;
-NativeClosure<ReadInt> builtin_read_int;
-NativeClosure<ShowInt> builtin_show_int;
-NativeClosure<Subtract> builtin_subtract;
-
-Value* Interpreter::Evaluate(const core::Builtin& x) {
+Value* Interpreter::MakeBuiltin(core::Builtin x) {
   switch (x) {
     case core::Builtin::kAdd:
-      return &builtin_add;
+      return Allocate<NativeClosure<Add>>();
     case core::Builtin::kAnd:
-      return &builtin_and;
+      return Allocate<NativeClosure<And>>();
     case core::Builtin::kBitShift:
-      return &builtin_bit_shift;
+      return Allocate<NativeClosure<BitShift>>();
     case core::Builtin::kBitwiseAnd:
-      return &builtin_bitwise_and;
+      return Allocate<NativeClosure<BitwiseAnd>>();
     case core::Builtin::kBitwiseOr:
-      return &builtin_bitwise_or;
+      return Allocate<NativeClosure<BitwiseOr>>();
     case core::Builtin::kChr:
-      return &builtin_chr;
+      return Allocate<NativeClosure<Chr>>();
     case core::Builtin::kConcat:
-      return &builtin_concat;
+      return Allocate<NativeClosure<Concat>>();
     case core::Builtin::kDivide:
-      return &builtin_divide;
+      return Allocate<NativeClosure<Divide>>();
     case core::Builtin::kError:
-      return &builtin_error;
+      return Allocate<NativeClosure<MakeError>>();
     case core::Builtin::kEqual:
-      return &builtin_equal;
+      return Allocate<NativeClosure<Equal>>();
     case core::Builtin::kLessThan:
-      return &builtin_less_than;
+      return Allocate<NativeClosure<LessThan>>();
     case core::Builtin::kModulo:
-      return &builtin_modulo;
+      return Allocate<NativeClosure<Modulo>>();
     case core::Builtin::kMultiply:
-      return &builtin_multiply;
+      return Allocate<NativeClosure<Multiply>>();
     case core::Builtin::kNot:
-      return &builtin_not;
+      return Allocate<NativeClosure<Not>>();
     case core::Builtin::kOr:
-      return &builtin_or;
+      return Allocate<NativeClosure<Or>>();
     case core::Builtin::kOrd:
-      return &builtin_ord;
+      return Allocate<NativeClosure<Ord>>();
     case core::Builtin::kReadInt:
-      return &builtin_read_int;
+      return Allocate<NativeClosure<ReadInt>>();
     case core::Builtin::kShowInt:
-      return &builtin_show_int;
+      return Allocate<NativeClosure<ShowInt>>();
     case core::Builtin::kSubtract:
-      return &builtin_subtract;
+      return Allocate<NativeClosure<Subtract>>();
   }
   throw std::runtime_error(StrCat("unimplemented builtin: ", x));
 }
 
-Value* Interpreter::Evaluate(const core::Identifier& identifier) {
-  return names.at(identifier).back()->Get(*this);
+Interpreter::Interpreter() {
+  for (int i = 0; i < kNil; i++) {
+    constants.push_back(MakeBuiltin(static_cast<core::Builtin>(i)));
+  }
+  constants.push_back(Allocate<Union>(core::UnionType::Id::kList, 1));
+  constants.push_back(Allocate<Union>(core::UnionType::Id::kBool, 0));
+  constants.push_back(Allocate<Union>(core::UnionType::Id::kBool, 1));
+}
+
+Value* Interpreter::Evaluate(const core::Builtin& x) {
+  return constants.at(static_cast<int>(x));
+}
+
+void Interpreter::PushFrame(const resolved::Function& function,
+                            std::span<Lazy* const> values,
+                            std::span<Lazy* const> arguments) {
+  frame = locals.size();
+  locals.resize(frame + function.frame_size);
+  std::ranges::copy(arguments,
+                    std::ranges::copy(values, locals.begin() + frame).out);
+}
+
+Value* Interpreter::Enter(const resolved::Function& function,
+                          std::span<Lazy* const> values,
+                          std::span<Lazy* const> arguments) {
+  const std::size_t caller = frame;
+  PushFrame(function, values, arguments);
+  Value* result;
+  if (compiled.empty()) {
+    do {
+      result = Evaluate(function.body);
+    } while (result == kLoop);
+  } else {
+    result = Execute(&compiled[function.id], nullptr);
+  }
+  locals.resize(frame);
+  frame = caller;
+  return result;
+}
+
+Value* Interpreter::Evaluate(const resolved::Variable& x) {
+  return Get(*this, Local(x.slot));
 }
 
 Value* Interpreter::Evaluate(const core::Integer& x) {
-  return Allocate<Int64>(x.value);
+  return Integer(x.value);
 }
 
 Value* Interpreter::Evaluate(const core::Character& x) {
-  return Allocate<Char>(x.value);
+  return Character(x.value);
 }
 
-Value* Interpreter::Evaluate(const core::Tuple& x) {
-  GCPtr<Tuple> tuple = Allocate<Tuple>();
+Value* Interpreter::Evaluate(const resolved::Tuple& x) {
+  // The elements are kept on the stack while the rest are evaluated so that
+  // they remain visible to the garbage collector.
   for (const auto& element : x.elements) {
-    tuple->elements.push_back(LazyEvaluate(element));
+    stack.push_back(LazyEvaluate(element));
   }
+  const int n = x.elements.size();
+  Value* tuple = Allocate<Tuple>(std::span<Lazy*>(stack).last(n));
+  stack.resize(stack.size() - n);
   return tuple;
 }
 
 Value* Interpreter::Evaluate(const core::UnionConstructor& x) {
   const int arity = x.type->alternatives.at(x.index).num_members;
-  if (arity == 0) {
+  if (x.type->id == core::UnionType::Id::kBool) {
+    return Bool(x.index);
+  } else if (arity == 0) {
     return Allocate<Union>(x.type->id, x.index);
   } else {
     return Allocate<NativeClosure<UnionConstructor>>(UnionConstructor(x));
   }
 }
 
-Value* Interpreter::Evaluate(const core::Apply& x) {
+Value* Interpreter::Evaluate(const resolved::Apply& x) {
+  HandleScope scope(*this);
   stack.push_back(LazyEvaluate(x.x));
-  Wrap(Evaluate(x.f))->Enter(*this);
-  Value* v = stack.back()->Get(*this);
+  Wrap(AsLambda(Evaluate(x.f)))->Enter(*this);
+  Value* v = Get(*this, stack.back());
   stack.pop_back();
   return v;
 }
 
-Value* Interpreter::Evaluate(const core::Lambda& x) {
-  return Allocate<UserLambda>(*this, x);
+Value* Interpreter::Evaluate(const resolved::Call& x) {
+  if (resolved::IsConditional(x)) {
+    const bool decided = std::get<core::Builtin>(x.function) ==
+                         core::Builtin::kOr;
+    Value* l = Evaluate(x.arguments[0]);
+    if (AsBool(l) == decided) return l;
+    return Evaluate(x.arguments[1]);
+  }
+  if (resolved::IsOperator(x)) {
+    HandleScope scope(*this);
+    GCPtr<Value> l(this, Evaluate(x.arguments[0]));
+    Value* r = Evaluate(x.arguments[1]);
+    return ApplyOperator(std::get<core::Builtin>(x.function), l, r);
+  }
+  // As for a tuple, the arguments stay on the stack until they are consumed.
+  for (const auto& argument : x.arguments) {
+    stack.push_back(LazyEvaluate(argument));
+  }
+  const int n = x.arguments.size();
+  if (const auto* builtin = std::get_if<core::Builtin>(&x.function)) {
+    return static_cast<NativeLambda*>(constants[static_cast<int>(*builtin)])
+        ->Invoke(*this);
+  }
+  if (const auto* f = std::get_if<resolved::Variable>(&x.function)) {
+    UserLambda* lambda = AsKnownLambda(Evaluate(*f), n);
+    Value* result = Enter(*lambda->function, lambda->values(),
+                          std::span<Lazy*>(stack).last(n));
+    stack.resize(stack.size() - n);
+    return result;
+  }
+  const auto& constructor = std::get<core::UnionConstructor>(x.function);
+  Value* value = Allocate<Union>(constructor.type->id, constructor.index,
+                                 std::span<Lazy*>(stack).last(n));
+  stack.resize(stack.size() - n);
+  return value;
 }
 
-Value* Interpreter::Evaluate(const core::Let& x) {
-  names[x.binding.variable].push_back(LazyEvaluate(x.binding.value));
-  Value* result = Evaluate(x.value);
-  names[x.binding.variable].pop_back();
-  return result;
+Value* Interpreter::Evaluate(const resolved::Loop& x) {
+  // As for a tuple, the arguments stay on the stack until they are all
+  // evaluated, since they may refer to the parameters.
+  for (const auto& argument : x.arguments) {
+    stack.push_back(LazyEvaluate(argument));
+  }
+  const int n = x.arguments.size();
+  for (int i = 0; i < n; i++) Local(x.slots[i]) = stack[stack.size() - n + i];
+  stack.resize(stack.size() - n);
+  return kLoop;
+}
+
+Value* Interpreter::Evaluate(const resolved::Lambda& x) {
+  return Allocate<UserLambda>(x.function, Frame());
+}
+
+Value* Interpreter::Evaluate(const resolved::Suspend& x) {
+  return Get(*this, LazyEvaluate(x));
+}
+
+Value* Interpreter::Evaluate(const resolved::Strict& x) {
+  return Evaluate(x.value);
+}
+
+Value* Interpreter::Evaluate(const resolved::String& x) {
+  return Allocate<Text>(x.value)->Run(*this);
 }
 
-Value* Interpreter::Evaluate(const core::LetRecursive& x) {
-  std::vector<Lazy*> holes;
-  for (const auto& [id, value] : x.bindings) {
-    GCPtr<Lazy> l =
-        Allocate<Lazy>(Allocate<Error>("this should never be executed"));
-    names[id].push_back(l);
-    holes.push_back(l);
+Value* Interpreter::Evaluate(const resolved::Constant& x) {
+  return Get(*this, pool[x.index]);
+}
+
+Value* Interpreter::Evaluate(const resolved::Let& x) {
+  Local(x.slot) = LazyEvaluate(x.value);
+  return Evaluate(x.body);
+}
+
+Value* Interpreter::Evaluate(const resolved::LetRecursive& x) {
+  for (const auto& binding : x.bindings) {
+    Local(binding.slot) = Allocate<Error>("this should never be executed");
   }
-  for (int i = 0, n = x.bindings.size(); i < n; i++) {
+  for (const auto& binding : x.bindings) {
     // There are two possible cases for the return value here.
     //
     //   * The return value is the value itself, which is currently just
     //     a hole. In this case, the expression has no weak head normal form:
     //     it diverges, so we replace it with an error.
     //   * The return value is *not* the value itself. In this case, we will
-    //     overwrite the hole with the thunk for the actual value. This may
-    //     refer to the value itself internally, at which point it will
+    //     overwrite the hole with an indirection to the actual value. This
+    //     may refer to the value itself internally, at which point it will
     //     evaluate as the newly-assigned value.
-    Lazy* value = LazyEvaluate(x.bindings[i].value);
-    if (holes[i] == value) {
-      *holes[i] = Lazy(Allocate<Error>("divergence"));
+    //
+    // The value may be another hole, or an indirection to one, which is only
+    // the value itself if it leads back to this hole.
+    Lazy* value = Follow(LazyEvaluate(binding.value));
+    Lazy* hole = Local(binding.slot);
+    if (hole == value) {
+      Become<Error>(hole, "divergence");
     } else {
-      *holes[i] = *value;
+      heap.WriteBarrier(Become<Indirection>(hole, value));
     }
   }
-  Value* result = Evaluate(x.value);
-  for (const auto& [id, value] : x.bindings) {
-    names[id].pop_back();
-  }
-  return result;
+  return Evaluate(x.body);
 }
 
-Value* Interpreter::Evaluate(const core::Case& x) {
+Value* Interpreter::Evaluate(const resolved::Case& x) {
+  HandleScope scope(*this);
   GCPtr<Value> v(this, Evaluate(x.value));
-  for (const auto& alternative : x.alternatives) {
-    if (Value* r = TryAlternative(v, alternative)) return r;
+  if (!x.dispatch.empty()) {
+    const UnionView value = AsUnion(v, x.type_id);
+    const int i = x.dispatch[value.index];
+    if (i != -1) {
+      const resolved::Case::Alternative& alternative = x.alternatives[i];
+      if (const auto* variable =
+              std::get_if<resolved::Variable>(&alternative.pattern)) {
+        Local(variable->slot) = Evaluated(v);
+      } else {
+        const auto& d = std::get<resolved::MatchUnion>(alternative.pattern);
+        for (int j = 0, n = value.elements.size(); j < n; j++) {
+          Local(d.slots[j]) = value.elements[j];
+        }
+      }
+      return Evaluate(alternative.value);
+    }
+  } else {
+    for (const auto& alternative : x.alternatives) {
+      if (Value* r = TryAlternative(v, alternative)) return r;
+    }
   }
   throw std::runtime_error(StrCat("non-exhaustative case: nothing to match ",
-                                  Name(v->GetType()),
-                                  ". core: ", x));
+                                  Name(TypeOf(v)),
+                                  ". core: ", *x.source));
 }
 
-Value* Interpreter::Evaluate(const core::Expression& x) {
+Value* Interpreter::Evaluate(const resolved::Expression& x) {
   return std::visit([this](const auto& x) { return Evaluate(x); },
                     x->value);
 }
 
 Lazy* Interpreter::LazyEvaluate(const core::Builtin& x) {
-  return Allocate<Lazy>(Wrap(Evaluate(x)));
+  return Evaluated(Evaluate(x));
 }
 
-Lazy* Interpreter::LazyEvaluate(const core::Identifier& identifier) {
-  return names.at(identifier).back();
+Lazy* Interpreter::LazyEvaluate(const resolved::Variable& x) {
+  return Local(x.slot);
 }
 
 Lazy* Interpreter::LazyEvaluate(const core::Integer& x) {
-  return Allocate<Lazy>(Wrap(Evaluate(x)));
+  return Evaluated(Evaluate(x));
 }
 
 Lazy* Interpreter::LazyEvaluate(const core::Character& x) {
-  return Allocate<Lazy>(Wrap(Evaluate(x)));
+  return Evaluated(Evaluate(x));
 }
 
-Lazy* Interpreter::LazyEvaluate(const core::Tuple& x) {
-  return Allocate<Lazy>(Wrap(Evaluate(x)));
+Lazy* Interpreter::LazyEvaluate(const resolved::Tuple& x) {
+  return Evaluated(Evaluate(x));
 }
 
 Lazy* Interpreter::LazyEvaluate(const core::UnionConstructor& x) {
-  return Allocate<Lazy>(Wrap(Evaluate(x)));
+  return Evaluated(Evaluate(x));
+}
+
+Lazy* Interpreter::LazyEvaluate(const resolved::Apply& x) {
+  return Allocate<Apply>(Wrap(LazyEvaluate(x.f)), Wrap(LazyEvaluate(x.x)));
+}
+
+Lazy* Interpreter::LazyEvaluate(const resolved::Call&) {
+  throw std::logic_error("call in lazy position was not suspended");
+}
+
+Lazy* Interpreter::LazyEvaluate(const resolved::Loop&) {
+  throw std::logic_error("loop outside of tail position");
+}
+
+Lazy* Interpreter::LazyEvaluate(const resolved::Lambda& x) {
+  return Evaluated(Evaluate(x));
+}
+
+Lazy* Interpreter::LazyEvaluate(const resolved::Suspend& x) {
+  return Allocate<Suspension>(x.function, Frame());
+}
+
+Lazy* Interpreter::LazyEvaluate(const resolved::Strict& x) {
+  return Evaluated(Evaluate(x.value));
 }
 
-Lazy* Interpreter::LazyEvaluate(const core::Apply& x) {
-  return Allocate<Lazy>(
-      Allocate<Apply>(Wrap(LazyEvaluate(x.f)), Wrap(LazyEvaluate(x.x))));
+Lazy* Interpreter::LazyEvaluate(const resolved::String& x) {
+  return Allocate<Text>(x.value);
 }
 
-Lazy* Interpreter::LazyEvaluate(const core::Lambda& x) {
-  return Allocate<Lazy>(Wrap(Evaluate(x)));
+Lazy* Interpreter::LazyEvaluate(const resolved::Constant& x) {
+  return pool[x.index];
 }
 
-Lazy* Interpreter::LazyEvaluate(const core::Let& x) {
-  return Allocate<Lazy>(Allocate<Let>(*this, x));
+Lazy* Interpreter::LazyEvaluate(const resolved::Let&) {
+  throw std::logic_error("let in lazy position was not suspended");
 }
 
-Lazy* Interpreter::LazyEvaluate(const core::LetRecursive& x) {
-  return Allocate<Lazy>(Allocate<LetRecursive>(*this, x));
+Lazy* Interpreter::LazyEvaluate(const resolved::LetRecursive&) {
+  throw std::logic_error("letrec in lazy position was not suspended");
 }
 
-Lazy* Interpreter::LazyEvaluate(const core::Case& x) {
-  return Allocate<Lazy>(Allocate<Case>(*this, x));
+Lazy* Interpreter::LazyEvaluate(const resolved::Case&) {
+  throw std::logic_error("case in lazy position was not suspended");
 }
 
-Lazy* Interpreter::LazyEvaluate(const core::Expression& x) {
+Lazy* Interpreter::LazyEvaluate(const resolved::Expression& x) {
   return std::visit([this](const auto& x) { return LazyEvaluate(x); },
                     x->value);
 }
 
-Value* Interpreter::TryAlternative(Value* v, const core::Case::Alternative& x) {
+Value* Interpreter::TryAlternative(Value* v,
+                                   const resolved::Case::Alternative& x) {
   return std::visit(
       [&](const auto& pattern) { return TryAlternative(v, pattern, x.value); },
-      x.pattern->value);
+      x.pattern);
 }
 
-Value* Interpreter::TryAlternative(Value* v, const core::Identifier& i,
-                                   const core::Expression& x) {
-  names[i].push_back(Allocate<Lazy>(v));
-  Value* result = Evaluate(x);
-  names[i].pop_back();
-  return result;
+Value* Interpreter::TryAlternative(Value* v, const resolved::Variable& i,
+                                   const resolved::Expression& x) {
+  Local(i.slot) = Evaluated(v);
+  return Evaluate(x);
 }
 
-Value* Interpreter::TryAlternative(Value* v, const core::MatchTuple& d,
-                                   const core::Expression& x) {
-  if (v->GetType() != Value::Type::kTuple) {
-    throw std::runtime_error(StrCat("attempting to match ", Name(v->GetType()),
-                                    " with tuple pattern"));
-  }
-  std::span<Lazy* const> elements = v->AsTuple();
-  if (elements.size() != d.elements.size()) {
-    throw std::runtime_error(
-        StrCat("attempting to match tuple of size ", elements.size(),
-               " with tuple pattern of size ", d.elements.size()));
+Value* Interpreter::TryAlternative(Value* v, const resolved::MatchTuple& d,
+                                   const resolved::Expression& x) {
+  std::span<Lazy* const> elements = AsTuple(v);
+  assert(elements.size() == d.slots.size());
+  for (int i = 0, n = elements.size(); i < n; i++) {
+    Local(d.slots[i]) = elements[i];
   }
-  const int n = elements.size();
-  for (int i = 0; i < n; i++) {
-    names[d.elements[i]].push_back(elements[i]);
-  }
-  Value* result = Evaluate(x);
-  for (int i = 0; i < n; i++) {
-    names[d.elements[i]].pop_back();
-  }
-  return result;
+  return Evaluate(x);
 }
 
-Value* Interpreter::TryAlternative(Value* v, const core::MatchUnion& d,
-                                   const core::Expression& x) {
-  if (v->GetType() != Value::Type::kUnion) {
-    throw std::runtime_error(StrCat("attempting to match ", Name(v->GetType()),
-                                    " with type constructor"));
-  }
-  const Union& value = v->AsUnion();
-  if (value.type_id != d.type->id) {
-    throw std::runtime_error(
-        StrCat("attempting to match value of type ", value.type_id,
-               " with type constructor for type ", d.type->id));
-  }
+Value* Interpreter::TryAlternative(Value* v, const resolved::MatchUnion& d,
+                                   const resolved::Expression& x) {
+  const UnionView value = AsUnion(v, d.type_id);
   if (value.index != d.index) return nullptr;
-  if (value.elements.size() != d.elements.size()) {
-    throw std::logic_error(StrCat(
-        "mismatch in cardinality for constructor ", value.index, " in type ",
-        value.type_id, ": ", value.elements.size(), " vs ", d.elements.size()));
-  }
-  const int n = value.elements.size();
-  for (int i = 0; i < n; i++) {
-    names[d.elements[i]].push_back(value.elements[i]);
-  }
-  Value* result = Evaluate(x);
-  for (int i = 0; i < n; i++) {
-    names[d.elements[i]].pop_back();
+  assert(value.elements.size() == d.slots.size());
+  for (int i = 0, n = value.elements.size(); i < n; i++) {
+    Local(d.slots[i]) = value.elements[i];
   }
-  return result;
+  return Evaluate(x);
 }
 
 Value* Interpreter::TryAlternative(Value* v, const core::Integer& i,
-                                   const core::Expression& x) {
-  if (v->GetType() != Value::Type::kInt64 || v->AsInt64() != i.value) {
-    return nullptr;
-  }
+                                   const resolved::Expression& x) {
+  if (AsInt64(v) != i.value) return nullptr;
   return Evaluate(x);
 }
 
 Value* Interpreter::TryAlternative(Value* v, const core::Character& c,
-                                   const core::Expression& x) {
-  if (v->GetType() != Value::Type::kChar || v->AsChar() != c.value) {
-    return nullptr;
-  }
+                                   const resolved::Expression& x) {
+  if (AsChar(v) != c.value) return nullptr;
   return Evaluate(x);
 }
 
-void Interpreter::Run(const core::Expression& program) {
-  GCPtr<Lazy> output =
-      Allocate<Lazy>(Allocate<Apply>(Allocate<Lazy>(Wrap(Evaluate(program))),
-                                     Allocate<Lazy>(Allocate<Read>())));
+Value* Interpreter::Force(Lazy* lazy) { return Execute(nullptr, lazy); }
+
+Value* Interpreter::Execute(const bytecode::Code* entry, Lazy* lazy) {
+  using bytecode::Continuation;
+  using bytecode::Op;
+  enum class Action {
+    // Runs the instruction at `pc`.
+    kRun,
+    // Evaluates `lazy` into the accumulator.
+    kForce,
+    // Applies the accumulator to `argument`.
+    kCall,
+    // Passes the accumulator to the innermost continuation.
+    kReturn,
+  };
+  // Nothing in the machine holds a GCPtr across a call or a return, so the
+  // handles created by allocations are released at each one.
+  const HandleStack::Mark mark = handles.GetMark();
+  const std::size_t caller = frame;
+  continuations.push_back({.kind = Continuation::Kind::kStop});
+  const bytecode::Code* code = entry;
+  const bytecode::Instruction* pc = entry ? entry->instructions.data() : nullptr;
+  // The accumulator is only ever held in this native frame, where it is
+  // visible to the conservative stack scan.
+  Value* acc = nullptr;
+  Lazy* argument = nullptr;
+  Action next = entry ? Action::kRun : Action::kForce;
+  while (true) {
+    switch (next) {
+      case Action::kRun:
+        while (next == Action::kRun) {
+          const bytecode::Instruction& i = *pc++;
+          switch (i.op) {
+            case Op::kBuiltin:
+              acc = constants[i.a];
+              break;
+            case Op::kInteger:
+              acc = Integer(code->integers[i.a]);
+              break;
+            case Op::kCharacter:
+              acc = Character(static_cast<char>(i.a));
+              break;
+            case Op::kConstructor:
+              acc = Evaluate(code->constructors[i.a]);
+              break;
+            case Op::kLoad:
+            case Op::kConstant:
+            case Op::kForce: {
+              Lazy* value;
+              if (i.op == Op::kLoad) {
+                value = Local(i.a);
+              } else if (i.op == Op::kConstant) {
+                value = pool[i.a];
+              } else {
+                value = stack.back();
+                stack.pop_back();
+              }
+              if (Value* v = TryGet(value)) {
+                acc = v;
+              } else {
+                continuations.push_back({.kind = Continuation::Kind::kResume,
+                                         .code = code,
+                                         .pc = pc,
+                                         .frame = frame});
+                lazy = value;
+                next = Action::kForce;
+              }
+              break;
+            }
+            case Op::kTuple:
+              acc = Allocate<Tuple>(std::span<Lazy*>(stack).last(i.a));
+              stack.resize(stack.size() - i.a);
+              break;
+            case Op::kLambda:
+              acc = Allocate<UserLambda>(*code->functions[i.a], Frame());
+              break;
+            case Op::kApply:
+              continuations.push_back({.kind = Continuation::Kind::kResume,
+                                       .code = code,
+                                       .pc = pc,
+                                       .frame = frame});
+              argument = stack.back();
+              stack.pop_back();
+              next = Action::kCall;
+              break;
+            case Op::kCallBuiltin:
+            case Op::kTailCallBuiltin: {
+              auto* native = static_cast<NativeLambda*>(constants[i.a]);
+              const std::uint32_t index = stack.size() - i.b;
+              const std::uint32_t end = index + native->NumStrict();
+              if (i.op == Op::kTailCallBuiltin) {
+                locals.resize(frame);
+                next = Action::kReturn;
+              }
+              if (std::all_of(stack.begin() + index, stack.begin() + end,
+                              [](Lazy* x) { return TryGet(x); })) {
+                acc = native->Invoke(*this);
+                break;
+              }
+              // Some strict arguments still need to be evaluated, as for a
+              // saturated application.
+              if (i.op == Op::kCallBuiltin) {
+                continuations.push_back({.kind = Continuation::Kind::kResume,
+                                         .code = code,
+                                         .pc = pc,
+                                         .frame = frame});
+              }
+              continuations.push_back({.kind = Continuation::Kind::kArguments,
+                                       .index = index,
+                                       .end = end,
+                                       .node = native});
+              next = Action::kReturn;
+              break;
+            }
+            case Op::kConstruct: {
+              const core::UnionConstructor& constructor =
+                  code->constructors[i.a];
+              acc = Allocate<Union>(constructor.type->id, constructor.index,
+                                    std::span<Lazy*>(stack).last(i.b));
+              stack.resize(stack.size() - i.b);
+              break;
+            }
+            case Op::kEnter:
+            case Op::kEnterUnboxed:
+            case Op::kTailEnter:
+            case Op::kTailEnterUnboxed: {
+              handles.Reset(mark);
+              UserLambda* lambda = AsKnownLambda(acc, i.b);
+              if (i.op == Op::kEnter || i.op == Op::kEnterUnboxed) {
+                continuations.push_back({.kind = Continuation::Kind::kResume,
+                                         .code = code,
+                                         .pc = pc,
+                                         .frame = frame});
+              } else {
+                locals.resize(frame);
+              }
+              PushFrame(*lambda->function, lambda->values(),
+                        std::span<Lazy*>(stack).last(i.b));
+              stack.resize(stack.size() - i.b);
+              code = &compiled[lambda->function->id];
+              pc = code->instructions.data();
+              if (i.op == Op::kEnterUnboxed || i.op == Op::kTailEnterUnboxed) {
+                pc += code->unboxed_entry;
+              }
+              break;
+            }
+            case Op::kSpread:
+              for (Lazy* element : AsTuple(acc)) stack.push_back(element);
+              break;
+            case Op::kPush:
+              stack.push_back(Local(i.a));
+              break;
+            case Op::kPushValue:
+              stack.push_back(Evaluated(acc));
+              break;
+            case Op::kOperator:
+              acc = ApplyOperator(static_cast<core::Builtin>(i.a),
+                                  TryGet(stack.back()), acc);
+              stack.pop_back();
+              break;
+            case Op::kPushApply: {
+              // The operands stay on the stack until the thunk has been
+              // allocated.
+              Lazy* thunk = Allocate<Apply>(stack.end()[-2], stack.end()[-1]);
+              stack.pop_back();
+              stack.back() = thunk;
+              break;
+            }
+            case Op::kPushSuspension:
+              stack.push_back(
+                  Allocate<Suspension>(*code->functions[i.a], Frame()));
+              break;
+            case Op::kPushConstant:
+              stack.push_back(pool[i.a]);
+              break;
+            case Op::kStore:
+              Local(i.a) = stack.back();
+              stack.pop_back();
+              break;
+            case Op::kHole:
+              Local(i.a) = Allocate<Error>("this should never be executed");
+              break;
+            case Op::kFill: {
+              // See Evaluate(const resolved::LetRecursive&).
+              Lazy* value = Follow(stack.back());
+              stack.pop_back();
+              Lazy* hole = Local(i.a);
+              if (hole == value) {
+                Become<Error>(hole, "divergence");
+              } else {
+                heap.WriteBarrier(Become<Indirection>(hole, value));
+              }
+              break;
+            }
+            case Op::kBind:
+              Local(i.a) = Evaluated(acc);
+              break;
+            case Op::kMatchTuple: {
+              const resolved::MatchTuple& d = *code->tuples[i.b];
+              std::span<Lazy* const> elements = AsTuple(acc);
+              assert(elements.size() == d.slots.size());
+              for (int j = 0, n = elements.size(); j < n; j++) {
+                Local(d.slots[j]) = elements[j];
+              }
+              break;
+            }
+            case Op::kMatchUnion: {
+              const resolved::MatchUnion& d = *code->unions[i.b];
+              const UnionView value = AsUnion(acc, d.type_id);
+              if (value.index != d.index) {
+                pc = code->instructions.data() + i.a;
+                break;
+              }
+              assert(value.elements.size() == d.slots.size());
+              for (int j = 0, n = value.elements.size(); j < n; j++) {
+                Local(d.slots[j]) = value.elements[j];
+              }
+              break;
+            }
+            case Op::kMatchInteger:
+              if (AsInt64(acc) != code->integers[i.b]) {
+                pc = code->instructions.data() + i.a;
+              }
+              break;
+            case Op::kMatchCharacter:
+              if (AsChar(acc) != static_cast<char>(i.b)) {
+                pc = code->instructions.data() + i.a;
+              }
+              break;
+            case Op::kNoMatch:
+              throw std::runtime_error(
+                  StrCat("non-exhaustative case: nothing to match ",
+                         Name(TypeOf(acc)),
+                         ". core: ", *code->cases[i.a]->source));
+            case Op::kSwitch: {
+              const bytecode::Switch& s = code->switches[i.a];
+              const UnionView value = AsUnion(acc, s.type_id);
+              pc = code->instructions.data() + s.targets[value.index];
+              break;
+            }
+            case Op::kUnpack: {
+              const resolved::MatchUnion& d = *code->unions[i.b];
+              std::span<Lazy* const> elements = AsUnion(acc).elements;
+              for (int j = 0, n = elements.size(); j < n; j++) {
+                Local(d.slots[j]) = elements[j];
+              }
+              break;
+            }
+            case Op::kJump:
+              pc = code->instructions.data() + i.a;
+              break;
+            case Op::kJumpIf:
+              if (AsBool(acc) == (i.b != 0)) {
+                pc = code->instructions.data() + i.a;
+              }
+              break;
+            case Op::kReturn:
+              locals.resize(frame);
+              next = Action::kReturn;
+              break;
+            case Op::kTailLoad:
+              lazy = Local(i.a);
+              locals.resize(frame);
+              next = Action::kForce;
+              break;
+            case Op::kTailApply:
+              argument = stack.back();
+              stack.pop_back();
+              locals.resize(frame);
+              next = Action::kCall;
+              break;
+          }
+        }
+        break;
+      case Action::kForce: {
+        if (Value* value = TryGet(lazy)) {
+          acc = value;
+          next = Action::kReturn;
+          break;
+        }
+        handles.Reset(mark);
+        Thunk* thunk = static_cast<Thunk*>(Follow(lazy));
+        thunk->Claim();
+        continuations.push_back(
+            {.kind = Continuation::Kind::kUpdate, .node = thunk});
+        switch (thunk->GetType()) {
+          case Thunk::Type::kSuspension: {
+            auto* suspension = static_cast<Suspension*>(thunk);
+            PushFrame(suspension->function, suspension->captures(), {});
+            code = &compiled[suspension->function.id];
+            pc = code->instructions.data();
+            next = Action::kRun;
+            break;
+          }
+          case Thunk::Type::kApply: {
+            auto* apply = static_cast<Apply*>(thunk);
+            stack.push_back(apply->x);
+            continuations.push_back({.kind = Continuation::Kind::kApply});
+            lazy = apply->f;
+            break;
+          }
+          case Thunk::Type::kNative:
+          case Thunk::Type::kRead:
+          case Thunk::Type::kText:
+          case Thunk::Type::kConcat:
+            acc = thunk->Run(*this);
+            next = Action::kReturn;
+            break;
+          case Thunk::Type::kIndirection:
+            throw std::logic_error("indirection was not followed");
+        }
+        break;
+      }
+      case Action::kCall: {
+        handles.Reset(mark);
+        Lambda* f = AsLambda(acc);
+        if (f->function) {
+          auto* lambda = static_cast<UserLambda*>(f);
+          if (lambda->num_bound + 1 < lambda->function->num_parameters) {
+            acc = Allocate<UserLambda>(*lambda, argument);
+            next = Action::kReturn;
+            break;
+          }
+          PushFrame(*lambda->function, lambda->values(), {&argument, 1});
+          code = &compiled[lambda->function->id];
+          pc = code->instructions.data();
+          next = Action::kRun;
+          break;
+        }
+        auto* native = static_cast<NativeLambda*>(f);
+        stack.push_back(argument);
+        if (auto arguments = native->Prepare(*this)) {
+          const std::uint32_t index = stack.size() - arguments->count;
+          continuations.push_back({.kind = Continuation::Kind::kArguments,
+                                   .index = index,
+                                   .end = index + arguments->strict,
+                                   .node = native});
+        } else {
+          acc = TryGet(stack.back());
+          stack.pop_back();
+        }
+        next = Action::kReturn;
+        break;
+      }
+      case Action::kReturn: {
+        Continuation& continuation = continuations.back();
+        switch (continuation.kind) {
+          case Continuation::Kind::kResume:
+            code = continuation.code;
+            pc = continuation.pc;
+            frame = continuation.frame;
+            continuations.pop_back();
+            next = Action::kRun;
+            break;
+          case Continuation::Kind::kUpdate:
+            static_cast<Thunk*>(continuation.node)->Update(*this, acc);
+            continuations.pop_back();
+            break;
+          case Continuation::Kind::kApply:
+            continuations.pop_back();
+            argument = stack.back();
+            stack.pop_back();
+            next = Action::kCall;
+            break;
+          case Continuation::Kind::kArguments: {
+            while (continuation.index < continuation.end) {
+              Lazy* value = stack[continuation.index++];
+              if (!TryGet(value)) {
+                lazy = value;
+                next = Action::kForce;
+                break;
+              }
+            }
+            if (next == Action::kForce) break;
+            auto* native = static_cast<NativeLambda*>(continuation.node);
+            continuations.pop_back();
+            acc = native->Invoke(*this);
+            break;
+          }
+          case Continuation::Kind::kStop:
+            continuations.pop_back();
+            frame = caller;
+            handles.Reset(mark);
+            return acc;
+        }
+        break;
+      }
+    }
+  }
+}
+
+void Interpreter::Run(const core::Expression& program, Backend backend) {
+  stack_base = __builtin_frame_address(0);
+  const StrictnessAnalyzer::Result strict =
+      StrictnessAnalyzer().AnalyzeProgram(program);
+  const TupleResultAnalyzer::Result results =
+      TupleResultAnalyzer().AnalyzeProgram(program);
+  const SelfTailCallFinder::Result loops =
+      SelfTailCallFinder().FindInProgram(program);
+  const resolved::Program resolved =
+      Resolver(strict, results, loops).ResolveProgram(program);
+  if (backend == Backend::kBytecode) {
+    compiled = BytecodeCompiler().CompileProgram(resolved.main);
+  }
+  for (const auto& constant : resolved.constants) {
+    pool.push_back(LazyEvaluate(constant));
+  }
+  GCPtr<Lazy> text = Allocate<Apply>(Evaluated(Enter(resolved.main, {}, {})),
+                                     Allocate<Read>(0));
   while (true) {
-    Value* v = output->Get(*this);
-    if (v->GetType() != Value::Type::kUnion) {
+    HandleScope scope(*this);
+    // Packed strings, either on their own or on the left of (++), are written
+    // out directly without being unpacked.
+    if (std::optional<std::string_view> rest = PendingString(text)) {
+      output.Write(*rest);
+      break;
+    }
+    if (Thunk* thunk = TryGetThunk(text);
+        thunk && thunk->GetType() == Thunk::Type::kConcat) {
+      auto* concat = static_cast<ConcatThunk*>(thunk);
+      if (std::optional<std::string_view> left = PendingString(concat->l)) {
+        output.Write(*left);
+        text = concat->r;
+        continue;
+      }
+    }
+    Value* v = Get(*this, text);
+    if (TypeOf(v) != Value::Type::kUnion) {
       throw std::runtime_error(StrCat("malformed string: tail is ",
-                                      Name(v->GetType()), ", not list"));
+                                      Name(TypeOf(v)), ", not list"));
     }
-    const Union& u = v->AsUnion();
+    const UnionView u = AsUnion(v);
     if (u.type_id != core::UnionType::Id::kList) {
       throw std::runtime_error(
           StrCat("malformed string: tail is ", u.type_id, ", not list"));
     }
     if (u.index == 1) break;
-    Value* head = u.elements[0]->Get(*this);
-    std::cout << head->AsChar();
-    output = u.elements[1];
+    output.Write(AsChar(Get(*this, u.elements[0])));
+    text = u.elements[1];
   }
+  output.Flush();
 }
 
 }  // namespace
 
-void Run(const core::Expression& program) {
+void Run(const core::Expression& program, Backend backend) {
   Interpreter interpreter;
-  interpreter.Run(program);
+  interpreter.Run(program, backend);
 }
 
 }  // namespace aoc2022
@@ -5,7 +5,15 @@
 
 namespace aoc2022 {
 
-void Run(const core::Expression& program);
+enum class Backend {
+  // Evaluates the program by walking its expression tree.
+  kTree,
+  // Compiles the program to bytecode and runs it in a virtual machine.
+  kBytecode,
+};
+
+void Run(const core::Expression& program,
+         Backend backend = Backend::kBytecode);
 
 }  // namespace aoc2022
 
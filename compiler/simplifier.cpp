@@ -0,0 +1,1814 @@
+#include "simplifier.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <span>
+#include <stdexcept>
+
+namespace aoc2022 {
+namespace {
+
+// Whether `x` is a variable or a constant, which can be copied freely without
+// duplicating any work.
+bool IsAtom(const core::Expression& x) {
+  return std::holds_alternative<core::Identifier>(x->value) ||
+         std::holds_alternative<core::Builtin>(x->value) ||
+         std::holds_alternative<core::Integer>(x->value) ||
+         std::holds_alternative<core::Character>(x->value) ||
+         std::holds_alternative<core::UnionConstructor>(x->value);
+}
+
+int Arity(core::Builtin x) {
+  switch (x) {
+    case core::Builtin::kChr:
+    case core::Builtin::kError:
+    case core::Builtin::kNot:
+    case core::Builtin::kOrd:
+    case core::Builtin::kReadInt:
+    case core::Builtin::kShowInt:
+      return 1;
+    default:
+      return 2;
+  }
+}
+
+// Splits an application into its head and its arguments, which are appended to
+// `arguments` in order.
+const core::Expression& Spine(const core::Expression& x,
+                              std::vector<core::Expression>& arguments) {
+  const core::Expression* head = &x;
+  const auto first = arguments.size();
+  while (const auto* apply = std::get_if<core::Apply>(&(*head)->value)) {
+    arguments.push_back(apply->x);
+    head = &apply->f;
+  }
+  std::reverse(arguments.begin() + first, arguments.end());
+  return *head;
+}
+
+// Calls `f` on each immediate subexpression of `x`.
+void ForEachChild(const core::Expression& x,
+                  const std::function<void(const core::Expression&)>& f) {
+  std::visit(
+      [&](const auto& x) {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, core::Tuple>) {
+          for (const auto& element : x.elements) f(element);
+        } else if constexpr (std::is_same_v<T, core::Apply>) {
+          f(x.f);
+          f(x.x);
+        } else if constexpr (std::is_same_v<T, core::Lambda>) {
+          f(x.result);
+        } else if constexpr (std::is_same_v<T, core::Let>) {
+          f(x.binding.value);
+          f(x.value);
+        } else if constexpr (std::is_same_v<T, core::LetRecursive>) {
+          for (const auto& binding : x.bindings) f(binding.value);
+          f(x.value);
+        } else if constexpr (std::is_same_v<T, core::Case>) {
+          f(x.value);
+          for (const auto& alternative : x.alternatives) f(alternative.value);
+        }
+      },
+      x->value);
+}
+
+// Rebuilds `x` with each immediate subexpression replaced by `f` of it.
+core::Expression MapChildren(
+    const core::Expression& x,
+    const std::function<core::Expression(const core::Expression&)>& f) {
+  return std::visit(
+      [&](const auto& x) -> core::Expression {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, core::Tuple>) {
+          std::vector<core::Expression> elements;
+          for (const auto& element : x.elements) elements.push_back(f(element));
+          return core::Tuple(std::move(elements));
+        } else if constexpr (std::is_same_v<T, core::Apply>) {
+          return core::Apply(f(x.f), f(x.x));
+        } else if constexpr (std::is_same_v<T, core::Lambda>) {
+          return core::Lambda(x.parameter, f(x.result));
+        } else if constexpr (std::is_same_v<T, core::Let>) {
+          return core::Let(core::Binding(x.binding.variable, f(x.binding.value)),
+                           f(x.value));
+        } else if constexpr (std::is_same_v<T, core::LetRecursive>) {
+          std::vector<core::Binding> bindings;
+          for (const auto& binding : x.bindings) {
+            bindings.push_back(core::Binding(binding.variable, f(binding.value)));
+          }
+          return core::LetRecursive(std::move(bindings), f(x.value));
+        } else if constexpr (std::is_same_v<T, core::Case>) {
+          std::vector<core::Case::Alternative> alternatives;
+          for (const auto& alternative : x.alternatives) {
+            alternatives.push_back(
+                core::Case::Alternative(alternative.pattern, f(alternative.value)));
+          }
+          return core::Case(f(x.value), std::move(alternatives));
+        } else {
+          return x;
+        }
+      },
+      x->value);
+}
+
+int NumParameters(const core::Expression& x) {
+  int result = 0;
+  for (const core::Expression* body = &x;
+       const auto* lambda = std::get_if<core::Lambda>(&(*body)->value);
+       body = &lambda->result) {
+    result++;
+  }
+  return result;
+}
+
+int Size(const core::Expression& x) {
+  int size = 1;
+  ForEachChild(x, [&](const core::Expression& child) { size += Size(child); });
+  return size;
+}
+
+void CollectIdentifiers(const core::Expression& x,
+                        std::set<core::Identifier>& result) {
+  if (const auto* id = std::get_if<core::Identifier>(&x->value)) {
+    result.insert(*id);
+  }
+  ForEachChild(x, [&](const core::Expression& child) {
+    CollectIdentifiers(child, result);
+  });
+}
+
+// Whether every binding is a function, so that allocating the bindings sooner
+// or less often doesn't change how much work is done.
+bool AllFunctions(std::span<const core::Binding> bindings) {
+  return std::ranges::all_of(bindings, [](const core::Binding& binding) {
+    return std::holds_alternative<core::Lambda>(binding.value->value);
+  });
+}
+
+bool AnyUses(std::span<const core::Binding> bindings, core::Identifier id) {
+  std::set<core::Identifier> uses;
+  for (const auto& binding : bindings) CollectIdentifiers(binding.value, uses);
+  return uses.contains(id);
+}
+
+std::vector<core::Identifier> Binders(const core::Pattern& x) {
+  return std::visit(
+      [](const auto& x) -> std::vector<core::Identifier> {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, core::Identifier>) {
+          return {x};
+        } else if constexpr (std::is_same_v<T, core::MatchTuple> ||
+                             std::is_same_v<T, core::MatchUnion>) {
+          return x.elements;
+        } else {
+          return {};
+        }
+      },
+      x->value);
+}
+
+int MaxIdentifier(const core::Expression& x) {
+  int result = -1;
+  const auto see = [&](core::Identifier id) {
+    result = std::max(result, static_cast<int>(id));
+  };
+  std::visit(
+      [&](const auto& x) {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, core::Identifier>) {
+          see(x);
+        } else if constexpr (std::is_same_v<T, core::Lambda>) {
+          see(x.parameter);
+        } else if constexpr (std::is_same_v<T, core::Let>) {
+          see(x.binding.variable);
+        } else if constexpr (std::is_same_v<T, core::LetRecursive>) {
+          for (const auto& binding : x.bindings) see(binding.variable);
+        } else if constexpr (std::is_same_v<T, core::Case>) {
+          for (const auto& alternative : x.alternatives) {
+            for (core::Identifier id : Binders(alternative.pattern)) see(id);
+          }
+        }
+      },
+      x->value);
+  ForEachChild(x, [&](const core::Expression& child) {
+    result = std::max(result, MaxIdentifier(child));
+  });
+  return result;
+}
+
+// The outermost structure of a value which is known at compile time.
+struct Shape {
+  enum class Kind {
+    kUnion,
+    kTuple,
+    kInteger,
+    kCharacter,
+  };
+  Kind kind;
+  core::UnionType::Id type_id = core::UnionType::Id::kBool;
+  // The constructor index for a union, or the value of a literal.
+  std::int64_t value = 0;
+  std::vector<core::Expression> elements;
+};
+
+std::optional<Shape> ShapeOf(const core::Expression& x) {
+  if (const auto* i = std::get_if<core::Integer>(&x->value)) {
+    return Shape{.kind = Shape::Kind::kInteger, .value = i->value,
+                 .elements = {}};
+  }
+  if (const auto* c = std::get_if<core::Character>(&x->value)) {
+    return Shape{.kind = Shape::Kind::kCharacter, .value = c->value,
+                 .elements = {}};
+  }
+  if (const auto* t = std::get_if<core::Tuple>(&x->value)) {
+    return Shape{.kind = Shape::Kind::kTuple, .elements = t->elements};
+  }
+  std::vector<core::Expression> arguments;
+  const core::Expression& head = Spine(x, arguments);
+  const auto* u = std::get_if<core::UnionConstructor>(&head->value);
+  if (!u) return std::nullopt;
+  const int num_members = u->type->alternatives.at(u->index).num_members;
+  if (static_cast<int>(arguments.size()) != num_members) return std::nullopt;
+  return Shape{.kind = Shape::Kind::kUnion,
+               .type_id = u->type->id,
+               .value = u->index,
+               .elements = std::move(arguments)};
+}
+
+enum class Match {
+  kYes,
+  kNo,
+  // The pattern can't be compared with the value at compile time, or it would
+  // fail with a runtime error.
+  kUnknown,
+};
+
+Match Matches(const Shape& shape, const core::Pattern& pattern) {
+  return std::visit(
+      [&](const auto& x) {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, core::Identifier>) {
+          return Match::kYes;
+        } else if constexpr (std::is_same_v<T, core::MatchTuple>) {
+          return shape.kind == Shape::Kind::kTuple &&
+                         shape.elements.size() == x.elements.size()
+                     ? Match::kYes
+                     : Match::kUnknown;
+        } else if constexpr (std::is_same_v<T, core::MatchUnion>) {
+          if (shape.kind != Shape::Kind::kUnion ||
+              shape.type_id != x.type->id) {
+            return Match::kUnknown;
+          }
+          return shape.value == x.index ? Match::kYes : Match::kNo;
+        } else if constexpr (std::is_same_v<T, core::Integer>) {
+          if (shape.kind != Shape::Kind::kInteger) return Match::kUnknown;
+          return shape.value == x.value ? Match::kYes : Match::kNo;
+        } else {
+          static_assert(std::is_same_v<T, core::Character>);
+          if (shape.kind != Shape::Kind::kCharacter) return Match::kUnknown;
+          return shape.value == x.value ? Match::kYes : Match::kNo;
+        }
+      },
+      pattern->value);
+}
+
+// The value which a scrutinee must have if it matched `pattern`, if that is
+// more than nothing.
+std::optional<core::Expression> PatternValue(const core::Pattern& pattern) {
+  return std::visit(
+      [&](const auto& x) -> std::optional<core::Expression> {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, core::Identifier>) {
+          return std::nullopt;
+        } else if constexpr (std::is_same_v<T, core::MatchTuple>) {
+          return core::Tuple(
+              std::vector<core::Expression>(x.elements.begin(),
+                                            x.elements.end()));
+        } else if constexpr (std::is_same_v<T, core::MatchUnion>) {
+          core::Expression result = core::UnionConstructor(x.type, x.index);
+          for (core::Identifier id : x.elements) {
+            result = core::Apply(std::move(result), id);
+          }
+          return result;
+        } else {
+          return x;
+        }
+      },
+      pattern->value);
+}
+
+// Where and how often a variable is used.
+struct Occurrences {
+  int count = 0;
+  // Whether any use is inside a lambda which doesn't also contain the binding,
+  // so that it may be evaluated many times.
+  bool under_lambda = false;
+};
+
+// Finds which of the `parameters` of the recursive function `f` are static,
+// meaning that every call in `x` passes each one back unchanged in the same
+// position, by clearing `is_static` for the others. Returns false if `f` is
+// used without being called, in which case nothing is static.
+bool FindStaticArguments(core::Identifier f,
+                         std::span<const core::Identifier> parameters,
+                         const core::Expression& x, std::vector<bool>& is_static) {
+  std::vector<core::Expression> arguments;
+  const core::Expression& head = Spine(x, arguments);
+  const auto* id = std::get_if<core::Identifier>(&head->value);
+  if (id && *id == f) {
+    if (arguments.empty()) return false;
+    for (std::size_t i = 0; i < parameters.size(); i++) {
+      const core::Identifier* argument =
+          i < arguments.size()
+              ? std::get_if<core::Identifier>(&arguments[i]->value)
+              : nullptr;
+      if (!argument || *argument != parameters[i]) is_static[i] = false;
+    }
+    return std::ranges::all_of(arguments, [&](const core::Expression& argument) {
+      return FindStaticArguments(f, parameters, argument, is_static);
+    });
+  }
+  bool result = true;
+  ForEachChild(x, [&](const core::Expression& child) {
+    result = result && FindStaticArguments(f, parameters, child, is_static);
+  });
+  return result;
+}
+
+// Replaces every call to `f` in `x` with a call to `worker` which omits the
+// static arguments.
+core::Expression DropStaticArguments(core::Identifier f, core::Identifier worker,
+                                     const std::vector<bool>& is_static,
+                                     const core::Expression& x) {
+  std::vector<core::Expression> arguments;
+  const core::Expression& head = Spine(x, arguments);
+  const auto* id = std::get_if<core::Identifier>(&head->value);
+  if (id && *id == f) {
+    core::Expression result = worker;
+    for (std::size_t i = 0; i < arguments.size(); i++) {
+      if (i < is_static.size() && is_static[i]) continue;
+      result = core::Apply(
+          std::move(result),
+          DropStaticArguments(f, worker, is_static, arguments[i]));
+    }
+    return result;
+  }
+  return MapChildren(x, [&](const core::Expression& child) {
+    return DropStaticArguments(f, worker, is_static, child);
+  });
+}
+
+// Finds the strongly connected components of the graph restricted to the
+// `included` nodes, using Tarjan's algorithm, which finds each component after
+// every component which it depends on.
+std::vector<std::vector<int>> Components(
+    const std::vector<std::vector<int>>& edges,
+    const std::vector<bool>& included) {
+  const int n = edges.size();
+  std::vector<std::vector<int>> components;
+  std::vector<int> order(n, -1), low(n), stack;
+  std::vector<bool> on_stack(n);
+  int next_order = 0;
+  std::function<void(int)> visit = [&](int i) {
+    order[i] = low[i] = next_order++;
+    stack.push_back(i);
+    on_stack[i] = true;
+    for (int j : edges[i]) {
+      if (!included[j]) continue;
+      if (order[j] == -1) {
+        visit(j);
+        low[i] = std::min(low[i], low[j]);
+      } else if (on_stack[j]) {
+        low[i] = std::min(low[i], order[j]);
+      }
+    }
+    if (low[i] != order[i]) return;
+    std::vector<int>& component = components.emplace_back();
+    while (true) {
+      const int j = stack.back();
+      stack.pop_back();
+      on_stack[j] = false;
+      component.push_back(j);
+      if (j == i) break;
+    }
+    std::ranges::sort(component);
+  };
+  for (int i = 0; i < n; i++) {
+    if (included[i] && order[i] == -1) visit(i);
+  }
+  return components;
+}
+
+// Chooses loop breakers for a recursive group of bindings: bindings which are
+// never inlined, such that every cycle in the group passes through at least
+// one of them. The other bindings are appended to `order` after everything
+// which they depend on.
+void ChooseLoopBreakers(const std::vector<std::vector<int>>& edges,
+                        const std::vector<int>& sizes,
+                        const std::vector<int>& group, std::vector<int>& order,
+                        std::vector<int>& breakers) {
+  std::vector<bool> included(edges.size());
+  for (int i : group) included[i] = true;
+  for (std::vector<int>& component : Components(edges, included)) {
+    if (component.size() == 1 &&
+        std::ranges::find(edges[component[0]], component[0]) ==
+            edges[component[0]].end()) {
+      order.push_back(component[0]);
+      continue;
+    }
+    // The largest binding is the one which is least likely to be worth
+    // inlining anyway.
+    const auto breaker = std::ranges::max_element(
+        component, [&](int a, int b) { return sizes[a] < sizes[b]; });
+    breakers.push_back(*breaker);
+    component.erase(breaker);
+    ChooseLoopBreakers(edges, sizes, component, order, breakers);
+  }
+}
+
+// Functions no bigger than `always` are inlined wherever they are called.
+// Functions no bigger than `interesting` are inlined where at least one of the
+// arguments is something which the body could make use of, such as a known
+// function or constructor.
+struct InlineLimits {
+  int always;
+  int interesting;
+};
+
+constexpr InlineLimits kInlineLimits[] = {
+    {.always = 0, .interesting = 0},
+    {.always = 0, .interesting = 0},
+    {.always = 12, .interesting = 60},
+    {.always = 24, .interesting = 120},
+};
+
+// The extra arity of an expression which never returns, and so can be given
+// any number of arguments.
+constexpr int kUnbounded = 1000;
+
+// A single pass of the simplifier. Identifiers in core are unique, so
+// expressions can be moved into the scope of other bindings without any risk
+// of capture. Code which is duplicated is cloned with fresh identifiers to keep
+// it that way.
+class Simplifier {
+ public:
+  // While `fusing`, the prelude's foldr and build are fused with each other
+  // instead of being inlined.
+  Simplifier(SimplifierStats& stats, int next_id,
+             const SimplifierOptions& options, bool fusing)
+      : stats_(stats),
+        next_id_(next_id),
+        inlining_(options.level >= 2),
+        limits_(kInlineLimits[options.level]),
+        foldr_(fusing ? options.foldr : std::nullopt),
+        build_(fusing ? options.build : std::nullopt) {}
+
+  core::Expression Run(const core::Expression& program) {
+    CountOccurrences(program, 0);
+    return Simplify(program);
+  }
+
+  bool changed() const { return changed_; }
+  int next_id() const { return next_id_; }
+
+ private:
+  struct Substitution {
+    core::Expression value;
+    bool used = false;
+  };
+
+  struct Unfolding {
+    core::Expression value;
+    int size;
+  };
+
+  void CountOccurrences(const core::Expression& x, int depth);
+  void Bind(core::Identifier id, int depth) { binder_depth_[id] = depth; }
+
+  core::Expression Simplify(const core::Builtin& x) { return x; }
+  core::Expression Simplify(const core::Identifier& x);
+  core::Expression Simplify(const core::Integer& x) { return x; }
+  core::Expression Simplify(const core::Character& x) { return x; }
+  core::Expression Simplify(const core::Tuple& x);
+  core::Expression Simplify(const core::UnionConstructor& x) { return x; }
+  core::Expression Simplify(const core::Apply& x);
+  core::Expression Simplify(const core::Lambda& x);
+  core::Expression Simplify(const core::Let& x);
+  core::Expression Simplify(const core::LetRecursive& x);
+  core::Expression Simplify(const core::Case& x);
+  core::Expression Simplify(const core::Expression& x);
+
+  // These take operands which have already been simplified, apart from the
+  // body of a let and the alternatives of a case.
+  core::Expression SimplifyApply(core::Expression f, core::Expression x);
+  core::Expression SimplifyLet(core::Identifier variable,
+                               core::Expression value,
+                               const std::function<core::Expression()>& body);
+  core::Expression SimplifyCase(
+      core::Expression value,
+      const std::vector<core::Case::Alternative>& alternatives);
+  // Binds the elements of a value which is known to match `pattern`.
+  core::Expression SimplifyMatch(const core::Pattern& pattern,
+                                 const core::Expression& value,
+                                 std::span<const core::Expression> elements,
+                                 const core::Expression& body);
+  std::optional<core::Expression> Fold(
+      core::Builtin f, std::span<const core::Expression> arguments);
+
+  // Records that calls to `variable` may be replaced with copies of `value`.
+  void Unfold(core::Identifier variable, const core::Expression& value);
+  bool ShouldInline(const Unfolding& unfolding,
+                    std::span<const core::Expression> arguments) const;
+  bool IsInteresting(const core::Expression& x) const;
+  std::optional<core::Expression> StaticArgumentTransform(
+      core::Identifier f, const core::Expression& value);
+  bool IsFusible(core::Identifier x) const { return x == foldr_ || x == build_; }
+
+  // How many more arguments `x` could take before doing any work which would
+  // be repeated by passing them in right away.
+  int ExtraArity(const core::Expression& x);
+  // Whether `x` is cheap enough to evaluate that it doesn't matter if it is
+  // evaluated more than once.
+  bool IsCheap(const core::Expression& x);
+  // Whether `x` is a function applied to too few arguments to do anything, so
+  // that it can be copied into a lambda without repeating any work.
+  bool IsPartialApplication(const core::Expression& x) const;
+  std::optional<core::Expression> EtaExpand(core::Identifier f,
+                                            const core::Expression& value);
+
+  core::Expression Bool(bool value) {
+    return core::UnionConstructor(bool_type_, value ? 1 : 0);
+  }
+  std::optional<bool> AsBool(const core::Expression& x) {
+    const auto* u = std::get_if<core::UnionConstructor>(&x->value);
+    if (!u || u->type->id != core::UnionType::Id::kBool) return std::nullopt;
+    return u->index == 1;
+  }
+
+  core::Identifier Fresh() { return core::Identifier(next_id_++); }
+  core::Expression Clone(const core::Expression& x,
+                         std::map<core::Identifier, core::Identifier>& names);
+  core::Pattern Clone(const core::Pattern& x,
+                      std::map<core::Identifier, core::Identifier>& names);
+  core::Expression Clone(const core::Expression& x) {
+    std::map<core::Identifier, core::Identifier> names;
+    return Clone(x, names);
+  }
+
+  void Changed(int& counter) {
+    counter++;
+    changed_ = true;
+  }
+
+  SimplifierStats& stats_;
+  int next_id_;
+  const bool inlining_;
+  const InlineLimits limits_;
+  const std::optional<core::Identifier> foldr_, build_;
+  bool changed_ = false;
+  std::map<core::Identifier, int> binder_depth_;
+  std::map<core::Identifier, Occurrences> occurrences_;
+  // Variables whose bindings have been inlined, along with their values.
+  std::map<core::Identifier, Substitution> substitution_;
+  // Variables whose outermost constructor is known, along with a value with
+  // that constructor whose fields are all atoms.
+  std::map<core::Identifier, core::Expression> known_;
+  // Non-recursive functions which may be inlined, along with their
+  // definitions.
+  std::map<core::Identifier, Unfolding> unfoldings_;
+  // The number of parameters of each let-bound function.
+  std::map<core::Identifier, int> arities_;
+  const std::shared_ptr<const core::UnionType> bool_type_ =
+      core::BoolType();
+  const std::shared_ptr<const core::UnionType> list_type_ =
+      core::ListType();
+};
+
+// Case of case duplicates the outer alternatives into each branch of the inner
+// case, so it is limited to cases where the copies are small in total.
+constexpr int kCaseOfCaseLimit = 100;
+
+void Simplifier::CountOccurrences(const core::Expression& x, int depth) {
+  std::visit(
+      [&](const auto& x) {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, core::Identifier>) {
+          Occurrences& occurrences = occurrences_[x];
+          occurrences.count++;
+          const auto i = binder_depth_.find(x);
+          if (i == binder_depth_.end() || i->second < depth) {
+            occurrences.under_lambda = true;
+          }
+        } else if constexpr (std::is_same_v<T, core::Lambda>) {
+          Bind(x.parameter, depth + 1);
+          CountOccurrences(x.result, depth + 1);
+        } else if constexpr (std::is_same_v<T, core::Let>) {
+          Bind(x.binding.variable, depth);
+          CountOccurrences(x.binding.value, depth);
+          CountOccurrences(x.value, depth);
+        } else if constexpr (std::is_same_v<T, core::LetRecursive>) {
+          for (const auto& binding : x.bindings) Bind(binding.variable, depth);
+          for (const auto& binding : x.bindings) {
+            CountOccurrences(binding.value, depth);
+          }
+          CountOccurrences(x.value, depth);
+        } else if constexpr (std::is_same_v<T, core::Case>) {
+          CountOccurrences(x.value, depth);
+          for (const auto& alternative : x.alternatives) {
+            for (core::Identifier id : Binders(alternative.pattern)) {
+              Bind(id, depth);
+            }
+            CountOccurrences(alternative.value, depth);
+          }
+        } else {
+          ForEachChild(x, [&](const core::Expression& child) {
+            CountOccurrences(child, depth);
+          });
+        }
+      },
+      x->value);
+}
+
+core::Expression Simplifier::Simplify(const core::Identifier& x) {
+  auto i = substitution_.find(x);
+  if (i == substitution_.end()) return x;
+  Substitution& substitution = i->second;
+  if (IsAtom(substitution.value)) return substitution.value;
+  // A binding which was used once can only be reached more than once through
+  // code which has since been duplicated.
+  if (substitution.used) return Clone(substitution.value);
+  substitution.used = true;
+  return substitution.value;
+}
+
+core::Expression Simplifier::Simplify(const core::Tuple& x) {
+  std::vector<core::Expression> elements;
+  for (const auto& element : x.elements) elements.push_back(Simplify(element));
+  return core::Tuple(std::move(elements));
+}
+
+core::Expression Simplifier::Simplify(const core::Apply& x) {
+  std::vector<core::Expression> arguments = {x.x};
+  const core::Expression* head = &x.f;
+  while (const auto* apply = std::get_if<core::Apply>(&(*head)->value)) {
+    arguments.push_back(apply->x);
+    head = &apply->f;
+  }
+  std::ranges::reverse(arguments);
+  core::Expression f = Simplify(*head);
+  for (auto& argument : arguments) argument = Simplify(argument);
+  // foldr k z (build g)  =>  g k z
+  if (const auto* id = std::get_if<core::Identifier>(&f->value);
+      id && foldr_ == *id && arguments.size() >= 3) {
+    // Bindings around the list are floated out of the way.
+    std::vector<core::Expression> lets;
+    core::Expression list = arguments[2];
+    while (true) {
+      if (const auto* let = std::get_if<core::Let>(&list->value)) {
+        lets.push_back(list);
+        list = let->value;
+      } else if (const auto* let = std::get_if<core::LetRecursive>(&list->value)) {
+        lets.push_back(list);
+        list = let->value;
+      } else {
+        break;
+      }
+    }
+    std::vector<core::Expression> inner;
+    const core::Expression& builder = Spine(list, inner);
+    const auto* build = std::get_if<core::Identifier>(&builder->value);
+    if (build && build_ == *build && inner.size() == 1) {
+      Changed(stats_.lists_fused);
+      core::Expression result = inner[0];
+      for (std::size_t i = 0; i < arguments.size(); i++) {
+        if (i != 2) result = SimplifyApply(std::move(result), arguments[i]);
+      }
+      for (int i = lets.size() - 1; i >= 0; i--) {
+        if (const auto* let = std::get_if<core::Let>(&lets[i]->value)) {
+          result = core::Let(let->binding, std::move(result));
+        } else {
+          result = core::LetRecursive(
+              std::get<core::LetRecursive>(lets[i]->value).bindings,
+              std::move(result));
+        }
+      }
+      return result;
+    }
+  }
+  if (const auto* id = std::get_if<core::Identifier>(&f->value)) {
+    const auto i = unfoldings_.find(*id);
+    if (i != unfoldings_.end() && ShouldInline(i->second, arguments)) {
+      Changed(stats_.functions_inlined);
+      f = Clone(i->second.value);
+    }
+  }
+  for (auto& argument : arguments) {
+    f = SimplifyApply(std::move(f), std::move(argument));
+  }
+  return f;
+}
+
+void Simplifier::Unfold(core::Identifier variable,
+                        const core::Expression& value) {
+  if (!inlining_ || !std::holds_alternative<core::Lambda>(value->value)) return;
+  if (IsFusible(variable)) return;
+  unfoldings_.insert_or_assign(
+      variable, Unfolding{.value = value, .size = Size(value)});
+}
+
+bool Simplifier::ShouldInline(
+    const Unfolding& unfolding,
+    std::span<const core::Expression> arguments) const {
+  if (unfolding.size <= limits_.always) return true;
+  return unfolding.size <= limits_.interesting &&
+         std::ranges::any_of(arguments, [&](const core::Expression& argument) {
+           return IsInteresting(argument);
+         });
+}
+
+bool Simplifier::IsInteresting(const core::Expression& x) const {
+  if (std::holds_alternative<core::Lambda>(x->value)) return true;
+  if (std::optional<Shape> shape = ShapeOf(x)) {
+    return (shape->kind == Shape::Kind::kUnion ||
+            shape->kind == Shape::Kind::kTuple) &&
+           !shape->elements.empty();
+  }
+  // Functions, including partial applications of them.
+  std::vector<core::Expression> arguments;
+  const core::Expression& head = Spine(x, arguments);
+  if (std::holds_alternative<core::Builtin>(head->value)) return true;
+  const auto* id = std::get_if<core::Identifier>(&head->value);
+  return id && unfoldings_.contains(*id);
+}
+
+int Simplifier::ExtraArity(const core::Expression& x) {
+  if (const auto* lambda = std::get_if<core::Lambda>(&x->value)) {
+    return std::min(kUnbounded, 1 + ExtraArity(lambda->result));
+  }
+  // Pushing arguments into a case repeats the match, which is fine as long as
+  // the scrutinee is cheap.
+  if (const auto* c = std::get_if<core::Case>(&x->value)) {
+    if (!IsCheap(c->value)) return 0;
+    int result = kUnbounded;
+    for (const auto& alternative : c->alternatives) {
+      result = std::min(result, ExtraArity(alternative.value));
+    }
+    return result;
+  }
+  if (const auto* let = std::get_if<core::Let>(&x->value)) {
+    if (!IsCheap(let->binding.value)) return 0;
+    const int arity = ExtraArity(let->binding.value);
+    if (arity == 0) return ExtraArity(let->value);
+    arities_.emplace(let->binding.variable, arity);
+    const int result = ExtraArity(let->value);
+    arities_.erase(let->binding.variable);
+    return result;
+  }
+  std::vector<core::Expression> arguments;
+  const core::Expression& head = Spine(x, arguments);
+  const int n = arguments.size();
+  const auto* builtin = std::get_if<core::Builtin>(&head->value);
+  if (builtin && *builtin == core::Builtin::kError && n > 0) return kUnbounded;
+  if (!std::ranges::all_of(arguments, IsAtom)) return 0;
+  if (builtin) return std::max(0, Arity(*builtin) - n);
+  if (const auto* id = std::get_if<core::Identifier>(&head->value)) {
+    if (const auto i = arities_.find(*id); i != arities_.end()) {
+      return std::max(0, i->second - n);
+    }
+  }
+  return 0;
+}
+
+bool Simplifier::IsCheap(const core::Expression& x) {
+  if (IsAtom(x) || ExtraArity(x) > 0) return true;
+  // Arithmetic and comparisons don't allocate, so they are as cheap as it gets.
+  std::vector<core::Expression> arguments;
+  const core::Expression& head = Spine(x, arguments);
+  const auto* builtin = std::get_if<core::Builtin>(&head->value);
+  if (!builtin || Arity(*builtin) != std::ssize(arguments)) return false;
+  switch (*builtin) {
+    case core::Builtin::kConcat:
+    case core::Builtin::kError:
+    case core::Builtin::kReadInt:
+    case core::Builtin::kShowInt:
+      return false;
+    default:
+      return std::ranges::all_of(arguments, [&](const core::Expression& x) {
+        return IsCheap(x);
+      });
+  }
+}
+
+bool Simplifier::IsPartialApplication(const core::Expression& x) const {
+  std::vector<core::Expression> arguments;
+  const core::Expression& head = Spine(x, arguments);
+  if (arguments.empty() || !std::ranges::all_of(arguments, IsAtom)) {
+    return false;
+  }
+  const int n = arguments.size();
+  if (const auto* builtin = std::get_if<core::Builtin>(&head->value)) {
+    return n < Arity(*builtin);
+  }
+  const auto* id = std::get_if<core::Identifier>(&head->value);
+  const auto i = id ? arities_.find(*id) : arities_.end();
+  return i != arities_.end() && n < i->second;
+}
+
+// Gives a recursive function as many parameters as its body can take without
+// repeating work, so that a loop which returns a function on each iteration,
+// as foldl does when it is written with foldr, takes all of its arguments in
+// one go instead:
+//
+//   go xs = case xs of
+//     [] -> id
+//     (x : xs') -> let k = go xs' in \a -> k (f a x)
+//   =>
+//   go xs a = case xs of
+//     [] -> a
+//     (x : xs') -> go xs' (f a x)
+std::optional<core::Expression> Simplifier::EtaExpand(
+    core::Identifier f, const core::Expression& value) {
+  std::vector<core::Identifier> parameters;
+  const core::Expression* body = &value;
+  while (const auto* lambda = std::get_if<core::Lambda>(&(*body)->value)) {
+    parameters.push_back(lambda->parameter);
+    body = &lambda->result;
+  }
+  if (parameters.empty()) return std::nullopt;
+  const int n = parameters.size();
+  // Start by assuming that the recursive calls can take any number of extra
+  // arguments, and lower that until it is consistent.
+  int extra = kUnbounded;
+  while (true) {
+    arities_.insert_or_assign(f, n + extra);
+    const int actual = ExtraArity(*body);
+    if (actual >= extra) break;
+    extra = actual;
+  }
+  if (extra == 0 || extra == kUnbounded) {
+    arities_.insert_or_assign(f, n);
+    return std::nullopt;
+  }
+  std::vector<core::Identifier> extras;
+  core::Expression result = *body;
+  for (int i = 0; i < extra; i++) {
+    extras.push_back(Fresh());
+    result = core::Apply(std::move(result), extras.back());
+  }
+  for (int i = extra - 1; i >= 0; i--) {
+    result = core::Lambda(extras[i], std::move(result));
+  }
+  for (int i = n - 1; i >= 0; i--) {
+    result = core::Lambda(parameters[i], std::move(result));
+  }
+  return result;
+}
+
+// A recursive function which passes some of its arguments unchanged to every
+// recursive call is rewritten as a non-recursive wrapper around a local loop
+// which takes only the other arguments:
+//
+//   map f xs = ... map f xs' ...
+//   =>
+//   map f ys = go ys where go xs = ... go xs' ...
+//
+// The wrapper can then be inlined, which specialises the loop to the static
+// arguments at each call site.
+std::optional<core::Expression> Simplifier::StaticArgumentTransform(
+    core::Identifier f, const core::Expression& value) {
+  std::vector<core::Identifier> parameters;
+  const core::Expression* body = &value;
+  while (const auto* lambda = std::get_if<core::Lambda>(&(*body)->value)) {
+    parameters.push_back(lambda->parameter);
+    body = &lambda->result;
+  }
+  std::vector<bool> is_static(parameters.size(), true);
+  if (!FindStaticArguments(f, parameters, *body, is_static)) {
+    return std::nullopt;
+  }
+  const auto num_static = std::ranges::count(is_static, true);
+  if (num_static == 0 || num_static == std::ssize(parameters)) {
+    return std::nullopt;
+  }
+  const core::Identifier worker = Fresh();
+  core::Expression loop = DropStaticArguments(f, worker, is_static, *body);
+  core::Expression call = worker;
+  std::vector<core::Identifier> outer = parameters;
+  for (std::size_t i = 0; i < parameters.size(); i++) {
+    if (is_static[i]) continue;
+    outer[i] = Fresh();
+    call = core::Apply(std::move(call), outer[i]);
+  }
+  for (int i = parameters.size() - 1; i >= 0; i--) {
+    if (!is_static[i]) loop = core::Lambda(parameters[i], std::move(loop));
+  }
+  core::Expression result = core::LetRecursive(
+      {core::Binding(worker, std::move(loop))}, std::move(call));
+  for (int i = parameters.size() - 1; i >= 0; i--) {
+    result = core::Lambda(outer[i], std::move(result));
+  }
+  return result;
+}
+
+core::Expression Simplifier::SimplifyApply(core::Expression f,
+                                           core::Expression x) {
+  if (const auto* lambda = std::get_if<core::Lambda>(&f->value)) {
+    Changed(stats_.beta_reductions);
+    return SimplifyLet(lambda->parameter, std::move(x),
+                       [&] { return Simplify(lambda->result); });
+  }
+  // (let v = e in f) x -> let v = e in f x
+  if (const auto* let = std::get_if<core::Let>(&f->value)) {
+    changed_ = true;
+    return core::Let(let->binding, SimplifyApply(let->value, std::move(x)));
+  }
+  if (const auto* let = std::get_if<core::LetRecursive>(&f->value)) {
+    changed_ = true;
+    return core::LetRecursive(let->bindings,
+                              SimplifyApply(let->value, std::move(x)));
+  }
+  // (case e of p -> a) x  =>  case e of p -> a x
+  if (const auto* c = std::get_if<core::Case>(&f->value); c && IsAtom(x)) {
+    changed_ = true;
+    std::vector<core::Case::Alternative> alternatives;
+    for (const auto& alternative : c->alternatives) {
+      alternatives.push_back(core::Case::Alternative(
+          alternative.pattern, SimplifyApply(alternative.value, x)));
+    }
+    return core::Case(c->value, std::move(alternatives));
+  }
+  core::Expression result = core::Apply(std::move(f), std::move(x));
+  std::vector<core::Expression> arguments;
+  const core::Expression& head = Spine(result, arguments);
+  const auto* builtin = std::get_if<core::Builtin>(&head->value);
+  if (builtin && Arity(*builtin) == static_cast<int>(arguments.size())) {
+    if (std::optional<core::Expression> value = Fold(*builtin, arguments)) {
+      Changed(stats_.constants_folded);
+      return std::move(*value);
+    }
+  }
+  return result;
+}
+
+std::optional<core::Expression> Simplifier::Fold(
+    core::Builtin f, std::span<const core::Expression> arguments) {
+  const auto* a = std::get_if<core::Integer>(&arguments[0]->value);
+  const auto* c = std::get_if<core::Character>(&arguments[0]->value);
+  const core::Integer* b = nullptr;
+  const core::Character* d = nullptr;
+  if (arguments.size() == 2) {
+    b = std::get_if<core::Integer>(&arguments[1]->value);
+    d = std::get_if<core::Character>(&arguments[1]->value);
+  }
+  // Arithmetic wraps around, as it does at runtime, but without the undefined
+  // behaviour.
+  const auto wrap = [](std::uint64_t x) {
+    return core::Integer(static_cast<std::int64_t>(x));
+  };
+  const auto l = a ? static_cast<std::uint64_t>(a->value) : 0;
+  const auto r = b ? static_cast<std::uint64_t>(b->value) : 0;
+  switch (f) {
+    case core::Builtin::kAdd:
+      if (a && b) return wrap(l + r);
+      break;
+    case core::Builtin::kSubtract:
+      if (a && b) return wrap(l - r);
+      break;
+    case core::Builtin::kMultiply:
+      if (a && b) return wrap(l * r);
+      break;
+    case core::Builtin::kDivide:
+    case core::Builtin::kModulo:
+      // Division by zero is left to fail at runtime.
+      if (!a || !b || b->value == 0) break;
+      if (a->value == std::numeric_limits<std::int64_t>::min() &&
+          b->value == -1) {
+        break;
+      }
+      if (f == core::Builtin::kDivide) return core::Integer(a->value / b->value);
+      return core::Integer(a->value % b->value);
+    case core::Builtin::kBitwiseAnd:
+      if (a && b) return wrap(l & r);
+      break;
+    case core::Builtin::kBitwiseOr:
+      if (a && b) return wrap(l | r);
+      break;
+    case core::Builtin::kBitShift:
+      if (!a || !b || b->value <= -64 || b->value >= 64) break;
+      return core::Integer(b->value > 0 ? wrap(l << b->value).value
+                                        : a->value >> -b->value);
+    case core::Builtin::kLessThan:
+      if (a && b) return Bool(a->value < b->value);
+      if (c && d) return Bool(c->value < d->value);
+      break;
+    case core::Builtin::kEqual:
+      if (a && b) return Bool(a->value == b->value);
+      if (c && d) return Bool(c->value == d->value);
+      break;
+    case core::Builtin::kNot:
+      if (std::optional<bool> x = AsBool(arguments[0])) return Bool(!*x);
+      break;
+    case core::Builtin::kAnd:
+      if (std::optional<bool> x = AsBool(arguments[0])) {
+        return *x ? arguments[1] : Bool(false);
+      }
+      break;
+    case core::Builtin::kOr:
+      if (std::optional<bool> x = AsBool(arguments[0])) {
+        return *x ? Bool(true) : arguments[1];
+      }
+      break;
+    case core::Builtin::kOrd:
+      if (c) return core::Integer(c->value);
+      break;
+    case core::Builtin::kChr:
+      if (a && 0 <= a->value && a->value < 128) {
+        return core::Character(static_cast<char>(a->value));
+      }
+      break;
+    case core::Builtin::kConcat:
+      if (std::optional<Shape> shape = ShapeOf(arguments[0]);
+          shape && shape->kind == Shape::Kind::kUnion &&
+          shape->type_id == core::UnionType::Id::kList && shape->value == 1) {
+        return arguments[1];
+      }
+      break;
+    case core::Builtin::kShowInt:
+      if (a) {
+        const std::string text = std::to_string(a->value);
+        core::Expression result = core::UnionConstructor(list_type_, 1);
+        for (int i = text.size() - 1; i >= 0; i--) {
+          result = core::Apply(core::Apply(core::UnionConstructor(list_type_, 0),
+                                           core::Character(text[i])),
+                               std::move(result));
+        }
+        return result;
+      }
+      break;
+    case core::Builtin::kError:
+    case core::Builtin::kReadInt:
+      break;
+  }
+  return std::nullopt;
+}
+
+core::Expression Simplifier::Simplify(const core::Lambda& x) {
+  core::Expression result = Simplify(x.result);
+  if (!inlining_) return core::Lambda(x.parameter, std::move(result));
+  // \x -> letrec fs in e  =>  letrec fs in \x -> e, when the fs are functions
+  // which don't depend on x, so that they are allocated once instead of on
+  // every call. Loops which come from inlining often end up like this.
+  if (const auto* let = std::get_if<core::LetRecursive>(&result->value);
+      let && AllFunctions(let->bindings) &&
+      !AnyUses(let->bindings, x.parameter)) {
+    changed_ = true;
+    return core::LetRecursive(let->bindings,
+                              core::Lambda(x.parameter, let->value));
+  }
+  if (const auto* let = std::get_if<core::Let>(&result->value);
+      let && AllFunctions({&let->binding, 1}) &&
+      !AnyUses({&let->binding, 1}, x.parameter)) {
+    changed_ = true;
+    return core::Let(let->binding, core::Lambda(x.parameter, let->value));
+  }
+  return core::Lambda(x.parameter, std::move(result));
+}
+
+core::Expression Simplifier::Simplify(const core::Let& x) {
+  return SimplifyLet(x.binding.variable, Simplify(x.binding.value),
+                     [&] { return Simplify(x.value); });
+}
+
+core::Expression Simplifier::SimplifyLet(
+    core::Identifier variable, core::Expression value,
+    const std::function<core::Expression()>& body) {
+  const auto i = occurrences_.find(variable);
+  // Variables which only appear in copies made during this pass have no
+  // entry, and so are left alone until the next pass.
+  const bool counted = binder_depth_.contains(variable);
+  const Occurrences occurrences =
+      i == occurrences_.end() ? Occurrences() : i->second;
+  if (counted && occurrences.count == 0) {
+    Changed(stats_.dead_bindings);
+    return body();
+  }
+  // let x = (letrec fs in e) in b  =>  letrec fs in let x = e in b, when the fs
+  // are functions, which exposes e to the rules below.
+  if (const auto* let = std::get_if<core::LetRecursive>(&value->value);
+      inlining_ && let && AllFunctions(let->bindings)) {
+    changed_ = true;
+    for (const auto& binding : let->bindings) {
+      arities_.insert_or_assign(binding.variable, NumParameters(binding.value));
+    }
+    return core::LetRecursive(let->bindings,
+                              SimplifyLet(variable, let->value, body));
+  }
+  if (const auto* let = std::get_if<core::Let>(&value->value);
+      inlining_ && let && AllFunctions({&let->binding, 1})) {
+    changed_ = true;
+    return core::Let(let->binding, SimplifyLet(variable, let->value, body));
+  }
+  // Inlining a binding which is used once only duplicates work if the use can
+  // be evaluated many times, which a lambda never minds. The functions which
+  // are being fused are left alone so that their uses can still be recognised.
+  const bool used_once =
+      counted && occurrences.count == 1 && !IsFusible(variable) &&
+      (!occurrences.under_lambda ||
+       std::holds_alternative<core::Lambda>(value->value));
+  // A partial application of atoms is as good as an atom, as long as the
+  // inliner is around to make use of it.
+  const bool trivial = IsAtom(value) || (inlining_ && IsPartialApplication(value));
+  if (trivial || used_once) {
+    Changed(stats_.inlined_bindings);
+    substitution_.emplace(variable, Substitution{.value = std::move(value)});
+    return body();
+  }
+  if (std::optional<Shape> shape = ShapeOf(value);
+      shape && std::ranges::all_of(shape->elements, IsAtom)) {
+    known_.emplace(variable, value);
+  }
+  if (const int arity = NumParameters(value); arity > 0) {
+    arities_.insert_or_assign(variable, arity);
+  }
+  Unfold(variable, value);
+  return core::Let(core::Binding(variable, std::move(value)), body());
+}
+
+core::Expression Simplifier::Simplify(const core::LetRecursive& x) {
+  // Split the bindings into strongly connected components, so that bindings
+  // which aren't really recursive become plain lets, and drop the ones which
+  // the body can't reach.
+  const int n = x.bindings.size();
+  std::map<core::Identifier, int> index;
+  for (int i = 0; i < n; i++) index.emplace(x.bindings[i].variable, i);
+  std::vector<std::vector<int>> edges(n);
+  std::vector<bool> recursive(n);
+  for (int i = 0; i < n; i++) {
+    std::set<core::Identifier> uses;
+    CollectIdentifiers(x.bindings[i].value, uses);
+    for (core::Identifier id : uses) {
+      const auto j = index.find(id);
+      if (j == index.end()) continue;
+      edges[i].push_back(j->second);
+      if (j->second == i) recursive[i] = true;
+    }
+  }
+  std::vector<bool> reachable(n);
+  std::vector<int> pending;
+  std::set<core::Identifier> roots;
+  CollectIdentifiers(x.value, roots);
+  for (core::Identifier id : roots) {
+    if (const auto i = index.find(id); i != index.end()) {
+      pending.push_back(i->second);
+    }
+  }
+  while (!pending.empty()) {
+    const int i = pending.back();
+    pending.pop_back();
+    if (reachable[i]) continue;
+    reachable[i] = true;
+    for (int j : edges[i]) pending.push_back(j);
+  }
+  const std::vector<std::vector<int>> components = Components(edges, reachable);
+  const int num_dead = std::ranges::count(reachable, false);
+  if (num_dead > 0) {
+    stats_.dead_bindings += num_dead;
+    changed_ = true;
+  }
+  const bool unchanged =
+      num_dead == 0 && components.size() == 1 &&
+      (components[0].size() > 1 || recursive[components[0][0]]);
+  if (!unchanged) changed_ = true;
+  std::function<core::Expression(std::size_t)> build = [&](std::size_t k) {
+    if (k == components.size()) return Simplify(x.value);
+    const std::vector<int>& component = components[k];
+    for (int i : component) {
+      if (const int arity = NumParameters(x.bindings[i].value); arity > 0) {
+        arities_.insert_or_assign(x.bindings[i].variable, arity);
+      }
+    }
+    if (component.size() == 1 && !recursive[component[0]]) {
+      const core::Binding& binding = x.bindings[component[0]];
+      return SimplifyLet(binding.variable, Simplify(binding.value),
+                         [&] { return build(k + 1); });
+    }
+    if (inlining_ && component.size() == 1) {
+      const core::Binding& binding = x.bindings[component[0]];
+      if (std::optional<core::Expression> wrapper =
+              StaticArgumentTransform(binding.variable, binding.value)) {
+        Changed(stats_.static_arguments);
+        return SimplifyLet(binding.variable, Simplify(*wrapper),
+                           [&] { return build(k + 1); });
+      }
+      if (std::optional<core::Expression> expanded =
+              EtaExpand(binding.variable, binding.value)) {
+        Changed(stats_.eta_expansions);
+        core::Expression value = Simplify(*expanded);
+        return core::Expression(core::LetRecursive(
+            {core::Binding(binding.variable, std::move(value))},
+            build(k + 1)));
+      }
+    }
+    // Only the loop breakers are left out of the inlining, and the other
+    // bindings are simplified first so that they can be inlined into them.
+    std::vector<int> order, breakers;
+    if (inlining_) {
+      std::vector<int> sizes(n);
+      for (int i : component) sizes[i] = Size(x.bindings[i].value);
+      ChooseLoopBreakers(edges, sizes, component, order, breakers);
+    } else {
+      breakers = component;
+    }
+    std::vector<core::Binding> bindings;
+    const auto add = [&](core::Identifier variable, core::Expression value) {
+      // letrec f = (letrec gs in e) in ...  =>  letrec f = e; gs in ..., when
+      // the gs are functions.
+      while (const auto* let = std::get_if<core::LetRecursive>(&value->value)) {
+        if (!inlining_ || !AllFunctions(let->bindings)) break;
+        changed_ = true;
+        bindings.insert(bindings.end(), let->bindings.begin(),
+                        let->bindings.end());
+        value = core::Expression(let->value);
+      }
+      bindings.push_back(core::Binding(variable, std::move(value)));
+    };
+    for (int i : order) {
+      core::Expression value = Simplify(x.bindings[i].value);
+      Unfold(x.bindings[i].variable, value);
+      add(x.bindings[i].variable, std::move(value));
+    }
+    for (int i : breakers) {
+      add(x.bindings[i].variable, Simplify(x.bindings[i].value));
+    }
+    return core::Expression(
+        core::LetRecursive(std::move(bindings), build(k + 1)));
+  };
+  return build(0);
+}
+
+core::Expression Simplifier::Simplify(const core::Case& x) {
+  return SimplifyCase(Simplify(x.value), x.alternatives);
+}
+
+core::Expression Simplifier::SimplifyCase(
+    core::Expression value,
+    const std::vector<core::Case::Alternative>& alternatives) {
+  // Case of known constructor.
+  std::optional<Shape> shape = ShapeOf(value);
+  if (const auto* id = std::get_if<core::Identifier>(&value->value)) {
+    if (const auto i = known_.find(*id); i != known_.end()) {
+      shape = ShapeOf(i->second);
+    }
+  }
+  if (shape) {
+    for (const auto& alternative : alternatives) {
+      const Match match = Matches(*shape, alternative.pattern);
+      if (match == Match::kNo) continue;
+      if (match == Match::kUnknown) break;
+      Changed(stats_.known_cases);
+      return SimplifyMatch(alternative.pattern, value, shape->elements,
+                           alternative.value);
+    }
+  }
+  // case not x of True -> a; False -> b  =>  case x of True -> b; False -> a
+  if (const auto* apply = std::get_if<core::Apply>(&value->value)) {
+    const auto* f = std::get_if<core::Builtin>(&apply->f->value);
+    const bool all_bool = std::ranges::all_of(
+        alternatives, [](const core::Case::Alternative& alternative) {
+          const auto* u = std::get_if<core::MatchUnion>(&alternative.pattern->value);
+          return u && u->type->id == core::UnionType::Id::kBool;
+        });
+    if (f && *f == core::Builtin::kNot && all_bool) {
+      Changed(stats_.case_of_cases);
+      std::vector<core::Case::Alternative> flipped;
+      for (const auto& alternative : alternatives) {
+        const auto& u = std::get<core::MatchUnion>(alternative.pattern->value);
+        flipped.push_back(core::Case::Alternative(
+            core::MatchUnion(u.type, 1 - u.index, {}), alternative.value));
+      }
+      return SimplifyCase(apply->x, flipped);
+    }
+  }
+  // case (let v = e in x) of ...  =>  let v = e in case x of ...
+  if (const auto* let = std::get_if<core::Let>(&value->value)) {
+    changed_ = true;
+    return core::Let(let->binding, SimplifyCase(let->value, alternatives));
+  }
+  if (const auto* let = std::get_if<core::LetRecursive>(&value->value)) {
+    changed_ = true;
+    return core::LetRecursive(let->bindings,
+                              SimplifyCase(let->value, alternatives));
+  }
+  // Case of case, when all but at most one of the copies of the outer case
+  // will immediately be resolved by case of known constructor.
+  if (const auto* inner = std::get_if<core::Case>(&value->value)) {
+    int num_unknown = 0;
+    for (const auto& alternative : inner->alternatives) {
+      if (!ShapeOf(alternative.value)) num_unknown++;
+    }
+    int size = 0;
+    for (const auto& alternative : alternatives) {
+      size += Size(alternative.value);
+    }
+    const int num_known = inner->alternatives.size() - num_unknown;
+    if (num_unknown <= 1 && num_known * size <= kCaseOfCaseLimit) {
+      Changed(stats_.case_of_cases);
+      std::vector<core::Case::Alternative> result;
+      bool first = true;
+      for (const auto& alternative : inner->alternatives) {
+        std::vector<core::Case::Alternative> outer;
+        for (const auto& x : alternatives) {
+          if (first) {
+            outer.push_back(x);
+          } else {
+            std::map<core::Identifier, core::Identifier> names;
+            core::Pattern pattern = Clone(x.pattern, names);
+            outer.push_back(core::Case::Alternative(std::move(pattern),
+                                                    Clone(x.value, names)));
+          }
+        }
+        first = false;
+        result.push_back(core::Case::Alternative(
+            alternative.pattern, SimplifyCase(alternative.value, outer)));
+      }
+      return core::Case(inner->value, std::move(result));
+    }
+  }
+  // Otherwise, simplify each alternative knowing that the scrutinee matched
+  // its pattern.
+  const auto* id = std::get_if<core::Identifier>(&value->value);
+  std::vector<core::Case::Alternative> result;
+  for (const auto& alternative : alternatives) {
+    std::optional<core::Expression> previous;
+    std::optional<core::Expression> known = PatternValue(alternative.pattern);
+    if (id && known) {
+      if (auto i = known_.find(*id); i != known_.end()) previous = i->second;
+      known_.insert_or_assign(*id, std::move(*known));
+    }
+    result.push_back(
+        core::Case::Alternative(alternative.pattern, Simplify(alternative.value)));
+    if (id && known) {
+      if (previous) {
+        known_.insert_or_assign(*id, std::move(*previous));
+      } else {
+        known_.erase(*id);
+      }
+    }
+    // Nothing after an irrefutable pattern can be reached.
+    if (std::holds_alternative<core::Identifier>(alternative.pattern->value)) {
+      if (&alternative != &alternatives.back()) changed_ = true;
+      break;
+    }
+  }
+  return core::Case(std::move(value), std::move(result));
+}
+
+core::Expression Simplifier::SimplifyMatch(
+    const core::Pattern& pattern, const core::Expression& value,
+    std::span<const core::Expression> elements, const core::Expression& body) {
+  if (const auto* id = std::get_if<core::Identifier>(&pattern->value)) {
+    return SimplifyLet(*id, value, [&] { return Simplify(body); });
+  }
+  const std::vector<core::Identifier> binders = Binders(pattern);
+  std::function<core::Expression(std::size_t)> bind = [&](std::size_t i) {
+    if (i == binders.size()) return Simplify(body);
+    return SimplifyLet(binders[i], elements[i], [&] { return bind(i + 1); });
+  };
+  return bind(0);
+}
+
+core::Pattern Simplifier::Clone(
+    const core::Pattern& x, std::map<core::Identifier, core::Identifier>& names) {
+  const auto rename = [&](const std::vector<core::Identifier>& ids) {
+    std::vector<core::Identifier> result;
+    for (core::Identifier id : ids) {
+      result.push_back(names[id] = Fresh());
+    }
+    return result;
+  };
+  return std::visit(
+      [&](const auto& x) -> core::Pattern {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, core::Identifier>) {
+          return names[x] = Fresh();
+        } else if constexpr (std::is_same_v<T, core::MatchTuple>) {
+          return core::MatchTuple(rename(x.elements));
+        } else if constexpr (std::is_same_v<T, core::MatchUnion>) {
+          return core::MatchUnion(x.type, x.index, rename(x.elements));
+        } else {
+          return x;
+        }
+      },
+      x->value);
+}
+
+core::Expression Simplifier::Clone(
+    const core::Expression& x,
+    std::map<core::Identifier, core::Identifier>& names) {
+  return std::visit(
+      [&](const auto& x) -> core::Expression {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, core::Identifier>) {
+          const auto i = names.find(x);
+          return i == names.end() ? x : i->second;
+        } else if constexpr (std::is_same_v<T, core::Tuple>) {
+          std::vector<core::Expression> elements;
+          for (const auto& element : x.elements) {
+            elements.push_back(Clone(element, names));
+          }
+          return core::Tuple(std::move(elements));
+        } else if constexpr (std::is_same_v<T, core::Apply>) {
+          core::Expression f = Clone(x.f, names);
+          return core::Apply(std::move(f), Clone(x.x, names));
+        } else if constexpr (std::is_same_v<T, core::Lambda>) {
+          const core::Identifier parameter = names[x.parameter] = Fresh();
+          return core::Lambda(parameter, Clone(x.result, names));
+        } else if constexpr (std::is_same_v<T, core::Let>) {
+          core::Expression value = Clone(x.binding.value, names);
+          const core::Identifier variable = names[x.binding.variable] = Fresh();
+          return core::Let(core::Binding(variable, std::move(value)),
+                           Clone(x.value, names));
+        } else if constexpr (std::is_same_v<T, core::LetRecursive>) {
+          for (const auto& binding : x.bindings) {
+            names[binding.variable] = Fresh();
+          }
+          std::vector<core::Binding> bindings;
+          for (const auto& binding : x.bindings) {
+            bindings.push_back(core::Binding(names.at(binding.variable),
+                                             Clone(binding.value, names)));
+          }
+          return core::LetRecursive(std::move(bindings), Clone(x.value, names));
+        } else if constexpr (std::is_same_v<T, core::Case>) {
+          core::Expression value = Clone(x.value, names);
+          std::vector<core::Case::Alternative> alternatives;
+          for (const auto& alternative : x.alternatives) {
+            core::Pattern pattern = Clone(alternative.pattern, names);
+            alternatives.push_back(core::Case::Alternative(
+                std::move(pattern), Clone(alternative.value, names)));
+          }
+          return core::Case(std::move(value), std::move(alternatives));
+        } else {
+          return x;
+        }
+      },
+      x->value);
+}
+
+core::Expression Simplifier::Simplify(const core::Expression& x) {
+  return std::visit([&](const auto& x) { return Simplify(x); }, x->value);
+}
+
+// Lambda lifting is limited to functions with at most this many free
+// variables, since each one becomes an argument to pass at every call.
+constexpr int kMaxLiftedParameters = 4;
+
+// Moves local functions to the top level of the program, with their free
+// variables as extra leading parameters, so that the closure for each one is
+// allocated once instead of every time that its definition is evaluated. This
+// happens after simplification, since lifted functions can't be inlined.
+class LambdaLifter {
+ public:
+  LambdaLifter(SimplifierStats& stats, int next_id)
+      : stats_(stats), next_id_(next_id) {}
+
+  core::Expression Run(const core::Expression& program);
+
+ private:
+  struct Lifted {
+    core::Identifier name;
+    std::vector<core::Identifier> parameters;
+  };
+
+  core::Expression Lift(const core::Expression& x);
+  core::Expression Lift(const core::Apply& x);
+  core::Expression Lift(const core::Lambda& x);
+  core::Expression Lift(const core::Let& x);
+  core::Expression Lift(const core::LetRecursive& x);
+  core::Expression Lift(const core::Case& x);
+
+  // Lifts the functions in `group`, whose scope is the group itself and
+  // `body`, if that is worthwhile: every use of them must be a saturated
+  // call, so that no partial application is allocated in place of the
+  // closure, and they mustn't capture any local function, whose calls would
+  // no longer be known.
+  bool TryLift(const std::vector<core::Binding>& group,
+               const core::Expression& body);
+  // Replaces calls to lifted functions in `x` with calls which pass the free
+  // variables as well.
+  core::Expression ReplaceCalls(const core::Expression& x);
+  core::Expression Call(const Lifted& f,
+                        std::span<const core::Expression> arguments);
+  // Adds the lifted functions to the top level around `body`.
+  core::Expression Bind(std::vector<std::vector<core::Binding>> groups,
+                        core::Expression body);
+
+  core::Identifier Fresh() { return core::Identifier(next_id_++); }
+
+  SimplifierStats& stats_;
+  int next_id_;
+  // The number of lambdas around the current expression.
+  int depth_ = 0;
+  // Variables in scope which aren't bound at the top level.
+  std::set<core::Identifier> locals_;
+  // Local functions which haven't been lifted.
+  std::set<core::Identifier> functions_;
+  std::map<core::Identifier, Lifted> lifted_;
+  // Groups of lifted functions which haven't been added to the program yet,
+  // each one after any which it depends on.
+  std::vector<std::vector<core::Binding>> groups_;
+};
+
+// Whether every use of the functions in `arities` within `x` is a call with at
+// least as many arguments as the function has parameters.
+bool OnlyCalled(const std::map<core::Identifier, int>& arities,
+                const core::Expression& x) {
+  std::vector<core::Expression> arguments;
+  const core::Expression& head = Spine(x, arguments);
+  if (const auto* id = std::get_if<core::Identifier>(&head->value)) {
+    const auto i = arities.find(*id);
+    if (i != arities.end() && (int)arguments.size() < i->second) return false;
+    return std::ranges::all_of(arguments, [&](const core::Expression& x) {
+      return OnlyCalled(arities, x);
+    });
+  }
+  bool result = true;
+  ForEachChild(x, [&](const core::Expression& child) {
+    result = result && OnlyCalled(arities, child);
+  });
+  return result;
+}
+
+core::Expression Rename(
+    const core::Expression& x,
+    const std::map<core::Identifier, core::Identifier>& names) {
+  if (const auto* id = std::get_if<core::Identifier>(&x->value)) {
+    const auto i = names.find(*id);
+    return i == names.end() ? x : core::Expression(i->second);
+  }
+  return MapChildren(
+      x, [&](const core::Expression& child) { return Rename(child, names); });
+}
+
+core::Expression LambdaLifter::Run(const core::Expression& program) {
+  // The top level is the chain of lets around the body of the program.
+  if (const auto* let = std::get_if<core::Let>(&program->value)) {
+    core::Expression value = Lift(let->binding.value);
+    std::vector<std::vector<core::Binding>> groups = std::move(groups_);
+    groups_.clear();
+    core::Binding binding(let->binding.variable, std::move(value));
+    return Bind(std::move(groups),
+                core::Let(std::move(binding), Run(let->value)));
+  }
+  if (const auto* let = std::get_if<core::LetRecursive>(&program->value)) {
+    // Functions lifted out of a recursive group may refer to the group.
+    std::vector<core::Binding> bindings;
+    for (const auto& binding : let->bindings) {
+      bindings.push_back(
+          core::Binding(binding.variable, Lift(binding.value)));
+    }
+    for (auto& group : groups_) {
+      bindings.insert(bindings.end(), group.begin(), group.end());
+    }
+    groups_.clear();
+    return core::LetRecursive(std::move(bindings), Run(let->value));
+  }
+  core::Expression body = Lift(program);
+  std::vector<std::vector<core::Binding>> groups = std::move(groups_);
+  groups_.clear();
+  return Bind(std::move(groups), std::move(body));
+}
+
+core::Expression LambdaLifter::Lift(const core::Expression& x) {
+  return std::visit(
+      [&](const auto& value) -> core::Expression {
+        using T = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same_v<T, core::Apply> ||
+                      std::is_same_v<T, core::Lambda> ||
+                      std::is_same_v<T, core::Let> ||
+                      std::is_same_v<T, core::LetRecursive> ||
+                      std::is_same_v<T, core::Case>) {
+          return Lift(value);
+        } else {
+          return MapChildren(
+              x, [&](const core::Expression& child) { return Lift(child); });
+        }
+      },
+      x->value);
+}
+
+core::Expression LambdaLifter::Lift(const core::Apply& x) {
+  std::vector<core::Expression> arguments = {x.x};
+  const core::Expression* head = &x.f;
+  while (const auto* apply = std::get_if<core::Apply>(&(*head)->value)) {
+    arguments.push_back(apply->x);
+    head = &apply->f;
+  }
+  std::ranges::reverse(arguments);
+  for (auto& argument : arguments) argument = Lift(argument);
+  if (const auto* id = std::get_if<core::Identifier>(&(*head)->value)) {
+    if (const auto i = lifted_.find(*id); i != lifted_.end()) {
+      return Call(i->second, arguments);
+    }
+  }
+  core::Expression result = Lift(*head);
+  for (auto& argument : arguments) {
+    result = core::Apply(std::move(result), std::move(argument));
+  }
+  return result;
+}
+
+core::Expression LambdaLifter::Lift(const core::Lambda& x) {
+  locals_.insert(x.parameter);
+  depth_++;
+  core::Expression result = Lift(x.result);
+  depth_--;
+  locals_.erase(x.parameter);
+  return core::Lambda(x.parameter, std::move(result));
+}
+
+core::Expression LambdaLifter::Lift(const core::Let& x) {
+  const core::Identifier f = x.binding.variable;
+  const std::vector<core::Binding> group = {
+      core::Binding(f, Lift(x.binding.value))};
+  if (TryLift(group, x.value)) return Lift(x.value);
+  locals_.insert(f);
+  if (NumParameters(group[0].value) > 0) functions_.insert(f);
+  core::Expression value = Lift(x.value);
+  functions_.erase(f);
+  locals_.erase(f);
+  return core::Let(group[0], std::move(value));
+}
+
+core::Expression LambdaLifter::Lift(const core::LetRecursive& x) {
+  // Functions nested inside the group which refer to it aren't lifted before
+  // the group itself, since it is treated as a local function until then.
+  for (const auto& binding : x.bindings) {
+    locals_.insert(binding.variable);
+    if (NumParameters(binding.value) > 0) functions_.insert(binding.variable);
+  }
+  std::vector<core::Binding> group;
+  for (const auto& binding : x.bindings) {
+    group.push_back(core::Binding(binding.variable, Lift(binding.value)));
+  }
+  const bool lifted = TryLift(group, x.value);
+  if (lifted) {
+    for (const auto& binding : x.bindings) {
+      functions_.erase(binding.variable);
+      locals_.erase(binding.variable);
+    }
+  }
+  core::Expression value = Lift(x.value);
+  if (lifted) return value;
+  for (const auto& binding : x.bindings) {
+    functions_.erase(binding.variable);
+    locals_.erase(binding.variable);
+  }
+  return core::LetRecursive(std::move(group), std::move(value));
+}
+
+core::Expression LambdaLifter::Lift(const core::Case& x) {
+  core::Expression value = Lift(x.value);
+  std::vector<core::Case::Alternative> alternatives;
+  for (const auto& alternative : x.alternatives) {
+    const std::vector<core::Identifier> binders = Binders(alternative.pattern);
+    locals_.insert(binders.begin(), binders.end());
+    alternatives.push_back(
+        core::Case::Alternative(alternative.pattern, Lift(alternative.value)));
+    for (core::Identifier id : binders) locals_.erase(id);
+  }
+  return core::Case(std::move(value), std::move(alternatives));
+}
+
+bool LambdaLifter::TryLift(const std::vector<core::Binding>& group,
+                           const core::Expression& body) {
+  // A function which isn't inside another one is only allocated once anyway.
+  if (depth_ == 0 || !AllFunctions(group)) return false;
+  std::map<core::Identifier, int> arities;
+  for (const auto& binding : group) {
+    arities.emplace(binding.variable, NumParameters(binding.value));
+  }
+  if (!OnlyCalled(arities, body)) return false;
+  std::set<core::Identifier> uses;
+  for (const auto& binding : group) {
+    if (!OnlyCalled(arities, binding.value)) return false;
+    CollectIdentifiers(binding.value, uses);
+  }
+  std::vector<core::Identifier> parameters;
+  for (core::Identifier id : uses) {
+    if (!locals_.contains(id) || arities.contains(id)) continue;
+    if (functions_.contains(id)) return false;
+    parameters.push_back(id);
+  }
+  if (std::ssize(parameters) > kMaxLiftedParameters) return false;
+  for (const auto& binding : group) {
+    lifted_.emplace(binding.variable, Lifted{Fresh(), parameters});
+  }
+  std::vector<core::Binding> bindings;
+  for (const auto& binding : group) {
+    // Each copy of the free variables is given fresh names to keep every
+    // identifier unique.
+    std::map<core::Identifier, core::Identifier> names;
+    for (core::Identifier id : parameters) names.emplace(id, Fresh());
+    core::Expression value = Rename(ReplaceCalls(binding.value), names);
+    for (auto i = parameters.rbegin(); i != parameters.rend(); i++) {
+      value = core::Lambda(names.at(*i), std::move(value));
+    }
+    bindings.push_back(
+        core::Binding(lifted_.at(binding.variable).name, std::move(value)));
+    stats_.lambdas_lifted++;
+  }
+  groups_.push_back(std::move(bindings));
+  return true;
+}
+
+core::Expression LambdaLifter::ReplaceCalls(const core::Expression& x) {
+  std::vector<core::Expression> arguments;
+  const core::Expression& head = Spine(x, arguments);
+  if (const auto* id = std::get_if<core::Identifier>(&head->value)) {
+    if (const auto i = lifted_.find(*id); i != lifted_.end()) {
+      for (auto& argument : arguments) argument = ReplaceCalls(argument);
+      return Call(i->second, arguments);
+    }
+  }
+  return MapChildren(
+      x, [&](const core::Expression& child) { return ReplaceCalls(child); });
+}
+
+core::Expression LambdaLifter::Call(
+    const Lifted& f, std::span<const core::Expression> arguments) {
+  core::Expression result = f.name;
+  for (core::Identifier parameter : f.parameters) {
+    result = core::Apply(std::move(result), parameter);
+  }
+  for (const auto& argument : arguments) {
+    result = core::Apply(std::move(result), argument);
+  }
+  return result;
+}
+
+core::Expression LambdaLifter::Bind(
+    std::vector<std::vector<core::Binding>> groups, core::Expression body) {
+  for (auto group = groups.rbegin(); group != groups.rend(); group++) {
+    if (group->size() == 1 && !AnyUses(*group, (*group)[0].variable)) {
+      body = core::Let(std::move((*group)[0]), std::move(body));
+    } else {
+      body = core::LetRecursive(std::move(*group), std::move(body));
+    }
+  }
+  return body;
+}
+
+}  // namespace
+
+std::ostream& operator<<(std::ostream& output, const SimplifierStats& stats) {
+  return output << "simplifier: " << stats.size_before << " -> "
+                << stats.size_after << " nodes in " << stats.passes
+                << " passes: " << stats.beta_reductions << " beta reductions, "
+                << stats.inlined_bindings << " bindings inlined, "
+                << stats.known_cases << " known cases, " << stats.case_of_cases
+                << " cases of cases, " << stats.constants_folded
+                << " constants folded, " << stats.dead_bindings
+                << " dead bindings, " << stats.functions_inlined
+                << " functions inlined, " << stats.static_arguments
+                << " static argument transformations, " << stats.eta_expansions
+                << " eta expansions, " << stats.lists_fused << " lists fused, "
+                << stats.lambdas_lifted << " lambdas lifted";
+}
+
+core::Expression Simplify(const core::Expression& program,
+                          const SimplifierOptions& options,
+                          SimplifierStats& stats) {
+  if (options.level < 0 || options.level > kMaxOptimizationLevel) {
+    throw std::logic_error("bad optimization level");
+  }
+  stats.size_before = Size(program);
+  core::Expression result = program;
+  if (options.level == 0) {
+    stats.size_after = stats.size_before;
+    return result;
+  }
+  int next_id = MaxIdentifier(program) + 1;
+  const auto run = [&](bool fusing) {
+    while (true) {
+      Simplifier simplifier(stats, next_id, options, fusing);
+      result = simplifier.Run(result);
+      next_id = simplifier.next_id();
+      stats.passes++;
+      if (!simplifier.changed()) break;
+    }
+  };
+  // Fusion needs foldr and build to be left intact until every pair of them
+  // which will meet has done so, so they are only inlined afterwards.
+  if (options.level >= 2 && options.foldr && options.build) run(true);
+  run(false);
+  if (options.level >= 2) result = LambdaLifter(stats, next_id).Run(result);
+  stats.size_after = Size(result);
+  return result;
+}
+
+}  // namespace aoc2022
@@ -0,0 +1,55 @@
+#ifndef AOC2022_SIMPLIFIER_HPP_
+#define AOC2022_SIMPLIFIER_HPP_
+
+#include "core.hpp"
+
+#include <iosfwd>
+#include <optional>
+
+namespace aoc2022 {
+
+// Counts of what the simplifier did to a program. The sizes are numbers of
+// expression nodes, and every other count is a reduction which would otherwise
+// have happened at runtime (or, for dead bindings, a thunk which would have
+// been allocated for nothing).
+struct SimplifierStats {
+  int size_before = 0;
+  int size_after = 0;
+  int passes = 0;
+  int beta_reductions = 0;
+  int inlined_bindings = 0;
+  int known_cases = 0;
+  int case_of_cases = 0;
+  int constants_folded = 0;
+  int dead_bindings = 0;
+  int functions_inlined = 0;
+  int static_arguments = 0;
+  int eta_expansions = 0;
+  int lists_fused = 0;
+  int lambdas_lifted = 0;
+};
+
+std::ostream& operator<<(std::ostream&, const SimplifierStats&);
+
+inline constexpr int kMaxOptimizationLevel = 3;
+
+struct SimplifierOptions {
+  // Level 0 leaves the program alone, level 1 only simplifies it, and levels 2
+  // and up also inline functions, with larger functions being inlined at
+  // higher levels, and lift local functions to the top level afterwards.
+  int level = 2;
+  // The prelude's `foldr` and `build`. If both are given (and the level allows
+  // inlining), `foldr f e (build g)` is rewritten to `g f e` before either of
+  // them is inlined, which removes the list in between.
+  std::optional<core::Identifier> foldr, build;
+};
+
+// Rewrites `program` into an equivalent program which does less work, by
+// repeatedly applying local simplifications until none of them apply.
+core::Expression Simplify(const core::Expression& program,
+                          const SimplifierOptions& options,
+                          SimplifierStats& stats);
+
+}  // namespace aoc2022
+
+#endif  // AOC2022_SIMPLIFIER_HPP_
@@ -0,0 +1,576 @@
+#include "types.hpp"
+
+#include <algorithm>
+#include <set>
+#include <span>
+#include <sstream>
+#include <vector>
+
+namespace aoc2022 {
+namespace {
+
+core::Type Variable(int id) {
+  return core::Type{.kind = core::Type::Kind::kVariable, .id = id};
+}
+
+// The i'th parameter of a polymorphic type.
+core::Type Parameter(int i) { return Variable(-1 - i); }
+
+core::Type Int() { return core::Type{.kind = core::Type::Kind::kInt}; }
+core::Type Char() { return core::Type{.kind = core::Type::Kind::kChar}; }
+
+core::Type Function(core::Type parameter, core::Type result) {
+  return core::Type{.kind = core::Type::Kind::kFunction,
+                    .arguments = {std::move(parameter), std::move(result)}};
+}
+
+core::Type Tuple(std::vector<core::Type> elements) {
+  return core::Type{.kind = core::Type::Kind::kTuple,
+                    .arguments = std::move(elements)};
+}
+
+core::Type Union(core::UnionType::Id id, std::vector<core::Type> arguments) {
+  return core::Type{.kind = core::Type::Kind::kUnion,
+                    .id = (int)id,
+                    .arguments = std::move(arguments)};
+}
+
+core::Type Bool() { return Union(core::UnionType::Id::kBool, {}); }
+core::Type List(core::Type element) {
+  return Union(core::UnionType::Id::kList, {std::move(element)});
+}
+core::Type String() { return List(Char()); }
+
+// A type which may be polymorphic in its first `num_parameters` parameters.
+struct Scheme {
+  core::Type type;
+  int num_parameters = 0;
+};
+
+Scheme BuiltinScheme(core::Builtin builtin) {
+  const core::Type a = Parameter(0);
+  switch (builtin) {
+    case core::Builtin::kAdd:
+    case core::Builtin::kBitShift:
+    case core::Builtin::kBitwiseAnd:
+    case core::Builtin::kBitwiseOr:
+    case core::Builtin::kDivide:
+    case core::Builtin::kModulo:
+    case core::Builtin::kMultiply:
+    case core::Builtin::kSubtract:
+      return {Function(Int(), Function(Int(), Int()))};
+    case core::Builtin::kAnd:
+    case core::Builtin::kOr:
+      return {Function(Bool(), Function(Bool(), Bool()))};
+    case core::Builtin::kChr:
+      return {Function(Int(), Char())};
+    case core::Builtin::kConcat:
+      return {Function(List(a), Function(List(a), List(a))), 1};
+    case core::Builtin::kError:
+      return {Function(String(), a), 1};
+    case core::Builtin::kEqual:
+    case core::Builtin::kLessThan:
+      return {Function(a, Function(a, Bool())), 1};
+    case core::Builtin::kNot:
+      return {Function(Bool(), Bool())};
+    case core::Builtin::kOrd:
+      return {Function(Char(), Int())};
+    case core::Builtin::kReadInt:
+      return {Function(String(), Int())};
+    case core::Builtin::kShowInt:
+      return {Function(Int(), String())};
+  }
+  throw std::logic_error("unknown builtin");
+}
+
+// Adds every variable which is mentioned in `x` to `result`.
+void CollectVariables(const core::Expression& x,
+                      std::set<core::Identifier>& result) {
+  std::visit(
+      [&](const auto& x) {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, core::Identifier>) {
+          result.insert(x);
+        } else if constexpr (std::is_same_v<T, core::Tuple>) {
+          for (const auto& element : x.elements) {
+            CollectVariables(element, result);
+          }
+        } else if constexpr (std::is_same_v<T, core::Apply>) {
+          CollectVariables(x.f, result);
+          CollectVariables(x.x, result);
+        } else if constexpr (std::is_same_v<T, core::Lambda>) {
+          CollectVariables(x.result, result);
+        } else if constexpr (std::is_same_v<T, core::Let>) {
+          CollectVariables(x.binding.value, result);
+          CollectVariables(x.value, result);
+        } else if constexpr (std::is_same_v<T, core::LetRecursive>) {
+          for (const auto& binding : x.bindings) {
+            CollectVariables(binding.value, result);
+          }
+          CollectVariables(x.value, result);
+        } else if constexpr (std::is_same_v<T, core::Case>) {
+          CollectVariables(x.value, result);
+          for (const auto& alternative : x.alternatives) {
+            CollectVariables(alternative.value, result);
+          }
+        }
+      },
+      x->value);
+}
+
+// Splits the bindings of a letrec into strongly connected components of the
+// graph of references between them, using Tarjan's algorithm. Each component
+// comes after every component which it refers to.
+class Components {
+ public:
+  explicit Components(const core::LetRecursive& x)
+      : edges_(x.bindings.size()), states_(x.bindings.size()) {
+    std::map<core::Identifier, int> indices;
+    for (int i = 0, n = x.bindings.size(); i < n; i++) {
+      indices.emplace(x.bindings[i].variable, i);
+    }
+    for (int i = 0, n = x.bindings.size(); i < n; i++) {
+      std::set<core::Identifier> variables;
+      CollectVariables(x.bindings[i].value, variables);
+      for (core::Identifier variable : variables) {
+        auto j = indices.find(variable);
+        if (j != indices.end()) edges_[i].push_back(j->second);
+      }
+    }
+    for (int i = 0, n = x.bindings.size(); i < n; i++) {
+      if (states_[i].index == -1) Visit(i);
+    }
+  }
+
+  std::vector<std::vector<int>> result() && { return std::move(result_); }
+
+ private:
+  struct State {
+    int index = -1;
+    int low = 0;
+    bool on_stack = false;
+  };
+
+  void Visit(int i) {
+    states_[i] = {.index = next_index_, .low = next_index_, .on_stack = true};
+    next_index_++;
+    stack_.push_back(i);
+    for (int j : edges_[i]) {
+      if (states_[j].index == -1) {
+        Visit(j);
+        states_[i].low = std::min(states_[i].low, states_[j].low);
+      } else if (states_[j].on_stack) {
+        states_[i].low = std::min(states_[i].low, states_[j].index);
+      }
+    }
+    if (states_[i].low != states_[i].index) return;
+    std::vector<int> component;
+    while (true) {
+      const int j = stack_.back();
+      stack_.pop_back();
+      states_[j].on_stack = false;
+      component.push_back(j);
+      if (j == i) break;
+    }
+    std::ranges::sort(component);
+    result_.push_back(std::move(component));
+  }
+
+  std::vector<std::vector<int>> edges_;
+  std::vector<State> states_;
+  std::vector<int> stack_;
+  int next_index_ = 0;
+  std::vector<std::vector<int>> result_;
+};
+
+// Writes types in the same notation as the source language. Type variables
+// are named a, b, c, and so on, in the order in which they are first printed.
+class TypePrinter {
+ public:
+  explicit TypePrinter(const std::map<core::UnionType::Id, std::string>& names)
+      : names_(names) {}
+
+  std::string operator()(const core::Type& type) {
+    std::ostringstream output;
+    Print(output, type, Position::kTop);
+    return output.str();
+  }
+
+ private:
+  enum class Position {
+    kTop,
+    // The parameter of a function type.
+    kParameter,
+    // An argument of a union type.
+    kArgument,
+  };
+
+  void Print(std::ostream& output, const core::Type& type, Position position) {
+    switch (type.kind) {
+      case core::Type::Kind::kVariable: {
+        auto [i, is_new] = variables_.emplace(type.id, variables_.size());
+        output << (char)('a' + i->second % 26);
+        if (i->second >= 26) output << i->second / 26;
+        return;
+      }
+      case core::Type::Kind::kInt:
+        output << "Int";
+        return;
+      case core::Type::Kind::kChar:
+        output << "Char";
+        return;
+      case core::Type::Kind::kFunction:
+        if (position != Position::kTop) output << "(";
+        Print(output, type.arguments[0], Position::kParameter);
+        output << " -> ";
+        Print(output, type.arguments[1], Position::kTop);
+        if (position != Position::kTop) output << ")";
+        return;
+      case core::Type::Kind::kTuple:
+        output << "(";
+        for (int i = 0, n = type.arguments.size(); i < n; i++) {
+          if (i) output << ", ";
+          Print(output, type.arguments[i], Position::kTop);
+        }
+        output << ")";
+        return;
+      case core::Type::Kind::kUnion: {
+        const auto id = core::UnionType::Id(type.id);
+        if (id == core::UnionType::Id::kList) {
+          output << "[";
+          Print(output, type.arguments[0], Position::kTop);
+          output << "]";
+          return;
+        }
+        auto name = names_.find(id);
+        const bool parenthesise =
+            position == Position::kArgument && !type.arguments.empty();
+        if (parenthesise) output << "(";
+        if (name == names_.end()) {
+          output << "<type " << type.id << ">";
+        } else {
+          output << name->second;
+        }
+        for (const auto& argument : type.arguments) {
+          output << " ";
+          Print(output, argument, Position::kArgument);
+        }
+        if (parenthesise) output << ")";
+        return;
+      }
+    }
+  }
+
+  const std::map<core::UnionType::Id, std::string>& names_;
+  std::map<int, int> variables_;
+};
+
+class Inferrer {
+ public:
+  std::map<core::Identifier, core::Type> InferProgram(
+      const core::Expression& program, const core::Type& type) {
+    const core::Type actual = Infer(program);
+    context_ = std::nullopt;
+    if (!Unify(type, actual)) {
+      TypePrinter print(names_);
+      const std::string expected_string = print(type);
+      throw TypeError(std::nullopt,
+                      "the program has type " + print(Resolve(actual)) +
+                          ", but it should have type " + expected_string);
+    }
+    std::map<core::Identifier, core::Type> result;
+    for (const auto& [id, type] : types_) result.emplace(id, Resolve(type));
+    return result;
+  }
+
+ private:
+  // A type variable, which may have been unified with a type. Variables which
+  // were created inside a let binding and are not bound by the end of it are
+  // generalised, unless they have been unified with a variable from outside
+  // of it, which gives them a lower level.
+  struct TypeVariable {
+    std::optional<core::Type> binding;
+    int level;
+  };
+
+  core::Type Fresh() {
+    variables_.push_back({.binding = std::nullopt, .level = level_});
+    return Variable(variables_.size() - 1);
+  }
+
+  // Follows the bindings of type variables until reaching a type which is not
+  // a bound variable.
+  core::Type Prune(core::Type type) const {
+    while (type.kind == core::Type::Kind::kVariable && type.id >= 0 &&
+           variables_[type.id].binding) {
+      type = *variables_[type.id].binding;
+    }
+    return type;
+  }
+
+  // Replaces every bound variable in `type` with its binding.
+  core::Type Resolve(const core::Type& type) const {
+    core::Type result = Prune(type);
+    for (auto& argument : result.arguments) argument = Resolve(argument);
+    return result;
+  }
+
+  // Replaces the parameters of a polymorphic type with `arguments`.
+  core::Type Instantiate(const core::Type& type,
+                         std::span<const core::Type> arguments) const {
+    if (type.kind == core::Type::Kind::kVariable && type.id < 0) {
+      return arguments[-1 - type.id];
+    }
+    core::Type result = type;
+    for (auto& argument : result.arguments) {
+      argument = Instantiate(argument, arguments);
+    }
+    return result;
+  }
+
+  core::Type Instantiate(const Scheme& scheme) {
+    std::vector<core::Type> arguments;
+    for (int i = 0; i < scheme.num_parameters; i++) {
+      arguments.push_back(Fresh());
+    }
+    return Instantiate(scheme.type, arguments);
+  }
+
+  // Turns every unbound variable in `type` which was created at a deeper
+  // level than the current one into a parameter.
+  Scheme Generalize(const core::Type& type) const {
+    std::map<int, int> parameters;
+    core::Type result = Generalize(type, parameters);
+    return {std::move(result), (int)parameters.size()};
+  }
+
+  core::Type Generalize(const core::Type& type,
+                        std::map<int, int>& parameters) const {
+    core::Type result = Prune(type);
+    if (result.kind == core::Type::Kind::kVariable) {
+      if (variables_[result.id].level <= level_) return result;
+      auto [i, is_new] = parameters.emplace(result.id, parameters.size());
+      return Parameter(i->second);
+    }
+    for (auto& argument : result.arguments) {
+      argument = Generalize(argument, parameters);
+    }
+    return result;
+  }
+
+  // Checks that `variable` does not occur in `type`, and lowers the level of
+  // the variables in `type` to that of `variable`, which they now belong to.
+  bool Adjust(int variable, const core::Type& type) {
+    const core::Type t = Prune(type);
+    if (t.kind == core::Type::Kind::kVariable) {
+      if (t.id == variable) return false;
+      variables_[t.id].level =
+          std::min(variables_[t.id].level, variables_[variable].level);
+      return true;
+    }
+    return std::ranges::all_of(t.arguments, [&](const core::Type& argument) {
+      return Adjust(variable, argument);
+    });
+  }
+
+  bool Unify(const core::Type& a, const core::Type& b) {
+    const core::Type x = Prune(a), y = Prune(b);
+    if (x.kind == core::Type::Kind::kVariable) {
+      if (y.kind == core::Type::Kind::kVariable && y.id == x.id) return true;
+      if (!Adjust(x.id, y)) return false;
+      variables_[x.id].binding = y;
+      return true;
+    }
+    if (y.kind == core::Type::Kind::kVariable) return Unify(y, x);
+    if (x.kind != y.kind || x.id != y.id ||
+        x.arguments.size() != y.arguments.size()) {
+      return false;
+    }
+    for (int i = 0, n = x.arguments.size(); i < n; i++) {
+      if (!Unify(x.arguments[i], y.arguments[i])) return false;
+    }
+    return true;
+  }
+
+  void Expect(const core::Type& expected, const core::Type& actual) {
+    if (Unify(expected, actual)) return;
+    TypePrinter print(names_);
+    const std::string expected_string = print(Resolve(expected));
+    throw TypeError(context_, "type mismatch: expected " + expected_string +
+                                  ", got " + print(Resolve(actual)));
+  }
+
+  void Bind(core::Identifier id, Scheme scheme) {
+    types_.insert_or_assign(id, scheme.type);
+    environment_.insert_or_assign(id, std::move(scheme));
+  }
+
+  core::Type Infer(const core::Builtin& x) {
+    return Instantiate(BuiltinScheme(x));
+  }
+
+  core::Type Infer(const core::Identifier& x) {
+    auto i = environment_.find(x);
+    if (i == environment_.end()) {
+      throw std::logic_error("variable used outside of its scope");
+    }
+    return Instantiate(i->second);
+  }
+
+  core::Type Infer(const core::Integer&) { return Int(); }
+  core::Type Infer(const core::Character&) { return Char(); }
+
+  core::Type Infer(const core::Tuple& x) {
+    std::vector<core::Type> elements;
+    for (const auto& element : x.elements) elements.push_back(Infer(element));
+    return Tuple(std::move(elements));
+  }
+
+  // Returns the type of the union which `type` is an alternative of, applied
+  // to fresh variables, which are also stored in `arguments`.
+  core::Type InstantiateUnion(const core::UnionType& type,
+                              std::vector<core::Type>& arguments) {
+    names_.emplace(type.id, type.name);
+    for (int i = 0; i < type.num_parameters; i++) arguments.push_back(Fresh());
+    return Union(type.id, arguments);
+  }
+
+  core::Type Infer(const core::UnionConstructor& x) {
+    std::vector<core::Type> arguments;
+    core::Type result = InstantiateUnion(*x.type, arguments);
+    const auto& members = x.type->alternatives.at(x.index).members;
+    for (int i = members.size() - 1; i >= 0; i--) {
+      result = Function(Instantiate(members[i], arguments), std::move(result));
+    }
+    return result;
+  }
+
+  core::Type Infer(const core::Apply& x) {
+    const core::Type f = Infer(x.f);
+    const core::Type argument = Infer(x.x);
+    const core::Type function = Prune(f);
+    if (function.kind == core::Type::Kind::kFunction) {
+      Expect(function.arguments[0], argument);
+      return function.arguments[1];
+    }
+    const core::Type result = Fresh();
+    if (!Unify(function, Function(argument, result))) {
+      TypePrinter print(names_);
+      const std::string function_string = print(Resolve(function));
+      throw TypeError(context_, "cannot apply a value of type " +
+                                    function_string + " to a value of type " +
+                                    print(Resolve(argument)));
+    }
+    return result;
+  }
+
+  core::Type Infer(const core::Lambda& x) {
+    const auto outer = context_;
+    context_ = x.parameter;
+    const core::Type parameter = Fresh();
+    Bind(x.parameter, {parameter});
+    core::Type result = Function(parameter, Infer(x.result));
+    context_ = outer;
+    return result;
+  }
+
+  core::Type Infer(const core::Let& x) {
+    const auto outer = context_;
+    context_ = x.binding.variable;
+    level_++;
+    const core::Type value = Infer(x.binding.value);
+    level_--;
+    context_ = outer;
+    Bind(x.binding.variable, Generalize(value));
+    return Infer(x.value);
+  }
+
+  core::Type Infer(const core::LetRecursive& x) {
+    const auto outer = context_;
+    for (const auto& component : Components(x).result()) {
+      level_++;
+      std::vector<core::Type> types;
+      for (int i : component) {
+        types.push_back(Fresh());
+        Bind(x.bindings[i].variable, {types.back()});
+      }
+      for (int j = 0, n = component.size(); j < n; j++) {
+        const core::Binding& binding = x.bindings[component[j]];
+        context_ = binding.variable;
+        Expect(types[j], Infer(binding.value));
+      }
+      level_--;
+      for (int j = 0, n = component.size(); j < n; j++) {
+        Bind(x.bindings[component[j]].variable, Generalize(types[j]));
+      }
+    }
+    context_ = outer;
+    return Infer(x.value);
+  }
+
+  void InferPattern(const core::Identifier& x, const core::Type& value) {
+    context_ = x;
+    Bind(x, {value});
+  }
+
+  void InferPattern(const core::MatchTuple& x, const core::Type& value) {
+    std::vector<core::Type> elements;
+    for (int i = 0, n = x.elements.size(); i < n; i++) {
+      elements.push_back(Fresh());
+    }
+    Expect(Tuple(elements), value);
+    for (int i = 0, n = x.elements.size(); i < n; i++) {
+      InferPattern(x.elements[i], elements[i]);
+    }
+  }
+
+  void InferPattern(const core::MatchUnion& x, const core::Type& value) {
+    std::vector<core::Type> arguments;
+    Expect(InstantiateUnion(*x.type, arguments), value);
+    const auto& members = x.type->alternatives.at(x.index).members;
+    for (int i = 0, n = x.elements.size(); i < n; i++) {
+      InferPattern(x.elements[i], Instantiate(members.at(i), arguments));
+    }
+  }
+
+  void InferPattern(const core::Integer&, const core::Type& value) {
+    Expect(Int(), value);
+  }
+
+  void InferPattern(const core::Character&, const core::Type& value) {
+    Expect(Char(), value);
+  }
+
+  core::Type Infer(const core::Case& x) {
+    const auto outer = context_;
+    const core::Type value = Infer(x.value);
+    const core::Type result = Fresh();
+    for (const auto& alternative : x.alternatives) {
+      std::visit([&](const auto& p) { InferPattern(p, value); },
+                 alternative.pattern->value);
+      Expect(result, Infer(alternative.value));
+      context_ = outer;
+    }
+    return result;
+  }
+
+  core::Type Infer(const core::Expression& x) {
+    return std::visit([&](const auto& x) { return Infer(x); }, x->value);
+  }
+
+  std::vector<TypeVariable> variables_;
+  std::map<core::Identifier, Scheme> environment_;
+  std::map<core::Identifier, core::Type> types_;
+  std::map<core::UnionType::Id, std::string> names_;
+  int level_ = 0;
+  std::optional<core::Identifier> context_;
+};
+
+}  // namespace
+
+std::map<core::Identifier, core::Type> InferTypes(
+    const core::Expression& program, const core::Type& type) {
+  return Inferrer().InferProgram(program, type);
+}
+
+}  // namespace aoc2022
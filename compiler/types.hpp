@@ -0,0 +1,32 @@
+#ifndef AOC2022_TYPES_HPP_
+#define AOC2022_TYPES_HPP_
+
+#include "core.hpp"
+
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+namespace aoc2022 {
+
+// A type error, which is attributed to the innermost variable whose binding
+// contains it, if there is one.
+class TypeError : public std::runtime_error {
+ public:
+  TypeError(std::optional<core::Identifier> context,
+            const std::string& message)
+      : runtime_error(message), context(context) {}
+  std::optional<core::Identifier> context;
+};
+
+// Infers the most general type of every variable bound in `program` using
+// Hindley-Milner type inference, where the program as a whole must have type
+// `type`. Each group of mutually recursive bindings is generalised on its own,
+// so a function may be used at several types once it has been defined.
+std::map<core::Identifier, core::Type> InferTypes(
+    const core::Expression& program, const core::Type& type);
+
+}  // namespace aoc2022
+
+#endif  // AOC2022_TYPES_HPP_